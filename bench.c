@@ -0,0 +1,905 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	bench.c
+ * @brief 	Microbenchmarks of the block device layer.
+ * @date	01/03/2017
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef FS_THREADS
+#include <pthread.h>
+#endif
+#include "include/blocks_cache.h"
+#include "include/filesystem.h"
+#include "include/auxiliary.h"
+
+#define BENCH_DEVICE "bench.dat"	// Scratch device used by the benchmarks
+#define BENCH_BLOCKS 512			// Number of blocks of the scratch device
+#define BENCH_ROUNDS 20				// Passes over the whole device per benchmark
+#define BENCH_FILE_SIZE (30 * BLOCK_SIZE)	// Size of the file read by the streaming benchmark
+#define BENCH_CHUNK 256				// Bytes per readFile call of the streaming benchmark
+#define OPEN_READERS 8				// Descriptors of the same file of the open benchmark
+#define SCALE_DEVICE "scale.dat"	// Sparse device of the scale benchmark
+#define SCALE_SIZE (4L << 30)		// Size of the sparse device, in bytes
+#define SCALE_FILES 200000			// Files created by the scale benchmark
+#define SCALE_FILE_SIZE (64 << 20)	// Size of the file written by the scale benchmark
+#define TREE_EXTENTS 20000			// Extents of the file of the extent tree benchmark
+#define DIR_ENTRIES 100000			// Entries of the directory of the directory benchmark
+#define SMALL_FILES 10000			// Files of the small file benchmark
+#define SMALL_FILE_SIZE 50			// Size of every file of the small file benchmark
+#define APPEND_SIZE 100				// Bytes per writeFile call of the append benchmark
+#define RECORD_HEADER 16			// Header of a record of the record benchmark
+#define RECORD_PAYLOAD 100			// Payload of a record of the record benchmark
+#define THREAD_MAX 8				// Most threads of the concurrency benchmark
+#define THREAD_FILE_SIZE (32 * BLOCK_SIZE)	// Size of every file read by the concurrency benchmark
+#define THREAD_READS 20000			// readFileAt calls of every thread of the concurrency benchmark
+#define THREAD_CHUNK 4096			// Bytes per readFileAt call of the concurrency benchmark
+
+/**
+ * Creates the scratch device filled with zeros
+ *
+ * @return 0 if success and -1 otherwise
+ */
+int createDevice(char *deviceName, int blocks){
+	char block[BLOCK_SIZE];
+	memset(block, 0, BLOCK_SIZE);
+	FILE *f = fopen(deviceName, "w");
+	if(f == NULL){ return -1;}
+	for(int i = 0; i < blocks; i++){
+		if(fwrite(block, BLOCK_SIZE, 1, f) != 1){ fclose(f); return -1;}
+	}
+	fclose(f);
+	return 0;
+}
+
+/**
+ * Returns the current monotonic time in nanoseconds
+ */
+double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Reads and writes every block of the scratch device BENCH_ROUNDS times
+ * and prints the syscalls and latency per block
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchBlocks(char *label){
+	char block[BLOCK_SIZE];
+	bstats_t st;
+
+	bresetstats();
+	double start = now();
+	for(int r = 0; r < BENCH_ROUNDS; r++){
+		for(int i = 0; i < BENCH_BLOCKS; i++){
+			if(bread(BENCH_DEVICE, i, block) < 0){ return -1;}
+		}
+	}
+	double readTime = now() - start;
+	bgetstats(&st);
+	double readCalls = (double) st.syscalls / st.reads;
+
+	bresetstats();
+	start = now();
+	for(int r = 0; r < BENCH_ROUNDS; r++){
+		for(int i = 0; i < BENCH_BLOCKS; i++){
+			if(bwrite(BENCH_DEVICE, i, block) < 0){ return -1;}
+		}
+	}
+	double writeTime = now() - start;
+	bgetstats(&st);
+	double writeCalls = (double) st.syscalls / st.writes;
+
+	int n = BENCH_ROUNDS * BENCH_BLOCKS;
+	printf("%-20s bread: %5.2f syscalls/block %9.0f ns/block | bwrite: %5.2f syscalls/block %9.0f ns/block\n",
+		   label, readCalls, readTime / n, writeCalls, writeTime / n);
+	return 0;
+}
+
+/**
+ * Reads a working set of hot blocks, as metadata accesses do, and prints
+ * the cache counters and latency per block
+ *
+ * @param label: name of the benchmark
+ * @param hot: number of distinct blocks of the working set
+ * @return 0 if success and -1 otherwise
+ */
+int benchHot(char *label, int hot){
+	char block[BLOCK_SIZE];
+	bstats_t st;
+
+	bresetstats();
+	double start = now();
+	for(int r = 0; r < BENCH_ROUNDS * 16; r++){
+		for(int i = 0; i < hot; i++){
+			if(bread(BENCH_DEVICE, (i * 7) % BENCH_BLOCKS, block) < 0){ return -1;}
+		}
+	}
+	double time = now() - start;
+	bgetstats(&st);
+
+	printf("%-20s %d hot blocks: %7lu hits %5lu misses %5lu evictions %5.2f syscalls/block %6.0f ns/block\n",
+		   label, hot, st.hits, st.misses, st.evictions, (double) st.syscalls / st.reads, time / st.reads);
+	return 0;
+}
+
+/**
+ * Reads and writes the whole device as one file of BENCH_BLOCKS blocks
+ * with one vectored call and prints the syscalls and latency per block
+ *
+ * @param label: name of the benchmark
+ * @param stride: distance between consecutive blocks of the file
+ *
+ * @return 0 if success and -1 otherwise
+ */
+int benchVector(char *label, int stride){
+	static char data[BENCH_BLOCKS][BLOCK_SIZE];
+	int blocks[BENCH_BLOCKS];
+	char *buffers[BENCH_BLOCKS];
+	bstats_t st;
+
+	/* stride 1 is a contiguous file, larger strides fragment it */
+	for(int i = 0; i < BENCH_BLOCKS; i++){
+		blocks[i] = (i * stride) % BENCH_BLOCKS + (i * stride) / BENCH_BLOCKS;
+		buffers[i] = data[i];
+	}
+
+	bresetstats();
+	double start = now();
+	for(int r = 0; r < BENCH_ROUNDS; r++){
+		if(breadv(BENCH_DEVICE, blocks, buffers, BENCH_BLOCKS) < 0){ return -1;}
+	}
+	double readTime = now() - start;
+	bgetstats(&st);
+	double readCalls = (double) st.syscalls / st.reads;
+
+	bresetstats();
+	start = now();
+	for(int r = 0; r < BENCH_ROUNDS; r++){
+		if(bwritev(BENCH_DEVICE, blocks, buffers, BENCH_BLOCKS) < 0){ return -1;}
+	}
+	double writeTime = now() - start;
+	bgetstats(&st);
+	double writeCalls = (double) st.syscalls / st.writes;
+
+	int n = BENCH_ROUNDS * BENCH_BLOCKS;
+	printf("%-14s stride %d breadv: %5.3f syscalls/block %8.0f ns/block | bwritev: %5.3f syscalls/block %8.0f ns/block\n",
+		   label, stride, readCalls, readTime / n, writeCalls, writeTime / n);
+	return 0;
+}
+
+/**
+ * Reads a file front to back in small chunks with a cold cache, as log
+ * scanners do, and prints the block I/O per chunk and latency per chunk
+ *
+ * @param label: name of the benchmark
+ * @param fileName: file read, BENCH_FILE_SIZE bytes
+ * @return 0 if success and -1 otherwise
+ */
+int benchStream(char *label, char *fileName){
+	static char data[BENCH_FILE_SIZE];
+	bstats_t st;
+	int chunks = 0;
+	double time = 0;
+
+	bresetstats();
+	for(int r = 0; r < BENCH_ROUNDS; r++){
+		/* drop the cached blocks of the previous pass */
+		if(bsetcache(CACHE_DEFAULT_BLOCKS, CACHE_LRU) < 0){ return -1;}
+		double start = now();
+		int fd = openFile(fileName);
+		if(fd < 0){ return -1;}
+		for(int offset = 0; offset < BENCH_FILE_SIZE; offset += BENCH_CHUNK){
+			if(readFile(fd, data + offset, BENCH_CHUNK) != BENCH_CHUNK){ return -1;}
+			chunks++;
+		}
+		if(closeFile(fd) < 0){ return -1;}
+		time += now() - start;
+	}
+	bgetstats(&st);
+
+	printf("%-20s %d B chunks: %5.3f reads/chunk %5.3f misses/chunk %5.3f prefetched/chunk %5.3f syscalls/chunk %6.0f ns/chunk\n",
+		   label, BENCH_CHUNK, (double) st.reads / chunks, (double) st.misses / chunks,
+		   (double) st.prefetched / chunks, (double) st.syscalls / chunks, time / chunks);
+	return 0;
+}
+
+/**
+ * Calls lseekFile, the cheapest entry point, in a loop and prints its latency,
+ * which is mostly the cost of the counters of fsGetStats
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchProbe(char *label){
+	int calls = BENCH_ROUNDS * 50000;
+	int fd = openFile("stream.log");
+	if(fd < 0){ return -1;}
+	double start = now();
+	for(int i = 0; i < calls; i++){
+		if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0){ return -1;}
+	}
+	double time = now() - start;
+	if(closeFile(fd) < 0){ return -1;}
+	printf("%-20s lseekFile: %5.1f ns/call\n", label, time / calls);
+	return 0;
+}
+
+/**
+ * Opens and closes a file in a loop, then reads it in chunks from OPEN_READERS
+ * descriptors in turn, and prints the latency and the block writes of an open
+ * and a close and the block reads per chunk
+ *
+ * @param label: name of the benchmark
+ * @param fileName: file of BENCH_FILE_SIZE bytes
+ * @return 0 if success and -1 otherwise
+ */
+int benchOpen(char *label, char *fileName){
+	int calls = BENCH_ROUNDS * 5000, fds[OPEN_READERS], chunks = 0;
+	char buf[BENCH_CHUNK];
+	bstats_t st;
+	bresetstats();
+	double start = now();
+	for(int i = 0; i < calls; i++){
+		int fd = openFile(fileName);
+		if(fd < 0 || closeFile(fd) < 0){ return -1;}
+	}
+	double time = now() - start;
+	bgetstats(&st);
+	unsigned long writes = st.writes;
+	for(int r = 0; r < OPEN_READERS; r++){
+		if((fds[r] = openFile(fileName)) < 0){ return -1;}
+	}
+	bresetstats();
+	for(int offset = 0; offset < BENCH_FILE_SIZE; offset += BENCH_CHUNK){
+		for(int r = 0; r < OPEN_READERS; r++, chunks++){
+			if(readFile(fds[r], buf, BENCH_CHUNK) != BENCH_CHUNK){ return -1;}
+		}
+	}
+	bgetstats(&st);
+	for(int r = 0; r < OPEN_READERS; r++){
+		if(closeFile(fds[r]) < 0){ return -1;}
+	}
+	printf("%-20s open+close %5.0f ns %4.2f block writes | %d readers in turn: %5.3f reads/chunk %5.3f misses/chunk\n",
+		   label, time / calls, (double) writes / calls, OPEN_READERS, (double) st.reads / chunks,
+		   (double) st.misses / chunks);
+	return 0;
+}
+
+/**
+ * Prints the counters of fsGetStats of every entry point called, with the
+ * latency bucket that holds the median call
+ *
+ * @return 0 if success and -1 otherwise
+ */
+int benchReport(void){
+	static char *names[FS_OP_COUNT] = {"mkFS", "mountFS", "unmountFS", "createFile", "removeFile",
+									   "openFile", "closeFile", "readFile", "writeFile", "lseekFile",
+									   "makeDir", "removeDir", "readDir"};
+	fs_stats_t st;
+	if(fsGetStats(&st) < 0){
+		printf("fsGetStats not available (built without FS_STATS)\n");
+		return 0;
+	}
+	for(int op = 0; op < FS_OP_COUNT; op++){
+		fs_op_stats_t *c = &st.op[op];
+		if(c->calls == 0){ continue;}
+		unsigned long seen = 0;
+		int median = 0;
+		while(median < FS_LATENCY_BUCKETS - 1 && (seen += c->latency[median]) * 2 < c->calls){
+			median++;
+		}
+		printf("%-20s %8lu calls %8.1f B/call %6.3f block reads/call %6.3f block writes/call  median < %lu ns\n",
+			   names[op], c->calls, (double) c->bytes / c->calls, (double) c->blockReads / c->calls,
+			   (double) c->blockWrites / c->calls, 2UL << median);
+	}
+	return 0;
+}
+
+/**
+ * Fills the file system up to its inode limit and looks names up, as
+ * createFile, openFile and removeFile do, and prints the latency per lookup
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchLookup(char *label){
+	static char names[1024][32];
+	int files = 1, lookups = BENCH_ROUNDS * 50000;
+	strcpy(names[0], "stream.log");
+	while(files < 1024){
+		sprintf(names[files], "file%d.log", files);
+		if(createFile(names[files]) < 0){ break;}
+		files++;
+	}
+	double start = now();
+	for(int i = 0; i < lookups; i++){
+		if(getInodePosition(names[i % files]) < 0){ return -1;}
+	}
+	double time = now() - start;
+	printf("%-20s %d files: %6.1f ns/lookup\n", label, files, time / lookups);
+	return 0;
+}
+
+/**
+ * Allocates every data block of a new file system one at a time, then all of
+ * them in a single allocN call, and prints the latency and writes per block
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchAlloc(char *label){
+	static int blocks[BENCH_BLOCKS * 2];
+	bstats_t st;
+	int n = 0;
+
+	if(mkFS(BENCH_BLOCKS * BLOCK_SIZE) < 0 || mountFS() < 0){ return -1;}
+	bresetstats();
+	double start = now();
+	while(n < BENCH_BLOCKS * 2 && (blocks[n] = alloc()) >= 0){
+		n++;
+	}
+	double oneTime = now() - start;
+	bgetstats(&st);
+	if(unmountFS() < 0){ return -1;}
+
+	if(mkFS(BENCH_BLOCKS * BLOCK_SIZE) < 0 || mountFS() < 0){ return -1;}
+	start = now();
+	if(allocN(n, blocks) < 0){ return -1;}
+	double nTime = now() - start;
+	if(unmountFS() < 0){ return -1;}
+
+	printf("%-20s %d blocks: alloc %7.1f ns/block %4.2f writes/block | allocN %5.1f ns/block\n",
+		   label, n, oneTime / n, (double) st.writes / n, nTime / n);
+	return 0;
+}
+
+/**
+ * Creates and removes files in a loop, as a mail spool does, and prints the
+ * block writes and system calls per operation, including the final flush
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchMeta(char *label){
+	char name[32];
+	bstats_t st;
+	int ops = 0;
+	if(mkFS(BENCH_BLOCKS * BLOCK_SIZE) < 0 || mountFS() < 0){ return -1;}
+	bresetstats();
+	double start = now();
+	for(int r = 0; r < BENCH_ROUNDS; r++){
+		for(int i = 0; i < 32; i++){
+			sprintf(name, "spool%d", i);
+			if(createFile(name) < 0){ return -1;}
+		}
+		for(int i = 0; i < 32; i++){
+			sprintf(name, "spool%d", i);
+			if(removeFile(name) < 0){ return -1;}
+		}
+		ops += 64;
+	}
+	if(bflush() < 0){ return -1;}
+	double time = now() - start;
+	bgetstats(&st);
+	printf("%-20s %d ops: %5.2f block writes/op %5.3f syscalls/op %6.0f ns/op\n",
+		   label, ops, (double) st.writes / ops, (double) st.syscalls / ops, time / ops);
+	return unmountFS();
+}
+
+/**
+ * Appends APPEND_SIZE bytes at a time to a log as large as half the scratch
+ * device, and prints the block I/O and latency per append
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchAppend(char *label){
+	char line[APPEND_SIZE];
+	bstats_t st;
+	memset(line, 'l', sizeof(line));
+	if(mkFS(BENCH_BLOCKS * BLOCK_SIZE) < 0 || mountFS() < 0 || createFile("append.log") < 0){ return -1;}
+	int fd = openFile("append.log");
+	if(fd < 0){ return -1;}
+	long appends = (long) BENCH_BLOCKS / 2 * BLOCK_SIZE / APPEND_SIZE;
+	bresetstats();
+	double start = now();
+	for(long i = 0; i < appends; i++){
+		if(writeFile(fd, line, APPEND_SIZE) != APPEND_SIZE){ return -1;}
+	}
+	if(closeFile(fd) < 0){ return -1;}
+	double time = now() - start;
+	bgetstats(&st);
+	printf("%-20s %ld x %d B: %5.3f block reads/append %5.3f block writes/append %6.0f ns/append\n",
+		   label, appends, APPEND_SIZE, (double) st.reads / appends, (double) st.writes / appends, time / appends);
+	return unmountFS();
+}
+
+/**
+ * Overwrites a file with records of a header and a payload, first with one
+ * writeFile for each and then with one writeFileV per record, and prints the
+ * block I/O and latency per record
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchRecords(char *label){
+	char header[RECORD_HEADER], payload[RECORD_PAYLOAD];
+	struct iovec iov[2] = {{header, RECORD_HEADER}, {payload, RECORD_PAYLOAD}};
+	bstats_t st, stV;
+	long records = (long) BENCH_BLOCKS / 2 * BLOCK_SIZE / (RECORD_HEADER + RECORD_PAYLOAD);
+	long size = records * (RECORD_HEADER + RECORD_PAYLOAD);
+	char *data = calloc(1, size);
+	memset(header, 'h', sizeof(header));
+	memset(payload, 'p', sizeof(payload));
+	if(data == NULL || mkFS(BENCH_BLOCKS * BLOCK_SIZE) < 0 || mountFS() < 0 || createFile("records.log") < 0){ return -1;}
+	int fd = openFile("records.log");
+	if(fd < 0 || writeFile(fd, data, size) != size || closeFile(fd) < 0 || (fd = openFile("records.log")) < 0){ return -1;}
+	free(data);
+
+	bresetstats();
+	double start = now();
+	for(long i = 0; i < records; i++){
+		if(writeFile(fd, header, RECORD_HEADER) != RECORD_HEADER || writeFile(fd, payload, RECORD_PAYLOAD) != RECORD_PAYLOAD){ return -1;}
+	}
+	double time = now() - start;
+	bgetstats(&st);
+
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0){ return -1;}
+	bresetstats();
+	start = now();
+	for(long i = 0; i < records; i++){
+		if(writeFileV(fd, iov, 2) != RECORD_HEADER + RECORD_PAYLOAD){ return -1;}
+	}
+	double timeV = now() - start;
+	bgetstats(&stV);
+	if(closeFile(fd) < 0){ return -1;}
+	printf("%-20s %ld x %d+%d B: writeFile x2 %5.3f block reads %5.3f block writes %6.0f ns | writeFileV %5.3f block reads %5.3f block writes %6.0f ns\n",
+		   label, records, RECORD_HEADER, RECORD_PAYLOAD, (double) st.reads / records, (double) st.writes / records, time / records,
+		   (double) stV.reads / records, (double) stV.writes / records, timeV / records);
+	return unmountFS();
+}
+
+/**
+ * Formats a sparse device of SCALE_SIZE bytes, creates SCALE_FILES files,
+ * mounts it again, looks the names up and writes and reads a file of
+ * SCALE_FILE_SIZE bytes, and prints the cost of every step
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchScale(char *label){
+	char name[32];
+	bstats_t st;
+	int fd = open(SCALE_DEVICE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0 || ftruncate(fd, SCALE_SIZE) < 0){ return -1;}
+	close(fd);
+	if(setDevice(SCALE_DEVICE, DEVICE_FD) < 0){ return -1;}
+
+	double start = now();
+	if(mkFS(SCALE_SIZE) < 0 || mountFS() < 0){ return -1;}
+	double mkfsTime = now() - start;
+
+	start = now();
+	for(int i = 0; i < SCALE_FILES; i++){
+		sprintf(name, "scale%d", i);
+		if(createFile(name) < 0){ return -1;}
+	}
+	double createTime = now() - start;
+	if(unmountFS() < 0){ return -1;}
+
+	bresetstats();
+	start = now();
+	if(mountFS() < 0){ return -1;}
+	double mountTime = now() - start;
+	bgetstats(&st);
+
+	int lookups = BENCH_ROUNDS * 50000;
+	start = now();
+	for(int i = 0; i < lookups; i++){
+		sprintf(name, "scale%d", (int) ((i * 2654435761u) % SCALE_FILES));
+		if(getInodePosition(name) < 0){ return -1;}
+	}
+	double lookupTime = now() - start;
+
+	char *data = calloc(1, SCALE_FILE_SIZE);
+	if(data == NULL || removeFile("scale0") < 0 || createFile("big") < 0 || (fd = openFile("big")) < 0){ return -1;}
+	start = now();
+	if(writeFile(fd, data, SCALE_FILE_SIZE) != SCALE_FILE_SIZE || closeFile(fd) < 0){ return -1;}
+	double writeTime = now() - start;
+	if((fd = openFile("big")) < 0){ return -1;}
+	start = now();
+	if(readFile(fd, data, SCALE_FILE_SIZE) != SCALE_FILE_SIZE || closeFile(fd) < 0){ return -1;}
+	double readTime = now() - start;
+	free(data);
+	if(unmountFS() < 0){ return -1;}
+	remove(SCALE_DEVICE);
+
+	printf("%-20s %ld MiB: mkFS %5.0f ms | %d creates %5.0f ns/op | mount %5.1f ms %lu block reads"
+		   " | lookup %5.0f ns | %d MiB file write %5.0f MB/s read %5.0f MB/s\n",
+		   label, SCALE_SIZE >> 20, mkfsTime / 1e6, SCALE_FILES, createTime / SCALE_FILES,
+		   mountTime / 1e6, st.reads, lookupTime / lookups, SCALE_FILE_SIZE >> 20,
+		   SCALE_FILE_SIZE / (writeTime / 1e3), SCALE_FILE_SIZE / (readTime / 1e3));
+	return 0;
+}
+
+/**
+ * Writes a file of TREE_EXTENTS blocks in the sparse device after leaving a
+ * hole every other block of the map, so that each block is an extent, and
+ * prints the block reads and latency of a bmap, which follow the depth of its
+ * extent tree, and of a random one-block read of the open file, with lseekFile
+ * and readFile and with readFileAt
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchTree(char *label){
+	char name[32];
+	bstats_t st;
+	char *data = malloc((long) TREE_EXTENTS * BLOCK_SIZE);
+	int fd = open(SCALE_DEVICE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(data == NULL || fd < 0 || ftruncate(fd, SCALE_SIZE) < 0){ return -1;}
+	close(fd);
+	if(setDevice(SCALE_DEVICE, DEVICE_FD) < 0 || mkFS(SCALE_SIZE) < 0 || mountFS() < 0){ return -1;}
+	memset(data, 't', (long) TREE_EXTENTS * BLOCK_SIZE);
+	for(int i = 0; i < 2 * TREE_EXTENTS; i++){
+		sprintf(name, "hole%d", i);
+		if(createFile(name) < 0 || (fd = openFile(name)) < 0){ return -1;}
+		if(writeFile(fd, data, BLOCK_SIZE) != BLOCK_SIZE || closeFile(fd) < 0){ return -1;}
+	}
+	for(int i = 0; i < 2 * TREE_EXTENTS; i += 2){
+		sprintf(name, "hole%d", i);
+		if(removeFile(name) < 0){ return -1;}
+	}
+	/* the allocator starts over from the first hole */
+	if(unmountFS() < 0 || mountFS() < 0){ return -1;}
+	if(createFile("tree") < 0 || (fd = openFile("tree")) < 0){ return -1;}
+	if(writeFile(fd, data, TREE_EXTENTS * BLOCK_SIZE) != TREE_EXTENTS * BLOCK_SIZE || closeFile(fd) < 0){ return -1;}
+
+	/* the file is closed: a bmap reads every node from the root to a leaf */
+	int lookups = BENCH_ROUNDS * 10000;
+	bresetstats();
+	double start = now();
+	for(int i = 0; i < lookups; i++){
+		if(bmap(fd, (long) ((i * 2654435761u) % TREE_EXTENTS) * BLOCK_SIZE) < 0){ return -1;}
+	}
+	double lookupTime = now() - start;
+	bgetstats(&st);
+	double lookupReads = (double) st.reads / lookups;
+
+	/* open, the root stays in memory */
+	if((fd = openFile("tree")) < 0){ return -1;}
+	bresetstats();
+	start = now();
+	for(int i = 0; i < lookups; i++){
+		long offset = (long) ((i * 2654435761u) % TREE_EXTENTS) * BLOCK_SIZE;
+		if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || lseekFile(fd, offset, FS_SEEK_CUR) < 0){ return -1;}
+		if(readFile(fd, data, BLOCK_SIZE) != BLOCK_SIZE){ return -1;}
+	}
+	double readTime = now() - start;
+	bgetstats(&st);
+
+	/* the same reads at their offset, without moving the seek pointer */
+	start = now();
+	for(int i = 0; i < lookups; i++){
+		long offset = (long) ((i * 2654435761u) % TREE_EXTENTS) * BLOCK_SIZE;
+		if(readFileAt(fd, data, BLOCK_SIZE, offset) != BLOCK_SIZE){ return -1;}
+	}
+	double readAtTime = now() - start;
+	if(closeFile(fd) < 0 || unmountFS() < 0){ return -1;}
+	remove(SCALE_DEVICE);
+	free(data);
+	printf("%-20s %d extents: bmap %5.0f ns %4.2f block reads | random 2 KiB read %5.0f ns %4.2f block reads"
+		   " | readFileAt %5.0f ns\n", label, TREE_EXTENTS, lookupTime / lookups, lookupReads,
+		   readTime / lookups, (double) st.reads / lookups, readAtTime / lookups);
+	return 0;
+}
+
+/**
+ * Creates DIR_ENTRIES files in one directory of the sparse device and, each
+ * time the directory grows tenfold, prints the latency and block reads of a
+ * lookup, which follow the height of the B+tree of the directory
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchDir(char *label){
+	char name[48];
+	bstats_t st;
+	int fd = open(SCALE_DEVICE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0 || ftruncate(fd, SCALE_SIZE) < 0){ return -1;}
+	close(fd);
+	if(setDevice(SCALE_DEVICE, DEVICE_FD) < 0 || mkFS(SCALE_SIZE) < 0 || mountFS() < 0){ return -1;}
+	if(makeDir("big") < 0){ return -1;}
+
+	int entries = 0;
+	double createTime = 0;
+	printf("%-20s", label);
+	for(int step = 1000; step <= DIR_ENTRIES; step *= 10){
+		double start = now();
+		for(; entries < step; entries++){
+			sprintf(name, "big/entry%d", entries);
+			if(createFile(name) < 0){ return -1;}
+		}
+		createTime += now() - start;
+
+		int lookups = BENCH_ROUNDS * 10000;
+		bresetstats();
+		start = now();
+		for(int i = 0; i < lookups; i++){
+			sprintf(name, "big/entry%d", (int) ((i * 2654435761u) % entries));
+			if(getInodePosition(name) < 0){ return -1;}
+		}
+		double lookupTime = now() - start;
+		bgetstats(&st);
+		printf(" %6d entries: lookup %5.0f ns %4.2f block reads |", entries, lookupTime / lookups,
+			   (double) st.reads / lookups);
+	}
+	printf(" create %5.0f ns/op\n", createTime / entries);
+	if(unmountFS() < 0){ return -1;}
+	remove(SCALE_DEVICE);
+	return 0;
+}
+
+/**
+ * Writes SMALL_FILES files of SMALL_FILE_SIZE bytes in the sparse device,
+ * mounts it again, reads all of them back, and prints the data blocks they
+ * take and the block reads and latency of a read
+ *
+ * @param label: name of the benchmark
+ * @return 0 if success and -1 otherwise
+ */
+int benchSmall(char *label){
+	char name[32], data[SMALL_FILE_SIZE];
+	struct stat image;
+	fs_stats_t st;
+	memset(data, 's', sizeof(data));
+	int fd = open(SCALE_DEVICE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0 || ftruncate(fd, SCALE_SIZE) < 0){ return -1;}
+	close(fd);
+	if(setDevice(SCALE_DEVICE, DEVICE_FD) < 0 || mkFS(SCALE_SIZE) < 0 || mountFS() < 0){ return -1;}
+	/* the space of the sparse image taken by the format */
+	if(stat(SCALE_DEVICE, &image) < 0){ return -1;}
+	long formatted = image.st_blocks * 512L;
+
+	fsResetStats();
+	for(int i = 0; i < SMALL_FILES; i++){
+		sprintf(name, "small%d.cfg", i);
+		if(createFile(name) < 0 || (fd = openFile(name)) < 0){ return -1;}
+		if(writeFile(fd, data, sizeof(data)) != sizeof(data) || closeFile(fd) < 0){ return -1;}
+	}
+	fsGetStats(&st);
+	double writeBlocks = (double) st.op[FS_OP_WRITE].blockWrites / SMALL_FILES;
+	if(unmountFS() < 0 || stat(SCALE_DEVICE, &image) < 0 || mountFS() < 0){ return -1;}
+	long used = image.st_blocks * 512L - formatted;
+
+	fsResetStats();
+	double start = now();
+	for(int i = 0; i < SMALL_FILES; i++){
+		sprintf(name, "small%d.cfg", i);
+		if((fd = openFile(name)) < 0 || readFile(fd, data, sizeof(data)) != sizeof(data) || closeFile(fd) < 0){ return -1;}
+	}
+	double time = now() - start;
+	fsGetStats(&st);
+	if(unmountFS() < 0){ return -1;}
+	remove(SCALE_DEVICE);
+
+	printf("%-20s %d files of %d B: %6.0f device bytes/file %5.2f block writes/write"
+		   " | after mount: readFile %5.2f block reads/call, open+read+close %6.0f ns/file\n",
+		   label, SMALL_FILES, SMALL_FILE_SIZE, (double) used / SMALL_FILES, writeBlocks,
+		   (double) st.op[FS_OP_READ].blockReads / SMALL_FILES, time / SMALL_FILES);
+	return 0;
+}
+
+#ifdef FS_THREADS
+static int threadFds[THREAD_MAX];	// Files of the concurrency benchmark, one per thread
+static int threadShared;			// All the threads read the first file
+
+/**
+ * Reads chunks of its file, or of the shared one, at pseudo-random offsets
+ *
+ * @return NULL if success and non-NULL otherwise
+ */
+static void *benchThreadRead(void *arg){
+	long t = (long) arg;
+	char buf[THREAD_CHUNK];
+	unsigned int seed = t + 1;
+	int fd = threadFds[threadShared ? 0 : t];
+	for(int i = 0; i < THREAD_READS; i++){
+		seed = seed * 1103515245 + 12345;
+		long offset = (seed >> 8) % (THREAD_FILE_SIZE - THREAD_CHUNK);
+		if(readFileAt(fd, buf, THREAD_CHUNK, offset) != THREAD_CHUNK){ return arg;}
+	}
+	return NULL;
+}
+
+/**
+ * Measures the throughput of readFileAt from 1 to THREAD_MAX threads, each one
+ * reading a file of its own and then all of them reading the same file
+ *
+ * @return 0 if success and -1 otherwise
+ */
+int benchThreads(char *label, char *deviceName, int backend){
+	static char data[THREAD_FILE_SIZE];
+	pthread_t threads[THREAD_MAX];
+	char name[32];
+	if(setDevice(deviceName, backend) < 0 || mkFS(BENCH_BLOCKS * BLOCK_SIZE) < 0 || mountFS() < 0){ return -1;}
+	for(int t = 0; t < THREAD_MAX; t++){
+		sprintf(name, "thread%d.dat", t);
+		if(createFile(name) < 0 || (threadFds[t] = openFile(name)) < 0){ return -1;}
+		if(writeFile(threadFds[t], data, sizeof(data)) != sizeof(data) || closeFile(threadFds[t]) < 0){ return -1;}
+		if((threadFds[t] = openFile(name)) < 0){ return -1;}
+	}
+	for(threadShared = 0; threadShared <= 1; threadShared++){
+		double single = 0;
+		for(int n = 1; n <= THREAD_MAX; n *= 2){
+			double start = now();
+			for(long t = 0; t < n; t++){
+				if(pthread_create(&threads[t], NULL, benchThreadRead, (void *) t) != 0){ return -1;}
+			}
+			int failed = 0;
+			for(int t = 0; t < n; t++){
+				void *ret;
+				pthread_join(threads[t], &ret);
+				failed |= ret != NULL;
+			}
+			if(failed){ return -1;}
+			double rate = (double) n * THREAD_READS / ((now() - start) / 1e9);
+			if(n == 1){
+				single = rate;
+			}
+			printf("%-20s %-10s %d threads: %9.0f readFileAt/s, x%4.2f the 1 thread rate\n",
+				   label, threadShared ? "same file" : "own file", n, rate, rate / single);
+		}
+	}
+	for(int t = 0; t < THREAD_MAX; t++){
+		if(closeFile(threadFds[t]) < 0){ return -1;}
+	}
+	return unmountFS();
+}
+#endif
+
+int main() {
+	if(createDevice(BENCH_DEVICE, BENCH_BLOCKS) < 0){
+		fprintf(stderr, "ERROR: UNABLE TO CREATE %s\n", BENCH_DEVICE);
+		return -1;
+	}
+
+	/*** one open/lseek/close cycle per block ***/
+	bsetcache(0, CACHE_LRU);
+	bsetengine(IO_SYNC);
+	if(benchBlocks("no session") < 0){ return -1;}
+
+	/*** positional I/O on the descriptor of the session ***/
+	if(bmount(BENCH_DEVICE, DEVICE_FD) < 0){ return -1;}
+	if(benchBlocks("device session") < 0){ return -1;}
+
+	/*** one vectored call per contiguous run ***/
+	if(benchVector("sync", 1) < 0){ return -1;}
+	if(benchVector("sync", 2) < 0){ return -1;}
+	bumount();
+
+	/*** all the runs queued to io_uring ***/
+	bsetengine(IO_URING);
+	if(bmount(BENCH_DEVICE, DEVICE_FD) < 0){ return -1;}
+	if(bgetengine() == IO_URING){
+		if(benchVector("io_uring", 1) < 0){ return -1;}
+		if(benchVector("io_uring", 2) < 0){ return -1;}
+	}
+	else{
+		printf("io_uring not available\n");
+	}
+	bumount();
+
+	/*** memory copies on a mapping of the device ***/
+	if(bmount(BENCH_DEVICE, DEVICE_MMAP) < 0){ return -1;}
+	if(benchBlocks("mmap") < 0){ return -1;}
+	if(benchVector("mmap", 1) < 0){ return -1;}
+	bumount();
+
+	/*** memory copies on a RAM disk ***/
+	if(bramdisk(BENCH_DEVICE, (long) BENCH_BLOCKS * BLOCK_SIZE) < 0){ return -1;}
+	if(bmount(BENCH_DEVICE, DEVICE_RAM) < 0){ return -1;}
+	if(benchBlocks("ram disk") < 0){ return -1;}
+	if(benchVector("ram disk", 1) < 0){ return -1;}
+	bumount();
+	bramfree(BENCH_DEVICE);
+
+	/*** hot working set with and without the block cache ***/
+	bsetcache(0, CACHE_LRU);
+	if(bmount(BENCH_DEVICE, DEVICE_FD) < 0){ return -1;}
+	if(benchHot("no cache", 48) < 0){ return -1;}
+	bumount();
+	bsetcache(CACHE_DEFAULT_BLOCKS, CACHE_LRU);
+	if(bmount(BENCH_DEVICE, DEVICE_FD) < 0){ return -1;}
+	if(benchHot("LRU cache", 48) < 0){ return -1;}
+	if(benchHot("LRU cache", 96) < 0){ return -1;}
+	bumount();
+	bsetcache(CACHE_DEFAULT_BLOCKS, CACHE_CLOCK);
+	if(bmount(BENCH_DEVICE, DEVICE_FD) < 0){ return -1;}
+	if(benchHot("CLOCK cache", 48) < 0){ return -1;}
+	if(benchHot("CLOCK cache", 96) < 0){ return -1;}
+	bumount();
+
+	/*** small-chunk streaming reads through the file system ***/
+	static char data[BENCH_FILE_SIZE];
+	if(setDevice(BENCH_DEVICE, DEVICE_FD) < 0 || mkFS(BENCH_BLOCKS * BLOCK_SIZE) < 0 || mountFS() < 0){ return -1;}
+	if(createFile("stream.log") < 0){ return -1;}
+	int fd = openFile("stream.log");
+	if(fd < 0 || writeFile(fd, data, BENCH_FILE_SIZE) != BENCH_FILE_SIZE || closeFile(fd) < 0){ return -1;}
+	fsResetStats();
+	if(benchStream("readahead", "stream.log") < 0){ return -1;}
+	if(benchReport() < 0){ return -1;}
+	if(benchProbe("probes") < 0){ return -1;}
+	if(benchOpen("open file table", "stream.log") < 0){ return -1;}
+	if(benchLookup("name lookup") < 0){ return -1;}
+	unmountFS();
+
+	/*** the same reads of a file whose extents need an extent block ***/
+	if(mkFS(BENCH_BLOCKS * BLOCK_SIZE) < 0 || mountFS() < 0){ return -1;}
+	/* a hole every other block of the map */
+	char name[32];
+	for(int i = 0; i < BENCH_FILE_SIZE / BLOCK_SIZE; i++){
+		sprintf(name, "hole%d", i);
+		if(createFile(name) < 0 || (fd = openFile(name)) < 0){ return -1;}
+		if(writeFile(fd, data, BLOCK_SIZE) != BLOCK_SIZE || closeFile(fd) < 0){ return -1;}
+	}
+	for(int i = 0; i < BENCH_FILE_SIZE / BLOCK_SIZE; i += 2){
+		sprintf(name, "hole%d", i);
+		if(removeFile(name) < 0){ return -1;}
+	}
+	/* the allocator starts over from the first hole */
+	if(unmountFS() < 0 || mountFS() < 0){ return -1;}
+	if(createFile("frag.log") < 0 || (fd = openFile("frag.log")) < 0){ return -1;}
+	if(writeFile(fd, data, BENCH_FILE_SIZE) != BENCH_FILE_SIZE || closeFile(fd) < 0){ return -1;}
+	if(benchStream("fragmented", "frag.log") < 0){ return -1;}
+	unmountFS();
+
+	/*** metadata operations ***/
+	if(benchMeta("create/remove") < 0){ return -1;}
+
+	/*** small appends to a log ***/
+	if(benchAppend("appends") < 0){ return -1;}
+
+	/*** records of a header and a payload ***/
+	if(benchRecords("records") < 0){ return -1;}
+
+	/*** block allocation ***/
+	if(benchAlloc("allocator") < 0){ return -1;}
+
+	/*** a multi-GiB device with hundreds of thousands of files ***/
+	if(benchScale("scale") < 0){ return -1;}
+
+	/*** a file of tens of thousands of extents ***/
+	if(benchTree("extent tree") < 0){ return -1;}
+
+	/*** a directory of a hundred thousand entries ***/
+	if(benchDir("directory") < 0){ return -1;}
+
+	/*** many files of a few bytes ***/
+	if(benchSmall("small files") < 0){ return -1;}
+
+#ifdef FS_THREADS
+	/*** readers in several threads, on as many CPUs as there are ***/
+	printf("%-20s %ld CPUs online\n", "threads", sysconf(_SC_NPROCESSORS_ONLN));
+	if(bramdisk(BENCH_DEVICE, (long) BENCH_BLOCKS * BLOCK_SIZE) < 0){ return -1;}
+	if(benchThreads("threads, ram disk", BENCH_DEVICE, DEVICE_RAM) < 0){ return -1;}
+	bramfree(BENCH_DEVICE);
+	if(benchThreads("threads, cached fd", BENCH_DEVICE, DEVICE_FD) < 0){ return -1;}
+	setDevice(DEVICE_IMAGE, DEVICE_FD);
+#endif
+
+	remove(BENCH_DEVICE);
+	return 0;
+}
@@ -5,7 +5,535 @@
  * order to read or read to and from the device.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include "blocks_cache.h"
+#include "devices.h"
+#ifdef FS_THREADS
+#include <pthread.h>
+#endif
+
+/* Device session opened by bmount(): the device is attached once and its size is cached */
+static const dev_ops_t *dev = NULL; /* Backend of the mounted device, NULL if none */
+static off_t devSize = 0;           /* Size of the mounted device in bytes */
+static char devName[DEVICE_NAME_MAX]; /* Name of the mounted device */
+
+/* Backends by number */
+static const dev_ops_t *backends[] = { &fileDevice, &mmapDevice, &ramDevice };
+
+/* Cached copy of a block of the mounted device */
+typedef struct{
+	int block;                      /* Block number, -1 if the entry is free */
+	char dirty;                     /* The copy is newer than the device */
+	char ref;                       /* Referenced since the clock hand last passed (CLOCK) */
+	int prev, next;                 /* Neighbours in the recency list, MRU first (LRU) */
+	int hnext;                      /* Next entry in the same hash bucket */
+	char data[BLOCK_SIZE];          /* Contents of the block */
+} centry_t;
+
+static centry_t *cache = NULL;      /* Cache entries */
+static int *cacheHash = NULL;       /* Hash buckets: first entry of each chain, -1 if empty */
+static int cacheBlocks = CACHE_DEFAULT_BLOCKS; /* Capacity of the cache in blocks */
+static int cachePolicy = CACHE_LRU; /* Eviction policy */
+static int cacheBuckets = 0;        /* Number of hash buckets (power of two) */
+static int cacheUsed = 0;           /* Entries holding a block */
+static int lruHead = -1, lruTail = -1; /* Most and least recently used entries (LRU) */
+static int clockHand = 0;           /* Next entry inspected by the clock (CLOCK) */
+
+static int cinit(void);
+static void cfree(void);
+
+#ifdef FS_THREADS
+/* The session is changed by bmount and bumount alone, and read under sessionLock, which the
+   calls that use it hold shared, before blockLock. The cache and the backends are used by one
+   thread at a time; the reads and writes of a memory backend, which has no cache, only copy
+   memory and go on in parallel */
+static pthread_rwlock_t sessionLock = PTHREAD_RWLOCK_INITIALIZER;
+static __thread int sessionDepth = 0; /* Session locks this thread holds: the outer one locks */
+static pthread_mutex_t blockLock;
+static pthread_once_t blockLockOnce = PTHREAD_ONCE_INIT;
+
+/*
+ * Locks the session, shared or exclusive, unless this thread holds it already: bumount calls
+ * bflush, and bread the other calls of the session.
+ */
+static int sessionLockTake(int exclusive) {
+	if(sessionDepth++ == 0){
+		if(exclusive){
+			pthread_rwlock_wrlock(&sessionLock);
+		}
+		else{
+			pthread_rwlock_rdlock(&sessionLock);
+		}
+	}
+	return 1;
+}
+
+static void sessionLockDrop(int *held) {
+	if(*held && --sessionDepth == 0){
+		pthread_rwlock_unlock(&sessionLock);
+	}
+}
+
+/*
+ * Makes the lock recursive: bumount and bsetcache call bflush, breadv and bwritev bread and bwrite.
+ */
+static void blockLockInit(void) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&blockLock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static int blockLockTake(void) {
+	pthread_once(&blockLockOnce, blockLockInit);
+	pthread_mutex_lock(&blockLock);
+	return 1;
+}
+
+static void blockLockDrop(int *held) {
+	if(*held){
+		pthread_mutex_unlock(&blockLock);
+	}
+}
+
+/* Holds the lock of the session up to the end of the enclosing block */
+#define SESSION_LOCKED(exclusive) int sessionLockHeld __attribute__((cleanup(sessionLockDrop), unused)) = sessionLockTake(exclusive)
+/* Holds the lock of the block layer, if cond, up to the end of the enclosing block */
+#define BLOCK_LOCKED_IF(cond) int blockLockHeld __attribute__((cleanup(blockLockDrop), unused)) = (cond) && blockLockTake()
+#define BLOCK_LOCKED() BLOCK_LOCKED_IF(1)
+/* Counters updated out of the lock */
+#define STATS_ADD(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#define STATS_GET(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#else
+#define SESSION_LOCKED(exclusive)
+#define BLOCK_LOCKED_IF(cond)
+#define BLOCK_LOCKED()
+#define STATS_ADD(counter, n) ((counter) += (n))
+#define STATS_GET(counter) (counter)
+#endif
+
+/*******************/
+/* Device session. */
+/*******************/
+
+/*
+ * Attaches the device once with the given backend and caches its size so
+ * that bread/bwrite on it are served by that backend.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bmount(char *deviceName, int backend) {
+	if(backend < 0 || backend >= (int) (sizeof(backends) / sizeof(backends[0]))){
+		return -1;
+	}
+	return bmountops(deviceName, backends[backend]);
+}
+
+/*
+ * Attaches the device once with the given operations table.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bmountops(char *deviceName, const dev_ops_t *ops) {
+	SESSION_LOCKED(1);
+	BLOCK_LOCKED();
+	if(dev != NULL || strlen(deviceName) >= DEVICE_NAME_MAX){
+		return -1;
+	}
+	if(ops->open(deviceName) < 0){
+		return -1;
+	}
+	dev = ops;
+	devSize = ops->size();
+	strcpy(devName, deviceName);
+	/* backends served from memory do not need a cache on top */
+	if(dev->cached && cinit() < 0){
+		bumount();
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Writes the dirty cached blocks back and detaches the device attached by bmount.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bumount(void) {
+	SESSION_LOCKED(1);
+	BLOCK_LOCKED();
+	if(dev == NULL){
+		return -1;
+	}
+	int ret = bflush();
+	cfree();
+	if(dev->close() < 0){
+		ret = -1;
+	}
+	dev = NULL;
+	devSize = 0;
+	devName[0] = '\0';
+	return ret;
+}
+
+/*
+ * Returns 1 if there is a session opened on the given device and 0 otherwise.
+ */
+int bmounted(char *deviceName) {
+	SESSION_LOCKED(0);
+	return dev != NULL && strcmp(deviceName, devName) == 0;
+}
+
+/*
+ * Returns the address of the block inside the memory of the device
+ * (DEVICE_MMAP, DEVICE_RAM) or NULL if the device is not addressable.
+ */
+char *bpeek(char *deviceName, int blockNumber) {
+	SESSION_LOCKED(0);
+	if(!bmounted(deviceName) || blockNumber < 0
+	   || (off_t) BLOCK_SIZE*blockNumber+BLOCK_SIZE > devSize){
+		return NULL;
+	}
+	return dev->peek(blockNumber);
+}
+
+/*
+ * Copies the block I/O counters into out.
+ */
+void bgetstats(bstats_t *out) {
+	BLOCK_LOCKED();
+	out->reads = STATS_GET(devStats.reads);
+	out->writes = STATS_GET(devStats.writes);
+	out->syscalls = devStats.syscalls;
+	out->hits = devStats.hits;
+	out->misses = devStats.misses;
+	out->evictions = devStats.evictions;
+	out->writebacks = devStats.writebacks;
+	out->queued = devStats.queued;
+	out->prefetched = devStats.prefetched;
+}
+
+/*
+ * Sets all the block I/O counters to zero.
+ */
+void bresetstats(void) {
+	BLOCK_LOCKED();
+	memset(&devStats, 0, sizeof(bstats_t));
+}
+
+/****************/
+/* Block cache. */
+/****************/
+
+/*
+ * Releases the memory of the cache. Dirty blocks are lost.
+ */
+static void cfree(void) {
+	free(cache);
+	free(cacheHash);
+	cache = NULL;
+	cacheHash = NULL;
+	cacheUsed = 0;
+	lruHead = lruTail = -1;
+	clockHand = 0;
+}
+
+/*
+ * Allocates an empty cache of cacheBlocks entries.
+ * Returns 0 if correct or -1 in case of error.
+ */
+static int cinit(void) {
+	if(cacheBlocks <= 0){
+		return 0;
+	}
+	cacheBuckets = 1;
+	while(cacheBuckets < 2 * cacheBlocks){
+		cacheBuckets <<= 1;
+	}
+	cache = malloc(sizeof(centry_t) * cacheBlocks);
+	cacheHash = malloc(sizeof(int) * cacheBuckets);
+	if(cache == NULL || cacheHash == NULL){
+		cfree();
+		return -1;
+	}
+	for(int i = 0; i < cacheBlocks; i++){
+		cache[i].block = -1;
+		cache[i].dirty = 0;
+		cache[i].ref = 0;
+		cache[i].prev = cache[i].next = cache[i].hnext = -1;
+	}
+	for(int i = 0; i < cacheBuckets; i++){
+		cacheHash[i] = -1;
+	}
+	return 0;
+}
+
+static int chash(int block) {
+	return (unsigned int) block * 2654435761u & (cacheBuckets - 1);
+}
+
+/*
+ * Returns the entry caching the block or -1 if it is not cached.
+ */
+static int clookup(int block) {
+	for(int e = cacheHash[chash(block)]; e >= 0; e = cache[e].hnext){
+		if(cache[e].block == block){
+			return e;
+		}
+	}
+	return -1;
+}
+
+static void lruUnlink(int e) {
+	if(cache[e].prev >= 0) cache[cache[e].prev].next = cache[e].next;
+	else lruHead = cache[e].next;
+	if(cache[e].next >= 0) cache[cache[e].next].prev = cache[e].prev;
+	else lruTail = cache[e].prev;
+	cache[e].prev = cache[e].next = -1;
+}
+
+static void lruPush(int e) {
+	cache[e].prev = -1;
+	cache[e].next = lruHead;
+	if(lruHead >= 0) cache[lruHead].prev = e;
+	lruHead = e;
+	if(lruTail < 0) lruTail = e;
+}
+
+/*
+ * Marks the entry as just used.
+ */
+static void ctouch(int e) {
+	if(cachePolicy == CACHE_LRU){
+		lruUnlink(e);
+		lruPush(e);
+	}
+	else{
+		cache[e].ref = 1;
+	}
+}
+
+/*
+ * Writes a dirty entry back to the device.
+ * Returns 0 if correct or -1 in case of error.
+ */
+static int cwriteback(int e) {
+	if(!cache[e].dirty){
+		return 0;
+	}
+	char *data = cache[e].data;
+	if(dev->write(&cache[e].block, &data, 1) < 0){
+		return -1;
+	}
+	cache[e].dirty = 0;
+	devStats.writebacks++;
+	return 0;
+}
+
+/*
+ * Removes the block held by the entry from the cache.
+ */
+static void cremove(int e) {
+	int *link = &cacheHash[chash(cache[e].block)];
+	while(*link != e){
+		link = &cache[*link].hnext;
+	}
+	*link = cache[e].hnext;
+	cache[e].hnext = -1;
+	cache[e].block = -1;
+	cache[e].dirty = 0;
+	cacheUsed--;
+	if(cachePolicy == CACHE_LRU){
+		lruUnlink(e);
+	}
+}
+
+/*
+ * Gets an entry for the block, evicting the policy victim if the cache is full.
+ * Returns the entry or -1 in case of error writing the victim back.
+ */
+static int cinsert(int block) {
+	int e = -1;
+	if(cacheUsed < cacheBlocks){
+		for(e = 0; cache[e].block >= 0; e++);
+	}
+	else{
+		if(cachePolicy == CACHE_LRU){
+			e = lruTail;
+		}
+		else{
+			/* second chance: skip and clear referenced entries */
+			while(cache[clockHand].ref){
+				cache[clockHand].ref = 0;
+				clockHand = (clockHand + 1) % cacheBlocks;
+			}
+			e = clockHand;
+			clockHand = (clockHand + 1) % cacheBlocks;
+		}
+		if(cwriteback(e) < 0){
+			return -1;
+		}
+		cremove(e);
+		devStats.evictions++;
+	}
+	cache[e].block = block;
+	cache[e].dirty = 0;
+	cache[e].ref = 1;
+	int h = chash(block);
+	cache[e].hnext = cacheHash[h];
+	cacheHash[h] = e;
+	cacheUsed++;
+	if(cachePolicy == CACHE_LRU){
+		lruPush(e);
+	}
+	return e;
+}
+
+/*
+ * Orders cache entries by block number.
+ */
+static int cblockcmp(const void *a, const void *b) {
+	return cache[*(const int *) a].block - cache[*(const int *) b].block;
+}
+
+/*
+ * Sets the capacity in blocks and the eviction policy of the cache.
+ * Cached blocks are written back and dropped first.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bsetcache(int blocks, int policy) {
+	SESSION_LOCKED(0);
+	BLOCK_LOCKED();
+	if(blocks < 0 || (policy != CACHE_LRU && policy != CACHE_CLOCK)){
+		return -1;
+	}
+	if(bflush() < 0){
+		return -1;
+	}
+	cfree();
+	cacheBlocks = blocks;
+	cachePolicy = policy;
+	if(dev != NULL && dev->cached){
+		return cinit();
+	}
+	return 0;
+}
+
+/*
+ * Writes every dirty block of the cache back to the device and flushes the backend.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bflush(void) {
+	SESSION_LOCKED(0);
+	BLOCK_LOCKED();
+	int ret = 0;
+	if(dev == NULL){
+		return 0;
+	}
+	if(cache == NULL){
+		return dev->flush();
+	}
+	/* gather the dirty blocks in device order so that adjacent ones form runs */
+	int *entries = malloc(sizeof(int) * cacheBlocks);
+	int *blocks = malloc(sizeof(int) * cacheBlocks);
+	char **buffers = malloc(sizeof(char *) * cacheBlocks);
+	int n = 0;
+	if(entries == NULL || blocks == NULL || buffers == NULL){
+		ret = -1;
+	}
+	for(int e = 0; ret == 0 && e < cacheBlocks; e++){
+		if(cache[e].block >= 0 && cache[e].dirty){
+			entries[n++] = e;
+		}
+	}
+	if(n > 0){
+		qsort(entries, n, sizeof(int), cblockcmp);
+		for(int i = 0; i < n; i++){
+			blocks[i] = cache[entries[i]].block;
+			buffers[i] = cache[entries[i]].data;
+		}
+		ret = dev->write(blocks, buffers, n);
+		for(int i = 0; ret == 0 && i < n; i++){
+			cache[entries[i]].dirty = 0;
+		}
+		if(ret == 0){
+			devStats.writebacks += n;
+		}
+	}
+	free(entries);
+	free(blocks);
+	free(buffers);
+	if(ret == 0){
+		ret = dev->flush();
+	}
+	return ret;
+}
+
+/*
+ * Loads blocks of the mounted device into the cache with a single backend request.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bprefetch(char *deviceName, int *blockNumbers, int count) {
+	SESSION_LOCKED(0);
+	BLOCK_LOCKED();
+	if(!bmounted(deviceName) || cache == NULL){
+		return 0;
+	}
+	/* leave room for the blocks being used */
+	if(count > cacheBlocks / 2){
+		count = cacheBlocks / 2;
+	}
+	int *blocks = malloc(sizeof(int) * count);
+	int *entries = malloc(sizeof(int) * count);
+	char **bufs = malloc(sizeof(char *) * count);
+	int n = 0, ret = 0;
+
+	if(blocks == NULL || entries == NULL || bufs == NULL){
+		ret = -1;
+	}
+	for(int i = 0; ret == 0 && i < count; i++){
+		if(blockNumbers[i] < 0 || (off_t) BLOCK_SIZE*blockNumbers[i]+BLOCK_SIZE > devSize){
+			ret = -1;
+			break;
+		}
+		if(clookup(blockNumbers[i]) >= 0){
+			continue;
+		}
+		int e = cinsert(blockNumbers[i]);
+		if(e < 0){
+			ret = -1;
+			break;
+		}
+		blocks[n] = blockNumbers[i];
+		entries[n] = e;
+		n++;
+	}
+	/* the clock may have taken back an entry of this batch for a later block */
+	int kept = 0;
+	for(int i = 0; i < n; i++){
+		if(cache[entries[i]].block == blocks[i]){
+			blocks[kept] = blocks[i];
+			entries[kept] = entries[i];
+			bufs[kept] = cache[entries[i]].data;
+			kept++;
+		}
+	}
+	if(ret == 0 && kept > 0){
+		ret = dev->read(blocks, bufs, kept);
+		if(ret == 0){
+			devStats.prefetched += kept;
+		}
+	}
+	/* never leave entries without their contents */
+	if(ret < 0){
+		for(int i = 0; i < kept; i++){
+			cremove(entries[i]);
+		}
+	}
+	free(blocks);
+	free(entries);
+	free(bufs);
+	return ret;
+}
 
 /****************/
 /* Disk access. */
@@ -17,32 +545,70 @@
  * read.
  */
 int bread(char *deviceName, int blockNumber, char *buffer) {
+	STATS_ADD(devStats.reads, 1);
+
+	/* Fast path: the backend of the mounted device, which stays mounted up to the return */
+	SESSION_LOCKED(0);
+	if(bmounted(deviceName)){
+		if(blockNumber < 0 || (off_t) BLOCK_SIZE*blockNumber+BLOCK_SIZE > devSize) {
+			return -1;
+		}
+		BLOCK_LOCKED_IF(dev->cached);
+		if(cache == NULL){
+			return dev->read(&blockNumber, &buffer, 1);
+		}
+		int e = clookup(blockNumber);
+		if(e >= 0){
+			devStats.hits++;
+			ctouch(e);
+		}
+		else{
+			devStats.misses++;
+			if((e = cinsert(blockNumber)) < 0){
+				return -1;
+			}
+			char *data = cache[e].data;
+			if(dev->read(&blockNumber, &data, 1) < 0){
+				cremove(e);
+				return -1;
+			}
+		}
+		memcpy(buffer, cache[e].data, BLOCK_SIZE);
+		return 0;
+	}
+
 	int fd = open(deviceName, O_RDONLY);
+	devStats.syscalls++;
 
 	if(fd < 0){
 		/* fprintf(stderr, "ERROR: UNABLE TO OPEN DISK FILE %s \n", deviceName); */
 		return -1;
 	}
 
-	int len = lseek(fd, 0, SEEK_END) + 1;
-	if((BLOCK_SIZE*blockNumber+BLOCK_SIZE) > len) {
+	off_t len = lseek(fd, 0, SEEK_END);
+	devStats.syscalls++;
+	if(blockNumber < 0 || (off_t) BLOCK_SIZE*blockNumber+BLOCK_SIZE > len) {
 		close(fd);
+		devStats.syscalls++;
 		return -1;
 	}
 
-	lseek(fd, BLOCK_SIZE*blockNumber, SEEK_SET);
+	lseek(fd, (off_t) BLOCK_SIZE*blockNumber, SEEK_SET);
+	devStats.syscalls++;
 
 	int total_read, read_result;
 
 	total_read = 0;
 	do{
 		read_result = read(fd, buffer+total_read, BLOCK_SIZE-total_read);
+		devStats.syscalls++;
 		total_read = total_read + read_result;
-	} while(total_read < BLOCK_SIZE && read_result >= 0);
+	} while(total_read < BLOCK_SIZE && read_result > 0);
 
 	close(fd);
+	devStats.syscalls++;
 
-	return 0;
+	return total_read < BLOCK_SIZE ? -1 : 0;
 }
 
 /*
@@ -50,30 +616,149 @@ int bread(char *deviceName, int blockNumber, char *buffer) {
  * Returns 0 or -1 in case of error.
  */
 int bwrite(char *deviceName, int blockNumber, char*buffer) {
+	STATS_ADD(devStats.writes, 1);
+
+	/* Fast path: the backend of the mounted device, which stays mounted up to the return */
+	SESSION_LOCKED(0);
+	if(bmounted(deviceName)){
+		if(blockNumber < 0 || (off_t) BLOCK_SIZE*blockNumber+BLOCK_SIZE > devSize) {
+			return -1;
+		}
+		BLOCK_LOCKED_IF(dev->cached);
+		if(cache == NULL){
+			return dev->write(&blockNumber, &buffer, 1);
+		}
+		/* write-back: the device is updated when the block is flushed or evicted */
+		int e = clookup(blockNumber);
+		if(e >= 0){
+			devStats.hits++;
+			ctouch(e);
+		}
+		else{
+			devStats.misses++;
+			if((e = cinsert(blockNumber)) < 0){
+				return -1;
+			}
+		}
+		memcpy(cache[e].data, buffer, BLOCK_SIZE);
+		cache[e].dirty = 1;
+		return 0;
+	}
+
 	int fd = open(deviceName, O_WRONLY);
+	devStats.syscalls++;
 
 	if(fd < 0){
 		/* fprintf(stderr, "ERROR: UNABLE TO OPEN DISK FILE %s \n", deviceName); */
 		return -1;
 	}
 
-	int len = lseek(fd, 0, SEEK_END) + 1;
-	if((BLOCK_SIZE*blockNumber+BLOCK_SIZE) > len) {
+	off_t len = lseek(fd, 0, SEEK_END);
+	devStats.syscalls++;
+	if(blockNumber < 0 || (off_t) BLOCK_SIZE*blockNumber+BLOCK_SIZE > len) {
 		close(fd);
+		devStats.syscalls++;
 		return -1;
 	}
 
-	lseek(fd, BLOCK_SIZE*blockNumber, SEEK_SET);
+	lseek(fd, (off_t) BLOCK_SIZE*blockNumber, SEEK_SET);
+	devStats.syscalls++;
 
 	int total_write, write_result;
 
 	total_write = 0;
 	do{
 		write_result = write(fd, buffer+total_write, BLOCK_SIZE-total_write);
+		devStats.syscalls++;
 		total_write = total_write + write_result;
-	} while(total_write < BLOCK_SIZE && write_result >= 0);
+	} while(total_write < BLOCK_SIZE && write_result > 0);
 
 	close(fd);
+	devStats.syscalls++;
 
-	return 0;
+	return total_write < BLOCK_SIZE ? -1 : 0;
+}
+
+/*
+ * Transfers the blocks of the mounted device. Cached blocks are served
+ * from (reads) or updated in (writes) the cache, the rest are handed to
+ * the backend in a single request.
+ * Returns 0 or -1 in case of error.
+ */
+static int bvector(int *blockNumbers, char **buffers, int count, int writing) {
+	BLOCK_LOCKED_IF(dev->cached);
+	int *blocks = malloc(sizeof(int) * count);
+	char **bufs = malloc(sizeof(char *) * count);
+	int n = 0, ret = 0;
+
+	if(blocks == NULL || bufs == NULL){
+		free(blocks);
+		free(bufs);
+		return -1;
+	}
+	for(int i = 0; i < count; i++){
+		if(blockNumbers[i] < 0 || (off_t) BLOCK_SIZE*blockNumbers[i]+BLOCK_SIZE > devSize){
+			ret = -1;
+			break;
+		}
+		int e;
+		if(cache != NULL && (e = clookup(blockNumbers[i])) >= 0){
+			devStats.hits++;
+			ctouch(e);
+			if(writing){
+				/* write-back, as bwrite */
+				memcpy(cache[e].data, buffers[i], BLOCK_SIZE);
+				cache[e].dirty = 1;
+			}
+			else{
+				memcpy(buffers[i], cache[e].data, BLOCK_SIZE);
+			}
+			continue;
+		}
+		blocks[n] = blockNumbers[i];
+		bufs[n] = buffers[i];
+		n++;
+	}
+	if(ret == 0 && n > 0){
+		ret = writing ? dev->write(blocks, bufs, n) : dev->read(blocks, bufs, n);
+	}
+	free(blocks);
+	free(bufs);
+	return ret;
+}
+
+/*
+ * Reads count blocks from the device, blockNumbers[i] into buffers[i].
+ * Returns 0 or -1 in case of error, including short read.
+ */
+int breadv(char *deviceName, int *blockNumbers, char **buffers, int count) {
+	SESSION_LOCKED(0);
+	if(!bmounted(deviceName)){
+		for(int i = 0; i < count; i++){
+			if(bread(deviceName, blockNumbers[i], buffers[i]) < 0){
+				return -1;
+			}
+		}
+		return 0;
+	}
+	STATS_ADD(devStats.reads, count);
+	return bvector(blockNumbers, buffers, count, 0);
+}
+
+/*
+ * Writes count blocks to the device, buffers[i] into blockNumbers[i].
+ * Returns 0 or -1 in case of error.
+ */
+int bwritev(char *deviceName, int *blockNumbers, char **buffers, int count) {
+	SESSION_LOCKED(0);
+	if(!bmounted(deviceName)){
+		for(int i = 0; i < count; i++){
+			if(bwrite(deviceName, blockNumbers[i], buffers[i]) < 0){
+				return -1;
+			}
+		}
+		return 0;
+	}
+	STATS_ADD(devStats.writes, count);
+	return bvector(blockNumbers, buffers, count, 1);
 }
@@ -0,0 +1,383 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	devices.c
+ * @brief 	Device backends: image file with positional I/O, shared mapping
+ * 			of the image file, and in-memory RAM disk.
+ * @date	01/03/2017
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "include/devices.h"
+#include "include/uring.h"
+
+bstats_t devStats;                  /* Block I/O counters */
+
+/**********************************/
+/* Image file, positional I/O.    */
+/**********************************/
+
+static int fileFd = -1;             /* Descriptor of the image */
+static off_t fileSize = 0;          /* Size of the image in bytes */
+static int fileEngine = IO_URING;   /* Preferred engine for multi-block transfers */
+
+/*
+ * Transfers the buffers of iov to consecutive positions starting at the
+ * given offset of fd with a single positional vectored call, retrying
+ * the remainder on short transfers.
+ * Returns 0 or -1 in case of error, including short transfer.
+ */
+static int fileXfer(off_t offset, struct iovec *iov, int count, int writing) {
+	while(count > 0){
+		ssize_t result;
+		if(writing){
+			result = pwritev(fileFd, iov, count, offset);
+		}
+		else{
+			result = preadv(fileFd, iov, count, offset);
+		}
+		devStats.syscalls++;
+		if(result <= 0){
+			return -1;
+		}
+		offset += result;
+		/* skip the buffers already transferred */
+		while(count > 0 && (size_t) result >= iov->iov_len){
+			result -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0){
+			iov->iov_base = (char *) iov->iov_base + result;
+			iov->iov_len -= result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Transfers count blocks merging physically contiguous runs into single
+ * vectored transfers. With the io_uring engine all the runs are queued
+ * and reaped together, otherwise each run is a blocking call.
+ * Returns 0 or -1 in case of error.
+ */
+static int fileSubmit(int *blockNumbers, char **buffers, int count, int writing) {
+	struct iovec iovSingle;
+	struct iovec *iov = count == 1 ? &iovSingle : malloc(sizeof(struct iovec) * count);
+	int runFirst[URING_DEPTH], runLength[URING_DEPTH];
+	char failed[URING_DEPTH];
+	int runs = 0, ret = 0;
+
+	if(iov == NULL){
+		return -1;
+	}
+	for(int i = 0; i < count; i++){
+		iov[i].iov_base = buffers[i];
+		iov[i].iov_len = BLOCK_SIZE;
+	}
+	for(int i = 0; i < count && ret == 0; ){
+		/* the run goes on while the next block is physically adjacent */
+		int j = i + 1;
+		while(j < count && blockNumbers[j] == blockNumbers[j-1] + 1 && j - i < BLOCK_RUN_MAX){
+			j++;
+		}
+		off_t offset = (off_t) BLOCK_SIZE*blockNumbers[i];
+		/* a single run gains nothing from the ring */
+		if(!uringReady() || (i == 0 && j == count)){
+			ret = fileXfer(offset, &iov[i], j - i, writing);
+		}
+		else if(uringQueue(offset, &iov[i], j - i, writing) >= 0){
+			runFirst[runs] = i;
+			runLength[runs] = j - i;
+			runs++;
+			devStats.queued++;
+		}
+		else{
+			/* the ring is full: reap the batch and queue the run again */
+			j = i;
+		}
+		if(runs > 0 && (runs == URING_DEPTH || j == i || j == count)){
+			/* the kernel is done with the buffers of the batch once it returns */
+			devStats.syscalls += uringSubmit(failed);
+			/* redo the short or failed transfers synchronously */
+			for(int r = 0; r < runs && ret == 0; r++){
+				if(failed[r]){
+					int first = runFirst[r];
+					ret = fileXfer((off_t) BLOCK_SIZE*blockNumbers[first],
+								   &iov[first], runLength[r], writing);
+				}
+			}
+			runs = 0;
+		}
+		i = j;
+	}
+	if(iov != &iovSingle){
+		free(iov);
+	}
+	return ret;
+}
+
+static int fileOpen(char *deviceName) {
+	struct stat st;
+	fileFd = open(deviceName, O_RDWR);
+	devStats.syscalls++;
+	if(fileFd < 0){
+		return -1;
+	}
+	devStats.syscalls++;
+	if(fstat(fileFd, &st) < 0){
+		close(fileFd);
+		devStats.syscalls++;
+		fileFd = -1;
+		return -1;
+	}
+	fileSize = st.st_size;
+	/* queue multi-block transfers; without io_uring they stay synchronous */
+	if(fileEngine == IO_URING){
+		uringInit(fileFd);
+	}
+	return 0;
+}
+
+static int fileClose(void) {
+	uringExit();
+	int ret = close(fileFd);
+	devStats.syscalls++;
+	fileFd = -1;
+	fileSize = 0;
+	return ret < 0 ? -1 : 0;
+}
+
+static off_t fileGetSize(void) {
+	return fileSize;
+}
+
+static int fileRead(int *blockNumbers, char **buffers, int count) {
+	return fileSubmit(blockNumbers, buffers, count, 0);
+}
+
+static int fileWrite(int *blockNumbers, char **buffers, int count) {
+	return fileSubmit(blockNumbers, buffers, count, 1);
+}
+
+/* Writes reach the page cache of the host as soon as they are issued: the flush makes them durable */
+static int fileFlush(void) {
+	devStats.syscalls++;
+	return fdatasync(fileFd) < 0 ? -1 : 0;
+}
+
+static char *filePeek(int blockNumber) {
+	return NULL;
+}
+
+const dev_ops_t fileDevice = {
+	"file", fileOpen, fileClose, fileGetSize, fileRead, fileWrite, fileFlush, filePeek, 1
+};
+
+/*
+ * Sets the engine used for multi-block transfers of the DEVICE_FD backend:
+ * IO_SYNC (one blocking call per run) or IO_URING (all the runs queued and
+ * reaped together). It applies to the next bmount.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bsetengine(int engine) {
+	if(engine != IO_SYNC && engine != IO_URING){
+		return -1;
+	}
+	fileEngine = engine;
+	return 0;
+}
+
+/*
+ * Returns the engine in use on the mounted device: IO_URING if the ring
+ * could be set up and IO_SYNC otherwise.
+ */
+int bgetengine(void) {
+	return uringReady() ? IO_URING : IO_SYNC;
+}
+
+/**********************************/
+/* Image file, shared mapping.    */
+/**********************************/
+
+static int mapFd = -1;              /* Descriptor of the image */
+static char *map = NULL;            /* Mapping of the whole image */
+static off_t mapSize = 0;           /* Size of the image in bytes */
+
+static int mmapOpen(char *deviceName) {
+	if(fileOpen(deviceName) < 0){
+		return -1;
+	}
+	/* only the descriptor is needed */
+	uringExit();
+	mapFd = fileFd;
+	mapSize = fileSize;
+	fileFd = -1;
+	map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mapFd, 0);
+	devStats.syscalls++;
+	if(map == MAP_FAILED){
+		map = NULL;
+		close(mapFd);
+		devStats.syscalls++;
+		mapFd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static int mmapClose(void) {
+	munmap(map, mapSize);
+	int ret = close(mapFd);
+	devStats.syscalls += 2;
+	map = NULL;
+	mapFd = -1;
+	mapSize = 0;
+	return ret < 0 ? -1 : 0;
+}
+
+static off_t mmapGetSize(void) {
+	return mapSize;
+}
+
+static int mmapRead(int *blockNumbers, char **buffers, int count) {
+	for(int i = 0; i < count; i++){
+		memcpy(buffers[i], map + (off_t) BLOCK_SIZE*blockNumbers[i], BLOCK_SIZE);
+	}
+	return 0;
+}
+
+static int mmapWrite(int *blockNumbers, char **buffers, int count) {
+	for(int i = 0; i < count; i++){
+		char *block = map + (off_t) BLOCK_SIZE*blockNumbers[i];
+		/* buffers obtained with bpeek are already in place */
+		if(block != buffers[i]){
+			memcpy(block, buffers[i], BLOCK_SIZE);
+		}
+	}
+	return 0;
+}
+
+static int mmapFlush(void) {
+	devStats.syscalls++;
+	return msync(map, mapSize, MS_SYNC) < 0 ? -1 : 0;
+}
+
+static char *mmapPeek(int blockNumber) {
+	return map + (off_t) BLOCK_SIZE*blockNumber;
+}
+
+const dev_ops_t mmapDevice = {
+	"mmap", mmapOpen, mmapClose, mmapGetSize, mmapRead, mmapWrite, mmapFlush, mmapPeek, 0
+};
+
+/**********************************/
+/* RAM disk.                      */
+/**********************************/
+
+/* RAM disk created with bramdisk */
+typedef struct{
+	char name[DEVICE_NAME_MAX];     /* Name of the device, empty if the slot is free */
+	char *data;                     /* Contents of the device */
+	off_t size;                     /* Size of the device in bytes */
+} ramdisk_t;
+
+static ramdisk_t ramDisks[RAMDISK_MAX]; /* RAM disks of the process */
+static ramdisk_t *ram = NULL;       /* RAM disk attached */
+
+static ramdisk_t *ramFind(char *deviceName) {
+	for(int i = 0; i < RAMDISK_MAX; i++){
+		if(ramDisks[i].data != NULL && strcmp(ramDisks[i].name, deviceName) == 0){
+			return &ramDisks[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Creates a RAM disk of the given size in bytes filled with zeros.
+ * An existing RAM disk with the same name is replaced.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bramdisk(char *deviceName, long size) {
+	if(strlen(deviceName) >= DEVICE_NAME_MAX || size <= 0 || bramfree(deviceName) < -1){
+		return -1;
+	}
+	for(int i = 0; i < RAMDISK_MAX; i++){
+		if(ramDisks[i].data == NULL){
+			ramDisks[i].data = calloc(1, size);
+			if(ramDisks[i].data == NULL){
+				return -1;
+			}
+			strcpy(ramDisks[i].name, deviceName);
+			ramDisks[i].size = size;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Destroys a RAM disk. It cannot be mounted.
+ * Returns 0 if correct, -1 if it does not exist or -2 if it is mounted.
+ */
+int bramfree(char *deviceName) {
+	ramdisk_t *disk = ramFind(deviceName);
+	if(disk == NULL){
+		return -1;
+	}
+	if(disk == ram){
+		return -2;
+	}
+	free(disk->data);
+	disk->data = NULL;
+	disk->name[0] = '\0';
+	disk->size = 0;
+	return 0;
+}
+
+static int ramOpen(char *deviceName) {
+	ram = ramFind(deviceName);
+	return ram == NULL ? -1 : 0;
+}
+
+static int ramClose(void) {
+	ram = NULL;
+	return 0;
+}
+
+static off_t ramGetSize(void) {
+	return ram->size;
+}
+
+static int ramRead(int *blockNumbers, char **buffers, int count) {
+	for(int i = 0; i < count; i++){
+		memcpy(buffers[i], ram->data + (off_t) BLOCK_SIZE*blockNumbers[i], BLOCK_SIZE);
+	}
+	return 0;
+}
+
+static int ramWrite(int *blockNumbers, char **buffers, int count) {
+	for(int i = 0; i < count; i++){
+		char *block = ram->data + (off_t) BLOCK_SIZE*blockNumbers[i];
+		if(block != buffers[i]){
+			memcpy(block, buffers[i], BLOCK_SIZE);
+		}
+	}
+	return 0;
+}
+
+static int ramFlush(void) {
+	return 0;
+}
+
+static char *ramPeek(int blockNumber) {
+	return ram->data + (off_t) BLOCK_SIZE*blockNumber;
+}
+
+const dev_ops_t ramDevice = {
+	"ram", ramOpen, ramClose, ramGetSize, ramRead, ramWrite, ramFlush, ramPeek, 0
+};
@@ -13,6 +13,11 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef FS_THREADS
+#include <pthread.h>
+#endif
 
 #include "include/filesystem.h"		// Headers for the core functionality
 #include "include/auxiliary.h"		// Headers for auxiliary functions
@@ -22,67 +27,495 @@
 
 superblock_t sb; /* superblock */
 inode_block_t * inodeList; /* Struct of inodes */
+char *inodeLoaded = NULL; /* one flag per inode block, set once read from the device; NULL if all are */
+char *inodeMap = NULL; /* i_map: one bit per inode, sb.imapBlocks blocks */
+char *blockMap = NULL; /* b_map: one bit per data block, sb.bmapBlocks blocks */
+char *metaFlags = NULL; /* META_DIRTY and META_LOGGED of every block before the data blocks */
+int *metaList = NULL; /* the blocks with a flag of metaFlags set, in no order */
+int metaCount = 0; /* blocks in metaList */
+int journalHead = 0; /* block of the journal where the next transaction goes */
+int journalOps = 0; /* operations in the running transaction */
+unsigned int journalNextSeq = 0; /* sequence number of the next transaction */
+file_state_t *fileState = NULL; /* state of the open files, one per inode */
+open_file_t *fileTable = NULL; /* open file table: FILE_TABLE_SIZE descriptors, the one of openFile is the index */
+int fileCursor = 0; /* no descriptor of fileTable below it is free */
+int freeInodes = 0, freeBlocks = 0; /* free bits of i_map and b_map */
+int blockCursor = 0; /* next-fit: bit of b_map where the next search starts */
+int inodeCursor = 0; /* no bit of i_map below it is free */
+dir_buffer_t *dirBuffers = NULL; /* directory nodes changed since the last checkpoint */
+int dirBufferCount = 0, dirBufferSize = 0; /* nodes in dirBuffers and room for them */
+int *dirFreed = NULL; /* blocks of directory nodes logged by the journal, freed at the next checkpoint */
+int dirFreedCount = 0, dirFreedSize = 0; /* blocks in dirFreed and room for them */
+int *fileCached = NULL; /* open files that keep the root of their extent tree or delayed blocks in their fileState */
+int fileCachedCount = 0, fileCachedSize = 0; /* files in fileCached and room for them */
+int delayedTotal = 0; /* blocks promised out of freeBlocks to the delayed blocks of the open files and to the extent nodes they may need */
+char deviceImage[DEVICE_NAME_MAX] = DEVICE_IMAGE; /* device the file system lives on */
+int deviceBackend = DEVICE_FD; /* backend used to attach the device */
+
+#define META_DIRTY 1 /* the block changed since the last commit */
+#define META_LOGGED 2 /* the journal holds a copy of the block newer than its home */
+#define DIR_ROOT -1 /* the root directory, which has no inode */
+
+/* calls made on behalf of others, inside their locks */
+static int journalDue(void);
+
+/* descriptors of the open file table */
+static open_file_t *fileAt(int fileDescriptor);
+static int fileInode(int fileDescriptor);
+static int fileOpen(int inode_id);
+static void fileRelease(int fileDescriptor);
+static void fileReleaseAll(int inode_id);
+static int fileLookup(int fileDescriptor, int fileBlock, int n, int *blocks);
+
+/* blocks of the maps */
+static int allocKept(int n, int *blocks, int *kept);
+static int allocAvailable(void);
+
+/* metadata blocks held in memory, with the auxiliary functions */
+static int metaAlloc(void);
+static void metaDirty(int block);
+static void metaDirtyAll(void);
+static char *metaBuffer(int block);
+
+/* extents of a file, with the auxiliary functions */
+static inode_t *inodeAt(int inode_id);
+static int inodeUsed(int inode_id);
+static int extentLoad(int inode_id, extent_block_t *room, extent_t **extents);
+static int extentWalk(int inode_id, int fileBlock, extent_block_t *room, extent_t **extents);
+static int extentLookup(int inode_id, int fileBlock, int n, int *blocks, extent_t *last);
+static int extentBlocks(int inode_id);
+static int extentPathWrite(int inode_id, int level, int block, extent_t *node);
+static int extentGrow(int inode_id, extent_t *root, int count);
+static int extentPush(int inode_id, extent_t *extent);
+static int extentCacheAdd(int inode_id);
+static void extentCacheDrop(int inode_id);
+static int extentFlush(int inode_id);
+static int extentFlushAll(void);
+static int fileCacheJoin(int inode_id);
+static void fileCacheLeave(int inode_id);
+static int delayWrite(int inode_id, int mapped, long offset, const struct iovec *iov, int iovcnt, long at, int numBytes);
+static int delayFlush(int inode_id);
+static int delayFlushAll(void);
+static void delayDrop(int inode_id);
+static long fileSize(int inode_id);
+static int extentBuild(int fileBlock, int *blocks, int n, extent_t *extents);
+static int extentSearch(extent_t *extents, int count, int fileBlock);
+static void extentMap(extent_t *extents, int count, int fileBlock, int n, int *blocks);
+static int extentEnd(extent_t *extents, int count);
+static int extentRelease(extent_t *extents, int count, int level);
+static int extentFree(int inode_id);
+static int extentReserve(int inode_id, int mapped, int count);
+
+/* directories, with the auxiliary functions */
+static int pathParent(char *path, int *dir, char *name);
+static int pathLookup(char *path, int *inode_id);
+static int dirLookup(int dir, char *name);
+static int dirInsert(int dir, char *name, int inode_id);
+static int dirRemove(int dir, char *name);
+static int dirNext(int dir, char *name, char *next);
+
+#ifdef FS_STATS
+static fs_stats_t fsStats; /* counters of the entry points */
+#endif
+
+#ifdef FS_THREADS
+/* Lock of the inodes i with the same i % INODE_LOCKS */
+typedef struct{
+	pthread_rwlock_t file; /* the inode, the fileState and the descriptors of the files: shared by the reads and lseekFile, exclusive otherwise */
+	pthread_mutex_t stream; /* the readahead window and the last extent of their descriptors */
+} inode_lock_t;
+
+/*
+ * Locks of the file system, always taken in this order. A call takes fsLock shared for as
+ * long as it runs, and a single inode lock: directories are guarded by nameLock instead.
+ */
+static pthread_rwlock_t fsLock = PTHREAD_RWLOCK_INITIALIZER; /* exclusive to mount, unmount, mkFS and the commits */
+static pthread_rwlock_t nameLock = PTHREAD_RWLOCK_INITIALIZER; /* the directories: shared by lookups, exclusive to create and remove */
+static pthread_mutex_t seekLocks[FILE_TABLE_SIZE]; /* the seek pointer of each descriptor, for the calls that hold its inode shared */
+static inode_lock_t inodeLocks[INODE_LOCKS]; /* the files */
+static pthread_mutex_t tableLock = PTHREAD_MUTEX_INITIALIZER; /* the free descriptors of fileTable and fileCursor */
+static pthread_mutex_t allocLock = PTHREAD_MUTEX_INITIALIZER; /* the maps, their free counts and cursors, and delayedTotal */
+static pthread_mutex_t metaLock = PTHREAD_MUTEX_INITIALIZER; /* metaFlags, metaList, journalOps, fileCached and inodeLoaded */
+#ifdef FS_STATS
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER; /* fsStats */
+#endif
+static pthread_once_t lockOnce = PTHREAD_ONCE_INIT;
+static int commitDue = 0; /* a call asked for a commit, run once the calls in progress end; reset by the commit */
+static __thread int commitWanted = 0; /* the call of this thread asked for it, and waits for it */
+
+static void lockInit(void)
+{
+	for(int i = 0; i < FILE_TABLE_SIZE; i++){
+		pthread_mutex_init(&seekLocks[i], NULL);
+	}
+	for(int i = 0; i < INODE_LOCKS; i++){
+		pthread_rwlock_init(&inodeLocks[i].file, NULL);
+		pthread_mutex_init(&inodeLocks[i].stream, NULL);
+	}
+}
+#endif
+
+/*
+ * Starts a call: shared, or exclusive to mount, unmount and mkFS. A commit asked for
+ * is run first, so that the calls that keep coming do not put it off. Without FS_THREADS it is empty.
+ */
+static inline void fsEnter(int exclusive)
+{
+#ifdef FS_THREADS
+	pthread_once(&lockOnce, lockInit);
+	if(exclusive){
+		pthread_rwlock_wrlock(&fsLock);
+		return;
+	}
+	if(__atomic_load_n(&commitDue, __ATOMIC_ACQUIRE)){
+		pthread_rwlock_wrlock(&fsLock);
+		if(__atomic_load_n(&commitDue, __ATOMIC_ACQUIRE)){
+			journalCommit();
+		}
+		pthread_rwlock_unlock(&fsLock);
+	}
+	pthread_rwlock_rdlock(&fsLock);
+#endif
+}
+
+/*
+ * Ends a call. The commit it asked for runs now, once no other call is in progress,
+ * and the call returns after it. Without FS_THREADS it is empty.
+ *
+ * @return 	0 if success, -1 if the commit failed.
+ */
+static inline int fsLeave(void)
+{
+	int ret = 0;
+#ifdef FS_THREADS
+	pthread_rwlock_unlock(&fsLock);
+	if(commitWanted){
+		commitWanted = 0;
+		/* another call may have run it meanwhile */
+		pthread_rwlock_wrlock(&fsLock);
+		if(__atomic_load_n(&commitDue, __ATOMIC_ACQUIRE)){
+			ret = journalCommit();
+		}
+		pthread_rwlock_unlock(&fsLock);
+	}
+#endif
+	return ret;
+}
+
+/*
+ * Locks the directories: shared to look names up, exclusive to change them. Without FS_THREADS it is empty.
+ */
+static inline void nameEnter(int exclusive)
+{
+#ifdef FS_THREADS
+	if(exclusive){
+		pthread_rwlock_wrlock(&nameLock);
+	}
+	else{
+		pthread_rwlock_rdlock(&nameLock);
+	}
+#endif
+}
+
+static inline void nameLeave(void)
+{
+#ifdef FS_THREADS
+	pthread_rwlock_unlock(&nameLock);
+#endif
+}
+
+/*
+ * Locks the seek pointer of a descriptor, which the calls that hold its inode exclusive move
+ * without it. Taken before the inode. Without FS_THREADS, or for no descriptor, it is empty.
+ */
+static inline void seekEnter(int fileDescriptor)
+{
+#ifdef FS_THREADS
+	if(fileDescriptor >= 0 && fileDescriptor < FILE_TABLE_SIZE){
+		pthread_mutex_lock(&seekLocks[fileDescriptor]);
+	}
+#endif
+}
+
+static inline void seekLeave(int fileDescriptor)
+{
+#ifdef FS_THREADS
+	if(fileDescriptor >= 0 && fileDescriptor < FILE_TABLE_SIZE){
+		pthread_mutex_unlock(&seekLocks[fileDescriptor]);
+	}
+#endif
+}
+
+/*
+ * Locks a file: shared by the reads and lseekFile, exclusive to the calls that change it. Without FS_THREADS it is empty.
+ */
+static inline void inodeEnter(int inode_id, int exclusive)
+{
+#ifdef FS_THREADS
+	pthread_rwlock_t *lock = &inodeLocks[(unsigned int) inode_id % INODE_LOCKS].file;
+	if(exclusive){
+		pthread_rwlock_wrlock(lock);
+	}
+	else{
+		pthread_rwlock_rdlock(lock);
+	}
+#endif
+}
+
+static inline void inodeLeave(int inode_id)
+{
+#ifdef FS_THREADS
+	pthread_rwlock_unlock(&inodeLocks[(unsigned int) inode_id % INODE_LOCKS].file);
+#endif
+}
+
+/*
+ * Locks the inode a descriptor is open on, as inodeEnter, and returns it, -1 if the descriptor
+ * is not open. The descriptor may be closed and taken for another file before the lock, which is
+ * then taken again.
+ */
+static inline int fileEnter(int fileDescriptor, int exclusive)
+{
+	int inode_id = fileInode(fileDescriptor);
+	inodeEnter(inode_id, exclusive);
+	while(fileInode(fileDescriptor) != inode_id){
+		inodeLeave(inode_id);
+		inode_id = fileInode(fileDescriptor);
+		inodeEnter(inode_id, exclusive);
+	}
+	return inode_id;
+}
+
+/*
+ * Locks the readahead window and the last extent of the descriptors of a file, which the readers
+ * that share the file move. Without FS_THREADS it is empty.
+ */
+static inline void streamEnter(int inode_id)
+{
+#ifdef FS_THREADS
+	pthread_mutex_lock(&inodeLocks[(unsigned int) inode_id % INODE_LOCKS].stream);
+#endif
+}
+
+static inline void streamLeave(int inode_id)
+{
+#ifdef FS_THREADS
+	pthread_mutex_unlock(&inodeLocks[(unsigned int) inode_id % INODE_LOCKS].stream);
+#endif
+}
+
+/*
+ * Locks the free descriptors of the open file table. Without FS_THREADS it is empty.
+ */
+static inline void tableEnter(void)
+{
+#ifdef FS_THREADS
+	pthread_mutex_lock(&tableLock);
+#endif
+}
+
+static inline void tableLeave(void)
+{
+#ifdef FS_THREADS
+	pthread_mutex_unlock(&tableLock);
+#endif
+}
+
+/*
+ * Locks the maps, or the metadata flags, for a short update. Without FS_THREADS they are empty.
+ */
+static inline void allocEnter(void)
+{
+#ifdef FS_THREADS
+	pthread_mutex_lock(&allocLock);
+#endif
+}
+
+static inline void allocLeave(void)
+{
+#ifdef FS_THREADS
+	pthread_mutex_unlock(&allocLock);
+#endif
+}
+
+static inline void metaEnter(void)
+{
+#ifdef FS_THREADS
+	pthread_mutex_lock(&metaLock);
+#endif
+}
+
+static inline void metaLeave(void)
+{
+#ifdef FS_THREADS
+	pthread_mutex_unlock(&metaLock);
+#endif
+}
+
+/* Start of a call to an entry point */
+typedef struct{
+	struct timespec start; /* time the call started */
+	unsigned long reads, writes; /* block counters when the call started */
+} fs_probe_t;
+
+/*
+ * Takes the time and block counters at the start of a call. Without FS_STATS it is empty.
+ */
+static inline void probeBegin(fs_probe_t *probe)
+{
+#ifdef FS_STATS
+	bstats_t st;
+	bgetstats(&st);
+	probe->reads = st.reads;
+	probe->writes = st.writes;
+	clock_gettime(CLOCK_MONOTONIC, &probe->start);
+#endif
+}
+
+/*
+ * Adds a finished call to the counters of its entry point. Without FS_STATS it is empty.
+ */
+static inline void probeEnd(fs_probe_t *probe, int op, int bytes)
+{
+#ifdef FS_STATS
+	struct timespec end;
+	bstats_t st;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	bgetstats(&st);
+	long ns = (end.tv_sec - probe->start.tv_sec) * 1000000000L + end.tv_nsec - probe->start.tv_nsec;
+	int bucket = ns > 1 ? 63 - __builtin_clzl(ns) : 0; /* floor(log2(ns)) */
+	if(bucket >= FS_LATENCY_BUCKETS){
+		bucket = FS_LATENCY_BUCKETS - 1;
+	}
+	fs_op_stats_t *counters = &fsStats.op[op];
+#ifdef FS_THREADS
+	pthread_mutex_lock(&statsLock);
+#endif
+	counters->calls++;
+	counters->bytes += bytes;
+	counters->blockReads += st.reads - probe->reads;
+	counters->blockWrites += st.writes - probe->writes;
+	counters->latency[bucket]++;
+#ifdef FS_THREADS
+	pthread_mutex_unlock(&statsLock);
+#endif
+#endif
+}
+
+/*
+ * @brief 	Selects the device used by the following mkFS and mountFS calls.
+ *
+ * @param deviceName: image file for DEVICE_FD and DEVICE_MMAP, or RAM disk for DEVICE_RAM.
+ * @param backend: DEVICE_FD, DEVICE_MMAP or DEVICE_RAM.
+ * @return 	0 if success, -1 otherwise.
+ */
+int setDevice(char *deviceName, int backend)
+{
+	if(strlen(deviceName) >= DEVICE_NAME_MAX || backend < DEVICE_FD || backend > DEVICE_RAM){
+		return -1;
+	}
+	/* the device in use cannot change under a mounted file system */
+	if(bmounted(deviceImage)){
+		return -1;
+	}
+	strcpy(deviceImage, deviceName);
+	deviceBackend = backend;
+	return 0;
+}
 
 /*
  * @brief 	Generates the proper file system structure in a storage device, as designed by the student.
  *
  * NF4 The file system block size will be 2048 bytes.
- * NF6 The file system will be used on disks from 50 KiB to 10 MiB.
+ * NF6 The file system will be used on disks from 50 KiB to MAX_FILE_SYSTEM_SIZE.
  * NF7 The size of on-disk filesystem metadata shall be minimized. (mierda)
  * NF8 The implementation shall not waste available resources. (mierda)
  *
+ * The inode table, the maps and the largest file are sized from the device:
+ * one inode per BYTES_PER_INODE bytes, INODE_MIN_NUMBER at least, rounded
+ * up to whole inode blocks.
+ *
  * @param deviceSize: size of the disk to be formatted in bytes.
  * @return 	0 if success, -1 otherwise.
  */
-int mkFS(long deviceSize)
+static int doMkFS(long deviceSize)
 {
-	int deviceSizeInt = (int) (deviceSize); /* convert the size of the file to integer */
 	/* check the validity of the size of the device */
-	if(deviceSizeInt < MIN_FILE_SYSTEM_SIZE || deviceSizeInt > MAX_FILE_SYSTEM_SIZE){
+	if(deviceSize < MIN_FILE_SYSTEM_SIZE || deviceSize > MAX_FILE_SYSTEM_SIZE){
 		return -1;
 	}
+	unsigned long long deviceBlocks = deviceSize / BLOCK_SIZE;
 
 	/* Superblock's magic number */
 	sb.magicNum = 1; /* por poner algo */
-	/* Number of data blocks in the device */
-	sb.dataBlockNum = needed_blocks(deviceSizeInt, 'B'); /* The size of the device over the block size */
-	/* Number of inodes in the device */
-	sb.numInodes = INODE_MAX_NUMBER; /* Stated in the PDF */
+	sb.version = FS_VERSION;
 	/* Set the size of the disk */
-	sb.deviceSize = deviceSizeInt;
+	sb.deviceSize = deviceSize;
 	/* Number of the first inode */
 	sb.firstInode = 2; /* the first inode is after the superblock */
 
-	/* calculate the number of inode_block_t that we need */
-	sb.inodesBlocks = (int) (INODE_MAX_NUMBER / INODE_PER_BLOCK);
-	if(((INODE_MAX_NUMBER % INODE_PER_BLOCK)) != 0){
-		sb.inodesBlocks++;
+	/* Number of inodes in the device, filling the inode blocks */
+	unsigned long long inodes = deviceSize / BYTES_PER_INODE;
+	if(inodes < INODE_MIN_NUMBER){
+		inodes = INODE_MIN_NUMBER;
 	}
-
-    /* Number of the first data block */
-    sb.firstDataBlock = sb.firstInode + sb.inodesBlocks; /* after the last inode block */
-
-	/* memory for the list of inodes */
-	inodeList = malloc(sizeof(inode_block_t) * sb.inodesBlocks);
-
-	/* Setting as free all the bitmap positions */
-	for(int i = 0; i < sb.numInodes; i++){ /* inode bitmap */
-		bitmap_setbit(sb.i_map, i, 0); /* free */
+	if(inodes > INODE_MAX_NUMBER){
+		inodes = INODE_MAX_NUMBER;
+	}
+	sb.inodesBlocks = (inodes + INODE_PER_BLOCK - 1) / INODE_PER_BLOCK;
+	sb.numInodes = sb.inodesBlocks * INODE_PER_BLOCK;
+
+	/* journal after the inode blocks, a sixteenth of the device at most */
+	sb.journalStart = sb.firstInode + sb.inodesBlocks;
+	sb.journalBlocks = deviceBlocks / 16;
+	if(sb.journalBlocks < JOURNAL_MIN_BLOCKS){
+		sb.journalBlocks = JOURNAL_MIN_BLOCKS;
 	}
-	for(int i = 0; i < sb.dataBlockNum; i++){ /* block bitmap */
-		bitmap_setbit(sb.b_map, i, 0); /* free */
+	if(sb.journalBlocks > JOURNAL_MAX_BLOCKS){
+		sb.journalBlocks = JOURNAL_MAX_BLOCKS;
+	}
+	sb.journalSeq = 1;
+	journalNextSeq = 1;
+	journalHead = 0;
+	journalOps = 0;
+
+	/* the maps after the journal: one bit per inode and one per block of the device at most */
+	sb.imapStart = sb.journalStart + sb.journalBlocks;
+	sb.imapBlocks = (sb.numInodes + MAP_BITS_PER_BLOCK - 1) / MAP_BITS_PER_BLOCK;
+	sb.bmapStart = sb.imapStart + sb.imapBlocks;
+	sb.bmapBlocks = (deviceBlocks + MAP_BITS_PER_BLOCK - 1) / MAP_BITS_PER_BLOCK;
+
+	/* Number of the first data block */
+	sb.firstDataBlock = sb.bmapStart + sb.bmapBlocks; /* after the last block of the maps */
+	if(sb.firstDataBlock >= deviceBlocks){
+		return -1;
 	}
+	/* Number of data blocks in the device */
+	sb.dataBlockNum = deviceBlocks - sb.firstDataBlock;
+	/* a file may take all the data blocks */
+	sb.maxFileSize = sb.dataBlockNum * BLOCK_SIZE;
 
-	/* Free the inode blocks */
-	for(int i = 0; i < sb.inodesBlocks; i++){
-		memset(&(inodeList[i]), 0, sizeof(inode_block_t));
+	/* memory for the inodes and the maps, all of them free */
+	if(metaAlloc() < 0){
+		return -1;
 	}
+	allocInit();
+	/* everything is written by the format */
+	metaDirtyAll();
+
+	/* an empty root directory takes no block */
+	sb.rootDir = 0;
+	sb.rootEntries = 0;
+
+	/* open the device just for the format if it is not mounted */
+	int session = !bmounted(deviceImage) && bmount(deviceImage, deviceBackend) == 0;
 
 	/* write the default file system into disk */
-	if( umount() < 0 ){ /* check for errors in umount */
-		return -1;
+	int ret = umount(); /* check for errors in umount */
+	if(session){
+		bumount();
 	}
-	return 0;
+	return ret < 0 ? -1 : 0;
 }
 
 /*
@@ -94,15 +527,69 @@ int mkFS(long deviceSize)
  */
 int mountFS(void)
 {
+	return mountFSBackend(deviceBackend);
+}
+
+/*
+ * @brief 	Mounts a file system in the simulated device using the given device backend.
+ *
+ * Only the superblock and the maps are read: the inodes and the directories are
+ * read as the lookups reach them.
+ *
+ * @param backend: DEVICE_FD, DEVICE_MMAP or DEVICE_RAM.
+ * @return 	0 if success, -1 otherwise.
+ */
+static int doMountFSBackend(int backend)
+{
+    /* open the device once for the whole session */
+    if(!bmounted(deviceImage) && bmount(deviceImage, backend) < 0){
+        return -1;
+    }
     /* read the superblock from the disk to the new superblock */
-    if(bread(DEVICE_IMAGE, 1, (char *) (&sb)) < 0){
+    if(bread(deviceImage, 1, (char *) (&sb)) < 0 || sb.version != FS_VERSION){
+        bumount();
+        return -1;
+    }
+    /* apply the transactions committed before a crash */
+    if(journalReplay() < 0){
+        bumount();
+        return -1;
+    }
+    /* the inode list is a copy of its own even on a device in memory, which could
+       write an inode block back home before the journal logs it */
+    if(metaAlloc() < 0){
+        bumount();
         return -1;
     }
-    /* read the inodeList from disk */
-    for(int i = 0; i < sb.inodesBlocks; i++){
-        if( bread(DEVICE_IMAGE, i+sb.firstInode, (char *) (&inodeList) + i*BLOCK_SIZE) < 0){
-            return -1;
-        }
+    /* the maps in one request; the inode blocks are read on first use */
+    int mapBlocks = sb.imapBlocks + sb.bmapBlocks;
+    int *blocks = malloc(sizeof(int) * mapBlocks);
+    char **buffers = malloc(sizeof(char *) * mapBlocks);
+    int ret = blocks == NULL || buffers == NULL ? -1 : 0;
+    for(int i = 0; ret == 0 && i < mapBlocks; i++){
+        blocks[i] = sb.imapStart + i; /* the block map follows the inode map */
+        buffers[i] = i < (int) sb.imapBlocks ? inodeMap + (long) BLOCK_SIZE * i
+                                             : blockMap + (long) BLOCK_SIZE * (i - sb.imapBlocks);
+    }
+    if(ret == 0){
+        ret = breadv(deviceImage, blocks, buffers, mapBlocks);
+    }
+    free(blocks);
+    free(buffers);
+    if(ret < 0){
+        bumount();
+        return -1;
+    }
+    /* the free counts are kept in the superblock */
+    freeInodes = sb.freeInodes;
+    freeBlocks = sb.freeBlocks;
+    blockCursor = 0;
+    inodeCursor = 0;
+    /* the inode blocks are read the first time a lookup reaches them */
+    inodeLoaded = calloc(sb.inodesBlocks, 1);
+    if(inodeLoaded == NULL){
+        bumount();
+        return -1;
     }
 	return 0;
 }
@@ -114,418 +601,2849 @@ int mountFS(void)
  *
  * @return 	0 if success, -1 otherwise.
  */
-int unmountFS(void)
+static int doUnmountFS(void)
 {
-	/* Free the inode blocks */
-	for(int i = 0; i < sb.inodesBlocks; i++){
-		memset(&(inodeList[i]), 0, sizeof(inode_block_t));
-  	}
-  	/* Free  */
-  	for(int i = 0; i < sb.numInodes; i++){
-		ifree(i);
-		bfree(i);
+	/* give blocks to the data of the open files, write the metadata home and leave the journal empty */
+	if(bmounted(deviceImage) && (delayFlushAll() < 0 || journalCheckpoint() < 0)){
+		return -1;
 	}
+	/* close the device session opened by mountFS */
+	if(bmounted(deviceImage)){
+		bumount();
+	}
+	/* the metadata in memory is empty now, with the same layout: a later sync writes all of it */
+	if(metaAlloc() < 0){
+		return -1;
+	}
+	allocInit();
+	metaDirtyAll();
+	/* the root directory is empty too */
+	sb.rootDir = 0;
+	sb.rootEntries = 0;
     return 0;
 }
 
 /*
- * @brief	Creates a new file, provided it it doesn't exist in the file system.
+ * @brief	Creates a new file or directory, provided it doesn't exist in the file system.
  *
- * NF1 The maximum number of files in the file system will never be higher than 40.
- * NF2 The maximum length of the file name will be 32 characters.
- * NF3 The maximum size of the file will be 1 MiB.
+ * NF1 The maximum number of files and directories is sb.numInodes, set by mkFS.
+ * NF2 The maximum length of the file name will be 32 characters, for every component of its path.
+ * NF3 The maximum size of the file is sb.maxFileSize, set by mkFS.
  *
- * @param fileName: name of the file to be created.
- * @return	0 if success, -1 if the file already exists, -2 in case of error.
+ * @param path: path of the file or directory to be created.
+ * @param type: INODE_FILE or INODE_DIR.
+ * @return	0 if success, -1 if it already exists, -2 in case of error.
  */
-int createFile(char *fileName)
+static int doCreateInode(char *path, int type)
 {
-	/* Check NF2 */
-	if(strlen(fileName) > NAME_MAX) return -2;
+	char name[NAME_MAX + 1];
+	int dir;
 
-  	if(getInodePosition(fileName) >= 0) return -1;
+	/* Check NF2, and that the directories of the path exist */
+	if(pathParent(path, &dir, name) < 0) return -2;
+
+	int found = dirLookup(dir, name);
+	if(found == -2) return -2;
+	if(found >= 0) return -1;
 
 	int position = ialloc(); /* get the position of a free inode */
     if(position < 0) {return -1;} /* error while ialloc */
-
-	int bPos = alloc(); /* get the position of a free data block */
-	if(bPos < 0) {return -1;} /* error while alloc */
-
-	/* know in what block of inodes it is */
-	int aux = position / INODE_PER_BLOCK;
-	position = position % INODE_PER_BLOCK;
-
-	inodeList[aux].inodeArray[position].indirectBlock = bPos;
-	inodeList[aux].inodeArray[position].ptr = 0;
-
-  	strcpy(inodeList[aux].inodeArray[position].name, fileName);
-	inodeList[aux].inodeArray[position].size = 0;
-	/* We set the new file to closed */
-	inodeList[aux].inodeArray[position].opened = 0;
-
+	inode_t *inode = inodeAt(position);
+	inodeEnter(position, 1);
+
+	/* no blocks until the first write, no entries until the first create in it */
+	inode->indirectBlock = 0;
+	inode->extents = 0;
+	inode->depth = 0;
+	inode->type = type;
+
+	memcpy(inode->name, name, NAME_MAX);
+	inode->size = 0;
+	dirtyInode(position);
+	inodeLeave(position);
+
+	/* the entry in its directory */
+	if(dirInsert(dir, name, position) < 0){
+		ifree(position);
+		return -2;
+	}
 	syncFS();
 	return 0;
 }
 
 /*
- * @brief	Deletes a file, provided it exists in the file system.
- * @param fileName: name of the file to be removed.
- * @return	0 if success, -1 if the file does not exist, -2 in case of error..
+ * @brief	Deletes a file, or a directory provided it is empty.
+ * @param path: path of the file or directory to be removed.
+ * @param type: INODE_FILE or INODE_DIR.
+ * @return	0 if success, -1 if it does not exist or is not empty, -2 in case of error..
  */
-int removeFile(char *fileName)
+static int doRemoveInode(char *path, int type)
 {
-	/* Name is too long */
-	if(strlen(fileName) > NAME_MAX){
-		return -2;
+	char name[NAME_MAX + 1];
+	int dir;
+
+	/* Name is too long, or a directory of the path does not exist */
+	int ret = pathParent(path, &dir, name);
+	if(ret < 0){
+		return ret;
 	}
 	/* get the position of the file to be deleted */
-	int position = getInodePosition(fileName);
-	/* know in what block of inodes it is */
-	int aux = position / INODE_PER_BLOCK;
-	position = position % INODE_PER_BLOCK;
-
-	if(position >= 0){
- 		if(inodeList[aux].inodeArray[position].opened == 1){
-			closeFile(position);
-		}
-		strcpy(inodeList[aux].inodeArray[position].name, "");
-		inodeList[aux].inodeArray[position].size = 0;
-		inodeList[aux].inodeArray[position].indirectBlock = 0;
-
-		inodeList[aux].inodeArray[position].ptr = 0;
+	int position = dirLookup(dir, name);
+	if(position < 0){
+		return position;
+	}
+	inode_t *inode = inodeAt(position);
+	inodeEnter(position, 1);
+	if(inode->type != type || (type == INODE_DIR && inode->size != 0)){
+		ret = -1;
+	}
 
-		bitmap_setbit(sb.i_map, position, 0);
-		syncFS();
-		return 0;
+	if(ret == 0 && fileState[position].opens > 0){
+		/* the delayed blocks of the file never reach the device, and its descriptors are closed */
+		delayDrop(position);
+		fileReleaseAll(position);
 	}
-	else{
-		return -1;
+	/* give back the data blocks and the nodes of the extent tree */
+	if(ret == 0 && type == INODE_FILE && extentFree(position) < 0){
+		ret = -2;
+	}
+	if(ret == 0 && dirRemove(dir, name) < 0){
+		ret = -2;
+	}
+	if(ret == 0){
+		strcpy(inode->name, "");
+		inode->size = 0;
+		inode->indirectBlock = 0;
+		inode->type = INODE_FILE;
+		dirtyInode(position);
+
+		ifree(position);
+	}
+	inodeLeave(position);
+	if(ret < 0){
+		return ret;
 	}
+	syncFS();
+	return 0;
 }
 
 /*
  * @brief	Opens an existing file and initializes its seek pointer to the beginning of the file.
+ * Every open gets a descriptor of its own in the open file table, the same file as many as
+ * there are free; nothing is written, neither in memory nor in the device.
  *
  * F2 Every time a file is opened, its seek pointer will be reset to the beginning of the file.
  * F5 File integrity must be checked, at least, on open operations.
  *
- * @param fileName: name of the file to be opened.
+ * @param fileName: path of the file to be opened.
  * @return	The file descriptor if possible, -1 if file does not exist, -2 in case of error..
  */
- int openFile(char *fileName)
+static int doOpenFile(char *fileName)
  {
 	int position = getInodePosition(fileName);
 	/* check if the file exists */
 	if(position < 0){ return -1;}
-	 /* know in what block of inodes it is */
-	 int aux = position / INODE_PER_BLOCK;
-	 /* position inside the block */
-	 int bPosition = position % INODE_PER_BLOCK;
-
-	/* If the file is already opened */
-	if(inodeList[aux].inodeArray[bPosition].opened == 1){
-		return -1;
-	}
+	inode_t *inode = inodeAt(position);
+	int ret = -1;
+	inodeEnter(position, 1);
 
-	/* If the file name is the same as the one in the inode and the entry of
-	that inode in the bitmap is not empty then the file is ready to be openned */
-	if((strcmp(fileName,inodeList[aux].inodeArray[bPosition].name) == 0) && bitmap_getbit(sb.i_map,position) == 1){
-		inodeList[aux].inodeArray[bPosition].opened = 1;
-		/* Set pointer of file to 0 */
-		if(inodeList[aux].inodeArray[bPosition].ptr > 0) inodeList[aux].inodeArray[bPosition].ptr = 0;
-		syncIN();
-		return position; //i is the file descriptor
+	/* A directory is not opened; the entry of that inode in the bitmap is not empty: the file is ready to be openned */
+	if(inode->type == INODE_FILE && inodeUsed(position)){
+		ret = fileOpen(position);
 	}
- 	return -1;
+	inodeLeave(position);
+ 	return ret;
  }
 
 /*
- * @brief	Closes a file.
+ * @brief	Closes a file. The descriptor is given back to the open file table; a close of a
+ * descriptor that did not write the file writes nothing.
  * @param fileDescriptor: descriptor of the file to close.
  * @return	0 if success, -1 otherwise.
  */
-int closeFile(int fileDescriptor)
+static int doCloseFile(int fileDescriptor)
 {
 	//PDF: when the file descriptor is closed, all file blocks are flushed to disk
-	if(fileDescriptor < 0){
+	open_file_t *file = fileAt(fileDescriptor);
+	if(file == NULL){
 		return -1;
 	}
+	int inode_id = file->inode;
+	int written = file->flags & FILE_WRITTEN;
 
-	/* know in what block of inodes it is */
-	int aux = fileDescriptor / INODE_PER_BLOCK;
-	/* position inside the block */
-	int bPosition = fileDescriptor % INODE_PER_BLOCK;
-
-	/* If the file is already closed */
-	if(inodeList[aux].inodeArray[bPosition].opened == 0){
+	/* the delayed blocks take their device blocks, then the root of the extent tree
+	   kept since the first open is written if it changed, at the latest by the last close */
+	if(written && delayFlush(inode_id) < 0){
+		return -1;
+	}
+	if((written || fileState[inode_id].opens == 1) && extentFlush(inode_id) < 0){
+		return -1;
+	}
+	fileRelease(fileDescriptor);
+	if(!written){
+		return 0;
+	}
+	/* commit the operations of the running transaction, which flushes the file blocks too */
+	if(journalDue() < 0){
+		return -1;
+	}
+	/* write the cached blocks back to the device */
+	if(bflush() < 0){
 		return -1;
 	}
-
-	inodeList[aux].inodeArray[bPosition].opened = 0;
-	syncIN();
 	return 0;
 }
 
 /*
- * @brief	Reads a number of bytes from a file, starting from the seek pointer of the file, and stores them in a buffer.
- * The seek pointer of the file is incremented as many bytes read from the file.
+ * @brief	Copies bytes between a buffer and the buffers of an iovec array, taken as one run of bytes.
  *
- * F6 The whole contents of a file could be read by means of several read operations.
+ * @param iov, iovcnt: the buffers.
+ * @param at: first byte of the run copied.
+ * @param buffer: the other end of the copy; NULL fills the run with zeros.
+ * @param length: number of bytes copied.
+ * @param toIov: 1 copies buffer into the run, 0 the run into buffer.
+ */
+static void iovCopy(const struct iovec *iov, int iovcnt, long at, char *buffer, long length, int toIov)
+{
+	for(int i = 0; i < iovcnt && length > 0; i++){
+		if(at >= (long) iov[i].iov_len){
+			at -= iov[i].iov_len;
+			continue;
+		}
+		long n = (long) iov[i].iov_len - at < length ? (long) iov[i].iov_len - at : length;
+		char *segment = (char *) iov[i].iov_base + at;
+		if(!toIov){
+			memcpy(buffer, segment, n);
+		}
+		else if(buffer == NULL){
+			memset(segment, 0, n);
+		}
+		else{
+			memcpy(segment, buffer, n);
+		}
+		if(buffer != NULL){
+			buffer += n;
+		}
+		length -= n;
+		at = 0;
+	}
+}
+
+/*
+ * @brief	Finds bytes of the run of an iovec array in a single buffer.
+ *
+ * @return	The address of the length bytes of the run from at, NULL if they span two buffers.
+ */
+static char *iovSpan(const struct iovec *iov, int iovcnt, long at, long length)
+{
+	int i = 0;
+	while(i < iovcnt && at >= (long) iov[i].iov_len){
+		at -= iov[i].iov_len;
+		i++;
+	}
+	if(i == iovcnt || at + length > (long) iov[i].iov_len){
+		return NULL;
+	}
+	return (char *) iov[i].iov_base + at;
+}
+
+/*
+ * @brief	Reads a number of bytes from a file, starting from a given offset, and stores them in the
+ * buffers of an iovec array, filled in order. Neither the seek pointer nor the inode of the file change.
+ * The whole blocks that fit in one buffer are read straight into it; a partial block, or one that
+ * spans two buffers, is read into a block of the stack and copied.
  *
  * @param fileDescriptor: file descriptor of the file to be read.
- * @param buffer: buffer that will store the read data after the execution of the function.
- * @param numBytes: number of bytes to read from the file.
+ * @param iov, iovcnt: buffers that will store the read data after the execution of the function.
+ * @param numBytes: number of bytes to read from the file, up to the bytes of the buffers.
+ * @param offset: first byte to read; from the end of the file on, nothing is read.
  *
  * @return	Number of bytes properly read, -1 in case of error.
  */
- int readFile(int fileDescriptor, void *buffer, int numBytes)
+static int doReadFileAtV(int fileDescriptor, const struct iovec *iov, int iovcnt, int numBytes, long offset)
  {
-  int bytesRead = 0;
-  int aux = fileDescriptor / INODE_PER_BLOCK;
-  int position = fileDescriptor % INODE_PER_BLOCK;
-  int pointer = inodeList[aux].inodeArray[position].ptr;
-  index_file_t indBlock;
-  int needed_blocks = 0;
-
-	 /* If the file descriptor does not exist or no bytes to read or pointer is set_pointer
-       to the end of the file or if the inode is unused, error */
-  if(fileDescriptor < 0 || fileDescriptor > sb.numInodes || numBytes == 0 || sb.i_map[fileDescriptor] == 0){
+  int local[1 + 2 * RA_MAX_BLOCKS];
+  char *direct[1 + 2 * RA_MAX_BLOCKS];
+  char block[BLOCK_SIZE];
+
+	 /* If the file descriptor is not open or no bytes to read, error */
+  open_file_t *file = fileAt(fileDescriptor);
+  if(file == NULL || numBytes <= 0 || offset < 0){
     return -1;
   }
 
-  /* If the file is not opened we proceed to open it */
-  if(inodeList[aux].inodeArray[position].opened == 0){
-    openFile(inodeList[aux].inodeArray[position].name);
+  /* Retrieve inode of the file from its descriptor */
+  int inode_id = file->inode;
+  inode_t *inode = inodeAt(inode_id);
+  file_state_t *st = &fileState[inode_id];
+  long size = fileSize(inode_id);
+  if(size == 0){ return 0;} /* Return 0 bytes (empty file) */
+  /* Size is not equal to zero */
+
+  /* A small file is read from the inode, without block I/O */
+  if(st->delayed == NULL && inode->size <= INODE_INLINE_SIZE){
+    if(numBytes > (long) inode->size - offset){
+      numBytes = inode->size - offset;
+    }
+    if(numBytes <= 0){ return 0;}
+    iovCopy(iov, iovcnt, 0, inode->data + offset, numBytes, 1);
+    return numBytes;
   }
 
-  /* Read the indirect block of the inode */
-  if(bread(DEVICE_IMAGE, inodeList[aux].inodeArray[position].indirectBlock, (char *)(&indBlock)) < 0){ return -1;}
+  /* Blocks mapped by the extents, all the blocks of the file but the delayed ones */
+  int mapped = st->delayed == NULL ? (size + BLOCK_SIZE - 1) / BLOCK_SIZE : extentBlocks(inode_id);
+  if(mapped < 0){ return -1;}
 
-  /* Retrieve inode of the file (fileDescriptor == index on array of inodes) */
-  if(inodeList[aux].inodeArray[position].size == 0){ return 0;} /* Return 0 bytes (empty file) */
-  /* Size is not equal to zero */
-	
-  lseekFile(fileDescriptor, 0, FS_SEEK_BEGIN);
-
-  /* If the number of bytes to be read plus the bytes to be read are less than the size
-  of the file then proceed to read as normal until the bytes to read have been read. */
-  needed_blocks = blocks_toWrite(numBytes, inodeList[aux].inodeArray[position].size, BLOCK_SIZE);
-  if(pointer + numBytes <= inodeList[aux].inodeArray[position].size){
-      /* Read the inode until the numBytes has been read*/
-	  for(int j = 0; j <= needed_blocks; j++) {
-		  if (bread(DEVICE_IMAGE, sb.firstDataBlock + indBlock.pos[j], buffer+BLOCK_SIZE*j) < 0) { return -1; }
+  /* Read from offset up to the end of the file at most */
+  long pointer = offset;
+  if(numBytes > size - pointer){
+    numBytes = size - pointer;
+  }
+  if(numBytes <= 0){ return 0;}
+  int first = pointer / BLOCK_SIZE;
+  int last = (pointer + numBytes - 1) / BLOCK_SIZE;
+
+  /* Device blocks of the read and of the largest readahead window after it: from the last extent
+     of the descriptor while they stay in it, otherwise a file with more than EXTENT_INLINE reads
+     the root of its extent tree once per open, and the nodes under it through the block cache */
+  int blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  if(blocks > mapped){
+	  blocks = mapped;
+  }
+  int span = last + 1 + RA_MAX_BLOCKS < blocks ? last + 1 + RA_MAX_BLOCKS - first : blocks - first;
+  int *blockNumbers = span <= (int) (sizeof(local) / sizeof(int)) ? local : malloc(sizeof(int) * span);
+  if(blockNumbers == NULL){ return -1;}
+  if(span > 0 && fileLookup(fileDescriptor, first, span, blockNumbers) < 0){
+	  if(blockNumbers != local){
+		  free(blockNumbers);
 	  }
-	  char newBuf[numBytes];
-	  memcpy(newBuf,buffer,  numBytes);
-	  newBuf[numBytes] = '\0';
-
-	  memset(buffer,0, numBytes + 1);
+	  return -1;
+  }
 
-      memcpy(buffer,newBuf,  numBytes);
+  /* Bring the blocks of this read, and the next ones if the access is sequential, into the cache */
+  int bytesRead = readahead(fileDescriptor, blockNumbers, pointer, numBytes, blocks) < 0 ? -1 : 0;
 
-      pointer += numBytes; /* Update pointer */
-      syncIN();
-      return bytesRead;
+  for(int b = first; bytesRead >= 0 && b <= last; ){
+	  int from = b == first ? pointer % BLOCK_SIZE : 0;
+	  int length = BLOCK_SIZE - from;
+	  if(length > numBytes - bytesRead){
+		  length = numBytes - bytesRead;
+	  }
+	  /* the blocks after the extents are in the delayed blocks, the others no extent maps read as zeros */
+	  if(b - first >= span || blockNumbers[b - first] == 0){
+		  if(b >= mapped && b - mapped < st->delayedBlocks){
+			  iovCopy(iov, iovcnt, bytesRead, st->delayed + (long) (b - mapped) * BLOCK_SIZE + from, length, 1);
+		  }
+		  else{
+			  iovCopy(iov, iovcnt, bytesRead, NULL, length, 1);
+		  }
+	  }
+	  /* a partial head or tail block, or one across two buffers, goes through block */
+	  else if(length < BLOCK_SIZE || iovSpan(iov, iovcnt, bytesRead, BLOCK_SIZE) == NULL){
+		  if(bread(deviceImage, blockNumbers[b - first], block) < 0){
+			  bytesRead = -1;
+			  break;
+		  }
+		  iovCopy(iov, iovcnt, bytesRead, block + from, length, 1);
+	  }
+	  /* the whole blocks that follow go straight into the buffers, in one call */
+	  else{
+		  int n = 0;
+		  while(n < (int) (sizeof(direct) / sizeof(char *)) && b + n - first < span && blockNumbers[b + n - first] != 0
+				&& (long) (n + 1) * BLOCK_SIZE <= numBytes - bytesRead){
+			  direct[n] = iovSpan(iov, iovcnt, bytesRead + (long) n * BLOCK_SIZE, BLOCK_SIZE);
+			  if(direct[n] == NULL){
+				  break;
+			  }
+			  n++;
+		  }
+		  if(breadv(deviceImage, &blockNumbers[b - first], direct, n) < 0){
+			  bytesRead = -1;
+			  break;
+		  }
+		  bytesRead += n * BLOCK_SIZE;
+		  b += n;
+		  continue;
+	  }
+	  bytesRead += length;
+	  b++;
   }
-  else{
-      for(int j = 0; j <= needed_blocks; j++) {
-          if (bread(DEVICE_IMAGE, sb.firstDataBlock + indBlock.pos[j], buffer+BLOCK_SIZE*j) < 0) { return -1; }
-      }
-      pointer = inodeList[aux].inodeArray[position].size;
-      bytesRead = inodeList[aux].inodeArray[position].size-pointer;
-      syncIN();
-      return bytesRead;
-    }
+  if(blockNumbers != local){
+	  free(blockNumbers);
+  }
+  if(bytesRead < 0){ return -1;}
+  return bytesRead;
  }
 
 /*
- * @brief	Writes a number of bytes from a buffer and into a file.
- * The seek pointer of the file is incremented as many bytes written from the file.
- *
- * In case the operation exceeds the number of data blocks initially reserved for the file,
- * new data blocks shall be reserved without violating the filesystem limits.
- *
- * F3 Metadata shall be updated after any write operation in order to properly reflect any modification in the file system.
- * F7 A file could be modified by means of write operations
- * F8 As part of a write operation, file capacity may be extended by means of additional data blocks.
- * NF3 The maximum size of the file will be 1 MiB.
+ * @brief	Reads a number of bytes from a file, starting from a given offset, and stores them in a buffer.
+ * Neither the seek pointer nor the inode of the file change.
  *
- * @param fileDescriptor: file descriptor of the file to write into.
- * @param buffer: data to be written.
- * @param numBytes: number of bytes to write to the file from the buffer.
+ * @param fileDescriptor: file descriptor of the file to be read.
+ * @param buffer: buffer that will store the read data after the execution of the function.
+ * @param numBytes: number of bytes to read from the file.
+ * @param offset: first byte to read; from the end of the file on, nothing is read.
  *
- * @return	Number of bytes properly written, -1 in case of error.
+ * @return	Number of bytes properly read, -1 in case of error.
  */
-int writeFile(int fileDescriptor, void *buffer, int numBytes)
+static int doReadFileAt(int fileDescriptor, void *buffer, int numBytes, long offset)
 {
-	int aux = fileDescriptor / (INODE_PER_BLOCK);
-	int position = fileDescriptor % (INODE_PER_BLOCK);
-	int needed_blocks = 0;
-	int block_free = 0;
-	index_file_t dummy;
-	char buffer_w[BLOCK_SIZE];
+	struct iovec one = { buffer, numBytes > 0 ? numBytes : 0 };
+	return doReadFileAtV(fileDescriptor, &one, 1, numBytes, offset);
+}
 
-	/* Errors... */
-	if(fileDescriptor < 0 || fileDescriptor > sb.numInodes || numBytes <= 0
-		 || sb.i_map[fileDescriptor] == 0){
-  	  return -1;
-  	}
+/*
+ * @brief	Reads a number of bytes from a file, starting from the seek pointer of the file, and stores them in a buffer.
+ * The seek pointer of the file is incremented as many bytes read from the file.
+ *
+ * F6 The whole contents of a file could be read by means of several read operations.
+ *
+ * @param fileDescriptor: file descriptor of the file to be read.
+ * @param buffer: buffer that will store the read data after the execution of the function.
+ * @param numBytes: number of bytes to read from the file.
+ *
+ * @return	Number of bytes properly read, -1 in case of error.
+ */
+static int doReadFile(int fileDescriptor, void *buffer, int numBytes)
+{
+	open_file_t *file = fileAt(fileDescriptor);
+	if(file == NULL){
+		return -1;
+	}
+	int bytesRead = doReadFileAt(fileDescriptor, buffer, numBytes, file->ptr);
+	if(bytesRead > 0){
+		file->ptr += bytesRead; /* Update pointer */
+	}
+	return bytesRead;
+}
+
+/*
+ * @brief	Writes a number of bytes from the buffers of an iovec array, in order, into a file,
+ * starting at a given offset. The seek pointer does not change, and the inode only when the
+ * file grows or keeps its contents in the inode: an overwrite of the blocks of the file writes
+ * its data blocks and no metadata. The whole blocks that lie in one buffer are written from it;
+ * a partial block, or one that spans two buffers, is put together in a bounce block first.
+ *
+ * @param fileDescriptor: file descriptor of the file to write into.
+ * @param iov, iovcnt: data to be written.
+ * @param numBytes: number of bytes to write to the file, the bytes of the buffers.
+ * @param offset: first byte to write, up to the size of the file: a write leaves no hole.
+ *
+ * @return	Number of bytes properly written, -1 in case of error.
+ */
+static int doWriteFileAtV(int fileDescriptor, const struct iovec *iov, int iovcnt, int numBytes, long offset)
+{
+	int localBlocks[2];
+	char *localBuffers[2];
+	char localBounces[2 * BLOCK_SIZE];
+
+	/* Errors... */
+	open_file_t *file = fileAt(fileDescriptor);
+	if(file == NULL || numBytes <= 0){
+  	  return -1;
+  	}
+	int inode_id = file->inode;
+	inode_t *inode = inodeAt(inode_id);
+
+	/* The write covers [pointer, end) and the file grows up to end at least */
+	long pointer = offset;
+	long end = pointer + numBytes;
+	long size = fileSize(inode_id) > end ? fileSize(inode_id) : end;
+
+	/* NF3, and no hole before the write */
+	if(pointer < 0 || pointer > fileSize(inode_id) || end > (long) sb.maxFileSize) return -1;
+
+	/* the close of the descriptor makes the write durable */
+	file->flags |= FILE_WRITTEN;
+
+	/* A small file keeps its contents in the inode, which the journal logs with them:
+	   no data block and no extent until it grows past INODE_INLINE_SIZE */
+	if(size <= INODE_INLINE_SIZE){
+		iovCopy(iov, iovcnt, 0, inode->data + pointer, numBytes, 0);
+		inode->size = size;
+		dirtyInode(inode_id);
+		syncFS();
+		return numBytes;
+	}
+
+	/* Blocks mapped by the extents of the file */
+	int inlined = fileState[inode_id].delayed == NULL && inode->size <= INODE_INLINE_SIZE ? inode->size : 0;
+	int mapped = inlined > 0 ? 0 : extentBlocks(inode_id);
+	if(mapped < 0){
+		return -1;
+	}
+	/* the bytes before split fall on blocks with a device block and are overwritten in
+	   place; the ones after it go to the delayed blocks, which take device blocks later */
+	long split = (long) mapped * BLOCK_SIZE;
+	if(split < pointer) split = pointer;
+	if(split > end) split = end;
+
+	int ret = 0;
+	if(pointer < split){
+		int first = pointer / BLOCK_SIZE;
+		int last = (split - 1) / BLOCK_SIZE;
+		int n = last - first + 1;
+		int *blockNumbers = n <= 2 ? localBlocks : malloc(sizeof(int) * n);
+		char **buffers = n <= 2 ? localBuffers : malloc(sizeof(char *) * n);
+		char *bounces = localBounces;
+		if(blockNumbers == NULL || buffers == NULL || fileLookup(fileDescriptor, first, n, blockNumbers) < 0){
+			ret = -1;
+		}
+		/* whole blocks are written from the buffer they lie in; the others need a bounce
+		   block, at most one per buffer boundary besides a partial head and tail */
+		int bounced = 0;
+		for(int b = first; ret == 0 && b <= last; b++){
+			int from = b == first ? pointer % BLOCK_SIZE : 0;
+			int to = b == last ? (split - 1) % BLOCK_SIZE + 1 : BLOCK_SIZE;
+			buffers[b - first] = from == 0 && to == BLOCK_SIZE ? iovSpan(iov, iovcnt, (long) b * BLOCK_SIZE - pointer, BLOCK_SIZE) : NULL;
+			bounced += buffers[b - first] == NULL;
+		}
+		if(ret == 0 && bounced > 2){
+			bounces = malloc((long) bounced * BLOCK_SIZE);
+			ret = bounces == NULL ? -1 : 0;
+		}
+		/* a partial head or tail block keeps the bytes of the file around the write, read back from the device */
+		bounced = 0;
+		for(int b = first; ret == 0 && b <= last; b++){
+			int from = b == first ? pointer % BLOCK_SIZE : 0;
+			int to = b == last ? (split - 1) % BLOCK_SIZE + 1 : BLOCK_SIZE;
+			if(buffers[b - first] != NULL){
+				continue;
+			}
+			char *bounce = bounces + (long) bounced++ * BLOCK_SIZE;
+			if(from > 0 || (to < BLOCK_SIZE && (long) b * BLOCK_SIZE + to < fileSize(inode_id))){
+				ret = bread(deviceImage, blockNumbers[b - first], bounce);
+			}
+			else if(to < BLOCK_SIZE){
+				memset(bounce, 0, BLOCK_SIZE);
+			}
+			iovCopy(iov, iovcnt, (long) b * BLOCK_SIZE + from - pointer, bounce + from, to - from, 0);
+			buffers[b - first] = bounce;
+		}
+		/* all the data blocks with as few device calls as possible */
+		if(ret == 0){
+			ret = bwritev(deviceImage, blockNumbers, buffers, n);
+		}
+		if(blockNumbers != localBlocks) free(blockNumbers);
+		if(buffers != localBuffers) free(buffers);
+		if(bounces != localBounces && bounces != NULL) free(bounces);
+	}
+	if(ret == 0 && split < end){
+		/* a small file copies its contents to its first delayed block, the inode keeps them until delayFlush */
+		if(inlined > 0){
+			struct iovec data = { inode->data, inlined };
+			ret = delayWrite(inode_id, 0, 0, &data, 1, 0, inlined);
+		}
+		if(ret == 0){
+			ret = delayWrite(inode_id, mapped, split, iov, iovcnt, split - pointer, end - split);
+		}
+		if(ret < 0 && inlined > 0){
+			delayDrop(inode_id);
+		}
+	}
+	if(ret < 0) return -1;
+  	/* Update the size of the file: the inode counts the bytes on device blocks
+	   only, the delayed ones count from delayFlush. An overwrite changes no metadata */
+	if(split > (long) inode->size && split <= (long) mapped * BLOCK_SIZE){
+		inode->size = split;
+		dirtyInode(inode_id);
+		syncFS();
+	}
+	return numBytes;
+}
+
+/*
+ * @brief	Writes a number of bytes from a buffer into a file, starting at a given offset.
+ * The seek pointer does not change, and the inode only when the file grows or
+ * keeps its contents in the inode: an overwrite of the blocks of the file writes
+ * its data blocks and no metadata.
+ *
+ * @param fileDescriptor: file descriptor of the file to write into.
+ * @param buffer: data to be written.
+ * @param numBytes: number of bytes to write to the file from the buffer.
+ * @param offset: first byte to write, up to the size of the file: a write leaves no hole.
+ *
+ * @return	Number of bytes properly written, -1 in case of error.
+ */
+static int doWriteFileAt(int fileDescriptor, void *buffer, int numBytes, long offset)
+{
+	struct iovec one = { buffer, numBytes > 0 ? numBytes : 0 };
+	return doWriteFileAtV(fileDescriptor, &one, 1, numBytes, offset);
+}
+
+/*
+ * @brief	Writes a number of bytes from a buffer and into a file, starting at its seek pointer.
+ * The seek pointer of the file is incremented as many bytes written from the file.
+ * The blocks the file already has are overwritten in place; only the blocks past its end are allocated.
+ *
+ * In case the operation exceeds the number of data blocks initially reserved for the file,
+ * new data blocks shall be reserved without violating the filesystem limits.
+ *
+ * F3 Metadata shall be updated after any write operation in order to properly reflect any modification in the file system.
+ * F7 A file could be modified by means of write operations
+ * F8 As part of a write operation, file capacity may be extended by means of additional data blocks.
+ * A file of up to INODE_INLINE_SIZE bytes is stored in its inode and moves to data blocks when it grows.
+ * NF3 The maximum size of the file is sb.maxFileSize, set by mkFS.
+ *
+ * @param fileDescriptor: file descriptor of the file to write into.
+ * @param buffer: data to be written.
+ * @param numBytes: number of bytes to write to the file from the buffer.
+ *
+ * @return	Number of bytes properly written, -1 in case of error.
+ */
+static int doWriteFile(int fileDescriptor, void *buffer, int numBytes)
+{
+	open_file_t *file = fileAt(fileDescriptor);
+	if(file == NULL){
+		return -1;
+	}
+	int bytesWritten = doWriteFileAt(fileDescriptor, buffer, numBytes, file->ptr);
+	if(bytesWritten > 0){
+		file->ptr += bytesWritten;
+	}
+	return bytesWritten;
+}
+
+/*
+ * @brief	Adds up the bytes of the buffers of an iovec array.
+ *
+ * @return	The bytes, -1 if they are none, more than the largest file or more than a call moves.
+ */
+static long iovLength(const struct iovec *iov, int iovcnt)
+{
+	long total = 0;
+	if(iov == NULL || iovcnt <= 0){
+		return -1;
+	}
+	for(int i = 0; i < iovcnt; i++){
+		total += iov[i].iov_len;
+		/* numBytes of doReadFileAtV and doWriteFileAtV is an int */
+		if(iov[i].iov_len > sb.maxFileSize || total > (long) sb.maxFileSize || total != (int) total){
+			return -1;
+		}
+	}
+	return total > 0 ? total : -1;
+}
+
+/*
+ * @brief	Reads from the seek pointer of a file into several buffers, filled in order.
+ * The blocks under all the buffers are read by a single doReadFileAtV, so they are mapped
+ * once and read with as few device calls as one read, straight into the buffers but for
+ * the blocks that span two of them; the seek pointer moves once, by the bytes read.
+ *
+ * @param fileDescriptor: file descriptor of the file to be read.
+ * @param iov, iovcnt: the buffers.
+ *
+ * @return	Number of bytes properly read, -1 in case of error.
+ */
+static int doReadFileV(int fileDescriptor, const struct iovec *iov, int iovcnt)
+{
+	long total = iovLength(iov, iovcnt);
+	open_file_t *file = fileAt(fileDescriptor);
+	if(total < 0 || file == NULL){
+		return -1;
+	}
+	int bytesRead = doReadFileAtV(fileDescriptor, iov, iovcnt, total, file->ptr);
+	if(bytesRead > 0){
+		file->ptr += bytesRead;
+	}
+	return bytesRead;
+}
+
+/*
+ * @brief	Writes several buffers, in order, from the seek pointer of a file.
+ * They are written by a single doWriteFileAtV: the blocks of the file are mapped once,
+ * every block is written once, from the buffers but for the blocks that span two of them,
+ * with as few device calls as one write, and the metadata, if any, is synced once.
+ *
+ * @param fileDescriptor: file descriptor of the file to write into.
+ * @param iov, iovcnt: the buffers.
+ *
+ * @return	Number of bytes properly written, -1 in case of error.
+ */
+static int doWriteFileV(int fileDescriptor, const struct iovec *iov, int iovcnt)
+{
+	long total = iovLength(iov, iovcnt);
+	open_file_t *file = fileAt(fileDescriptor);
+	if(total < 0 || file == NULL){
+		return -1;
+	}
+	int bytesWritten = doWriteFileAtV(fileDescriptor, iov, iovcnt, total, file->ptr);
+	if(bytesWritten > 0){
+		file->ptr += bytesWritten;
+	}
+	return bytesWritten;
+}
+
+/*
+ * @brief	Modifies the position of the seek pointer of a file according to a given reference and offset.
+ *
+ * @param fileDescriptor: file descriptor.
+ * @param whence: Constant value acting as reference for the seek operation. This could be: FS SEEK CUR, FS SEEK BEGIN or FSSEEKEND.
+ * @param offset: Number of bytes to displace the seek pointer from the FS SEEK CUR position.
+ * This value can be either positive or negative, although it will never allow positioning the seek pointer outside the limits of the file.
+ * If whence is set to FS SEEK BEGIN or FS SEEK END, the file pointer must be set to this position, regardless of the offset value.
+ *
+ * @return	0 if success, -1 otherwise.
+ */
+static int doLseekFile(int fileDescriptor, long offset, int whence)
+{
+	/* If the file descriptor is not open we cannot move its pointer */
+	open_file_t *file = fileAt(fileDescriptor);
+	if(file == NULL){
+		return -1;
+	}
+
+	/* If the offset is larger than the file size */
+	long size = fileSize(file->inode);
+	if(labs(offset) > size){
+		return -1;
+	}
+
+	/* Modify the position from the current one */
+	if(whence == FS_SEEK_CUR){
+		if((file->ptr + offset) > size){
+			return -1;
+		}
+		if((file->ptr + offset) < 0){
+			return -1;
+		}
+		file->ptr += offset;
+	}
+	/* Modify the position from the beginning of the file */
+	else if(whence == FS_SEEK_BEGIN){
+		file->ptr = 0;
+	}
+	/* Modify the position from the end of the file */
+	else if(whence == FS_SEEK_END){
+		file->ptr = size;
+	}
+	else{
+		/* The whence has a wrong value */
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * @brief	Gets the entry of a directory that follows a name in alphabetical order. The
+ * entries of a directory are listed by calling it with "" first and then with the
+ * name returned by the previous call, so the listing goes on from where it was
+ * whatever the entries created or removed in between.
+ *
+ * @param dirName: path of the directory, "" or "/" for the root directory.
+ * @param name: the previous entry, "" for the first one; NAME_MAX + 1 characters
+ * that hold the next entry after the call.
+ *
+ * @return	1 if name holds the next entry, 0 if there are no more, -1 in case of error.
+ */
+static int doReadDir(char *dirName, char *name)
+{
+	char last[NAME_MAX + 1], next[NAME_MAX + 1];
+	int dir;
+
+	if(strlen(name) > NAME_MAX || pathLookup(dirName, &dir) < 0){
+		return -1;
+	}
+	if(dir != DIR_ROOT && inodeAt(dir)->type != INODE_DIR){
+		return -1;
+	}
+	memset(last, 0, sizeof(last));
+	memcpy(last, name, strlen(name));
+	int ret = dirNext(dir, last, next);
+	if(ret == 1){
+		memcpy(name, next, NAME_MAX);
+		name[NAME_MAX] = '\0';
+	}
+	return ret;
+}
+
+/*
+ * Tells whether a read may read a file under a shared lock: the root of its extent tree, when
+ * it is a node, is kept in memory, so the read changes no more than the readahead window and the
+ * last extent of the descriptor, and its seek pointer under seekEnter.
+ */
+static inline int readShared(int fileDescriptor)
+{
+#ifdef FS_THREADS
+	int inode_id = fileInode(fileDescriptor);
+	if(inode_id < 0){
+		return 1;
+	}
+	return inodeAt(inode_id)->depth == 0 || fileState[inode_id].extentCache != NULL;
+#else
+	return 1;
+#endif
+}
+
+/*
+ * Locks the inode of a descriptor for a read, as fileEnter: the readers of a file share its lock,
+ * and the first read that needs the root of its extent tree reads it on its own.
+ */
+static inline int readEnter(int fileDescriptor)
+{
+	int inode_id = fileEnter(fileDescriptor, 0);
+	if(!readShared(fileDescriptor)){
+		inodeLeave(inode_id);
+		inode_id = fileEnter(fileDescriptor, 1);
+	}
+	return inode_id;
+}
+
+/*
+ * Entry points of filesystem.h: each one is timed and its block I/O counted for fsGetStats.
+ * With FS_THREADS they take the locks of fsEnter, nameEnter and inodeEnter around the call,
+ * or of fileEnter for the calls on a descriptor, and seekEnter too for the ones that move its
+ * seek pointer under a shared lock.
+ */
+
+int mkFS(long deviceSize)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(1);
+	int ret = doMkFS(deviceSize);
+	fsLeave();
+	probeEnd(&probe, FS_OP_MKFS, 0);
+	return ret;
+}
+
+int mountFSBackend(int backend)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(1);
+	int ret = doMountFSBackend(backend);
+	fsLeave();
+	probeEnd(&probe, FS_OP_MOUNT, 0);
+	return ret;
+}
+
+int unmountFS(void)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(1);
+	int ret = doUnmountFS();
+	fsLeave();
+	probeEnd(&probe, FS_OP_UNMOUNT, 0);
+	return ret;
+}
+
+int createFile(char *fileName)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	nameEnter(1);
+	int ret = doCreateInode(fileName, INODE_FILE);
+	nameLeave();
+	fsLeave();
+	probeEnd(&probe, FS_OP_CREATE, 0);
+	return ret;
+}
+
+int removeFile(char *fileName)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	nameEnter(1);
+	int ret = doRemoveInode(fileName, INODE_FILE);
+	nameLeave();
+	fsLeave();
+	probeEnd(&probe, FS_OP_REMOVE, 0);
+	return ret;
+}
+
+int openFile(char *fileName)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	nameEnter(0);
+	int ret = doOpenFile(fileName);
+	nameLeave();
+	fsLeave();
+	probeEnd(&probe, FS_OP_OPEN, 0);
+	return ret;
+}
+
+int closeFile(int fileDescriptor)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	int inode_id = fileEnter(fileDescriptor, 1);
+	int ret = doCloseFile(fileDescriptor);
+	inodeLeave(inode_id);
+	if(fsLeave() < 0){
+		ret = -1;
+	}
+	probeEnd(&probe, FS_OP_CLOSE, 0);
+	return ret;
+}
+
+int readFile(int fileDescriptor, void *buffer, int numBytes)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	seekEnter(fileDescriptor);
+	int inode_id = readEnter(fileDescriptor);
+	int ret = doReadFile(fileDescriptor, buffer, numBytes);
+	inodeLeave(inode_id);
+	seekLeave(fileDescriptor);
+	fsLeave();
+	probeEnd(&probe, FS_OP_READ, ret > 0 ? ret : 0);
+	return ret;
+}
+
+int writeFile(int fileDescriptor, void *buffer, int numBytes)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	int inode_id = fileEnter(fileDescriptor, 1);
+	int ret = doWriteFile(fileDescriptor, buffer, numBytes);
+	inodeLeave(inode_id);
+	fsLeave();
+	probeEnd(&probe, FS_OP_WRITE, ret > 0 ? ret : 0);
+	return ret;
+}
+
+int readFileAt(int fileDescriptor, void *buffer, int numBytes, long offset)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	int inode_id = readEnter(fileDescriptor);
+	int ret = doReadFileAt(fileDescriptor, buffer, numBytes, offset);
+	inodeLeave(inode_id);
+	fsLeave();
+	probeEnd(&probe, FS_OP_READ, ret > 0 ? ret : 0);
+	return ret;
+}
+
+int writeFileAt(int fileDescriptor, void *buffer, int numBytes, long offset)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	int inode_id = fileEnter(fileDescriptor, 1);
+	int ret = doWriteFileAt(fileDescriptor, buffer, numBytes, offset);
+	inodeLeave(inode_id);
+	fsLeave();
+	probeEnd(&probe, FS_OP_WRITE, ret > 0 ? ret : 0);
+	return ret;
+}
+
+int readFileV(int fileDescriptor, const struct iovec *iov, int iovcnt)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	seekEnter(fileDescriptor);
+	int inode_id = readEnter(fileDescriptor);
+	int ret = doReadFileV(fileDescriptor, iov, iovcnt);
+	inodeLeave(inode_id);
+	seekLeave(fileDescriptor);
+	fsLeave();
+	probeEnd(&probe, FS_OP_READ, ret > 0 ? ret : 0);
+	return ret;
+}
+
+int writeFileV(int fileDescriptor, const struct iovec *iov, int iovcnt)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	int inode_id = fileEnter(fileDescriptor, 1);
+	int ret = doWriteFileV(fileDescriptor, iov, iovcnt);
+	inodeLeave(inode_id);
+	fsLeave();
+	probeEnd(&probe, FS_OP_WRITE, ret > 0 ? ret : 0);
+	return ret;
+}
+
+int lseekFile(int fileDescriptor, long offset, int whence)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	seekEnter(fileDescriptor);
+	int inode_id = fileEnter(fileDescriptor, 0);
+	int ret = doLseekFile(fileDescriptor, offset, whence);
+	inodeLeave(inode_id);
+	seekLeave(fileDescriptor);
+	fsLeave();
+	probeEnd(&probe, FS_OP_LSEEK, 0);
+	return ret;
+}
+
+int makeDir(char *dirName)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	nameEnter(1);
+	int ret = doCreateInode(dirName, INODE_DIR);
+	nameLeave();
+	fsLeave();
+	probeEnd(&probe, FS_OP_MKDIR, 0);
+	return ret;
+}
+
+int removeDir(char *dirName)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	nameEnter(1);
+	int ret = doRemoveInode(dirName, INODE_DIR);
+	nameLeave();
+	fsLeave();
+	probeEnd(&probe, FS_OP_RMDIR, 0);
+	return ret;
+}
+
+int readDir(char *dirName, char *name)
+{
+	fs_probe_t probe;
+	probeBegin(&probe);
+	fsEnter(0);
+	nameEnter(0);
+	int ret = doReadDir(dirName, name);
+	nameLeave();
+	fsLeave();
+	probeEnd(&probe, FS_OP_READDIR, 0);
+	return ret;
+}
+
+/*
+ * @brief 	Copies the counters of every entry point into stats.
+ * @return 	0 if success, -1 if the file system was built without FS_STATS (stats is zeroed).
+ */
+int fsGetStats(struct fs_stats *stats)
+{
+#ifdef FS_STATS
+#ifdef FS_THREADS
+	pthread_mutex_lock(&statsLock);
+#endif
+	*stats = fsStats;
+#ifdef FS_THREADS
+	pthread_mutex_unlock(&statsLock);
+#endif
+	return 0;
+#else
+	memset(stats, 0, sizeof(fs_stats_t));
+	return -1;
+#endif
+}
+
+/*
+ * @brief 	Sets all the counters of fsGetStats to zero.
+ */
+void fsResetStats(void)
+{
+#ifdef FS_STATS
+#ifdef FS_THREADS
+	pthread_mutex_lock(&statsLock);
+#endif
+	memset(&fsStats, 0, sizeof(fs_stats_t));
+#ifdef FS_THREADS
+	pthread_mutex_unlock(&statsLock);
+#endif
+#endif
+}
+
+/*
+ * @brief 	Verifies the integrity of the file system metadata.
+ * @return 	0 if the file system is correct, -1 if the file system is corrupted, -2 in case of error.
+ */
+int checkFS(void)
+{
+	return -2;
+}
+
+/*
+ * @brief 	Verifies the integrity of a file.
+ * @return 	0 if the file is correct, -1 if the file is corrupted, -2 in case of error.
+ */
+int checkFile(char *fileName)
+{
+	return -2;
+}
+
+/**
+ * Writes the default File System into the disk
+ * @return -1 in error and 0 otherwise
+ */
+int umount (void){
+	/* check that all the files are closed  */
+	if(freeInodes != (int) sb.numInodes){
+		return -1; /* inode in used  */
+	}
+
+	/* an empty journal: no transaction of a previous format can be replayed */
+	char zero[BLOCK_SIZE];
+	memset(zero, 0, BLOCK_SIZE);
+	for(int i = 0; i < (int) sb.journalBlocks; i++){
+		if(bwrite(deviceImage, sb.journalStart + i, zero) < 0){
+			return -1;
+		}
+	}
+	/* flush metadata on disk */
+	if( journalCheckpoint() < 0){ /* check errors in sync */
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Ends a metadata operation. Its changes join the running transaction of
+ * the journal, which is committed every JOURNAL_BATCH operations.
+ *
+ * @return -1 in error and 0 otherwise
+ */
+int syncFS (void){
+	metaEnter();
+	int batch = ++journalOps >= JOURNAL_BATCH;
+	metaLeave();
+	if(!batch){
+		return 0;
+	}
+	return journalDue();
+}
+
+/**
+ * Commits the running transaction. With FS_THREADS the operations of the other
+ * calls in progress are part of it: it runs once they end, before the call
+ * that asked for it returns, from fsLeave.
+ *
+ * @return -1 in error and 0 otherwise
+ */
+static int journalDue(void){
+#ifdef FS_THREADS
+	__atomic_store_n(&commitDue, 1, __ATOMIC_RELEASE);
+	commitWanted = 1;
+	return 0;
+#else
+	return journalCommit();
+#endif
+}
+
+/**
+ * Checksum of a transaction: the CRC32 of the CRC32 of every block logged
+ * and of their homes. CRC32 does not chain its prev_crc argument.
+ *
+ * @param buffers, home, count : the blocks logged and their homes
+ * @return the checksum
+ */
+static unsigned int journalChecksum(char **buffers, unsigned long long *home, int count){
+	uint32_t crcs[count + 1];
+	for(int i = 0; i < count; i++){
+		crcs[i] = CRC32((unsigned char *) buffers[i], BLOCK_SIZE, 0);
+	}
+	crcs[count] = CRC32((unsigned char *) home, sizeof(unsigned long long) * count, 0);
+	return CRC32((unsigned char *) crcs, sizeof(uint32_t) * (count + 1), 0);
+}
+
+/**
+ * Orders block numbers for qsort
+ */
+static int blockCompare(const void *a, const void *b){
+	return (*(const int *) a > *(const int *) b) - (*(const int *) a < *(const int *) b);
+}
+
+/**
+ * Appends the metadata blocks changed by the running transaction to the
+ * journal: the dirty data blocks are flushed first, then the blocks logged,
+ * in one sequential write, and last the descriptor that commits them, with
+ * a flush after each step, so that a crash never leaves a committed
+ * transaction without its blocks or its data. The blocks are written home
+ * later, by journalCheckpoint. A full journal is checkpointed instead.
+ *
+ * @return -1 in error and 0 otherwise
+ */
+int journalCommit(void){
+	journal_desc_t desc;
+	int count = 0;
+
+	journalOps = 0;
+#ifdef FS_THREADS
+	__atomic_store_n(&commitDue, 0, __ATOMIC_RELAXED);
+#endif
+	if(extentFlushAll() < 0){
+		return -1;
+	}
+	for(int i = 0; i < metaCount; i++){
+		count += (metaFlags[metaList[i]] & META_DIRTY) != 0;
+	}
+	for(int i = 0; i < dirBufferCount; i++){
+		count += (dirBuffers[i].flags & META_DIRTY) != 0;
+	}
+	if(count == 0){
+		return bflush();
+	}
+	if(count > JOURNAL_DESC_MAX || journalHead + 1 + count > (int) sb.journalBlocks){
+		return journalCheckpoint();
+	}
+	int *blocks = malloc(sizeof(int) * (1 + count));
+	char **buffers = malloc(sizeof(char *) * (1 + count));
+	if(blocks == NULL || buffers == NULL){
+		free(blocks);
+		free(buffers);
+		return -1;
+	}
+	/* in the order of their homes */
+	qsort(metaList, metaCount, sizeof(int), blockCompare);
+	memset(&desc, 0, sizeof(journal_desc_t));
+	sb.freeInodes = freeInodes;
+	sb.freeBlocks = freeBlocks;
+	count = 0;
+	for(int i = 0; i < metaCount; i++){
+		if(metaFlags[metaList[i]] & META_DIRTY){
+			desc.home[count] = metaList[i];
+			buffers[1 + count++] = metaBuffer(metaList[i]);
+		}
+	}
+	/* then the directory nodes, which live among the data blocks */
+	for(int i = 0; i < dirBufferCount; i++){
+		if(dirBuffers[i].flags & META_DIRTY){
+			desc.home[count] = dirBuffers[i].block;
+			buffers[1 + count++] = (char *) (&dirBuffers[i].node);
+		}
+	}
+	desc.magic = JOURNAL_MAGIC;
+	desc.seq = journalNextSeq;
+	desc.count = count;
+	desc.crc = journalChecksum(&buffers[1], desc.home, count);
+	buffers[0] = (char *) (&desc);
+	for(int i = 0; i <= count; i++){
+		blocks[i] = sb.journalStart + journalHead + i;
+	}
+	/* the data blocks are durable before the journal points to them, and the blocks logged
+	   before the descriptor that commits them: each step is flushed before the next one */
+	int ret = bflush() < 0 || bwritev(deviceImage, blocks + 1, buffers + 1, count) < 0 || bflush() < 0
+		|| bwrite(deviceImage, blocks[0], buffers[0]) < 0 || bflush() < 0 ? -1 : 0;
+	free(blocks);
+	free(buffers);
+	if(ret < 0){
+		return -1;
+	}
+	journalHead += 1 + count;
+	journalNextSeq++;
+	for(int i = 0; i < metaCount; i++){
+		metaFlags[metaList[i]] = META_LOGGED;
+	}
+	for(int i = 0; i < dirBufferCount; i++){
+		dirBuffers[i].flags = META_LOGGED;
+	}
+	return 0;
+}
+
+/**
+ * Writes home every metadata block changed since the last checkpoint and
+ * empties the journal. The inode, map and directory blocks go first: the
+ * superblock, which tells the transactions of the journal that are still
+ * valid, goes last. The directory nodes freed since the last checkpoint can
+ * be taken again from then on.
+ *
+ * @return -1 in error and 0 otherwise
+ */
+int journalCheckpoint(void){
+	journalOps = 0;
+#ifdef FS_THREADS
+	__atomic_store_n(&commitDue, 0, __ATOMIC_RELAXED);
+#endif
+	if(extentFlushAll() < 0 || syncIN() < 0 || bflush() < 0){
+		return -1;
+	}
+	/* from here on the transactions in the journal are old */
+	sb.journalSeq = journalNextSeq;
+	metaDirty(1);
+	if(syncSP() < 0 || bflush() < 0){
+		return -1;
+	}
+	journalHead = 0;
+	for(int i = 0; i < dirFreedCount; i++){
+		bfree(dirFreed[i] - sb.firstDataBlock);
+	}
+	dirFreedCount = 0;
+	return 0;
+}
+
+/**
+ * Tells whether a block holds metadata that the journal may log
+ */
+static int journalHome(unsigned long long block){
+	return block == 1 || (block >= sb.firstInode && block < sb.journalStart)
+		|| (block >= sb.imapStart && block < sb.firstDataBlock + sb.dataBlockNum);
+}
+
+/**
+ * Writes home the blocks of the transactions committed to the journal and
+ * not checkpointed, in order, up to the first one that is missing or torn.
+ * It must be called after reading the superblock and before the inodes;
+ * the superblock is read again if a transaction logged it.
+ *
+ * @return -1 in case of error and the number of transactions replayed otherwise
+ */
+int journalReplay(void){
+	journal_desc_t desc;
+	int head = 0, replayed = 0;
+	unsigned int seq = sb.journalSeq;
+
+	while(head + 1 < (int) sb.journalBlocks){
+		if(bread(deviceImage, sb.journalStart + head, (char *) (&desc)) < 0){
+			return -1;
+		}
+		if(desc.magic != JOURNAL_MAGIC || desc.seq != seq || desc.count == 0
+		   || desc.count > JOURNAL_DESC_MAX || head + 1 + (int) desc.count > (int) sb.journalBlocks){
+			break;
+		}
+		int count = desc.count;
+		char *logged = malloc((size_t) BLOCK_SIZE * count);
+		int blocks[count];
+		char *buffers[count];
+		if(logged == NULL){
+			return -1;
+		}
+		for(int i = 0; i < count; i++){
+			blocks[i] = sb.journalStart + head + 1 + i;
+			buffers[i] = logged + (size_t) BLOCK_SIZE * i;
+		}
+		if(breadv(deviceImage, blocks, buffers, count) < 0){
+			free(logged);
+			return -1;
+		}
+		int valid = 1;
+		for(int i = 0; i < count; i++){
+			/* only the superblock, the inode blocks, the maps and the directory nodes are logged */
+			if(!journalHome(desc.home[i])){
+				valid = 0;
+			}
+		}
+		if(!valid || journalChecksum(buffers, desc.home, count) != desc.crc){
+			free(logged);
+			break;
+		}
+		for(int i = 0; i < count; i++){
+			blocks[i] = desc.home[i];
+		}
+		int ret = bwritev(deviceImage, blocks, buffers, count);
+		free(logged);
+		if(ret < 0){
+			return -1;
+		}
+		head += 1 + count;
+		seq++;
+		replayed++;
+	}
+	if(replayed > 0){
+		/* the superblock may have been replayed: read it again and mark the journal as applied */
+		if(bflush() < 0 || bread(deviceImage, 1, (char *) (&sb)) < 0){
+			return -1;
+		}
+		sb.journalSeq = seq;
+		if(bwrite(deviceImage, 1, (char *) (&sb)) < 0 || bflush() < 0){
+			return -1;
+		}
+	}
+	journalNextSeq = seq;
+	journalHead = 0;
+	journalOps = 0;
+	return replayed;
+}
+
+/**
+ * Writes the superblock into the disk
+ *
+ * @return -1 in error and 0 otherwise
+ */
+int syncSP(){
+	/* nothing changed since the last write */
+	if(metaFlags != NULL && metaFlags[1] == 0){
+		return 0;
+	}
+	sb.freeInodes = freeInodes;
+	sb.freeBlocks = freeBlocks;
+	/* write the superblock into the first block of the disk */
+	if( bwrite(deviceImage, 1, (char *) (&sb)) < 0){
+		return -1;
+	}
+	/* the superblock is the last entry with a flag once syncIN has run */
+	if(metaFlags != NULL){
+		metaFlags[1] = 0;
+		for(int i = 0; i < metaCount; i++){
+			if(metaList[i] == 1){
+				metaList[i] = metaList[--metaCount];
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Releases the memory of the inode list, the maps, the flags of the metadata blocks
+ * and the directory nodes not written home
+ */
+void freeIN(){
+	free(inodeList);
+	inodeList = NULL;
+	free(inodeLoaded);
+	inodeLoaded = NULL;
+	free(inodeMap);
+	inodeMap = NULL;
+	free(blockMap);
+	blockMap = NULL;
+	free(metaFlags);
+	metaFlags = NULL;
+	free(metaList);
+	metaList = NULL;
+	metaCount = 0;
+	for(int i = 0; i < fileCachedCount; i++){
+		free(fileState[fileCached[i]].extentCache);
+		free(fileState[fileCached[i]].delayed);
+	}
+	free(fileCached);
+	fileCached = NULL;
+	fileCachedCount = fileCachedSize = 0;
+	delayedTotal = 0;
+	free(fileState);
+	fileState = NULL;
+	free(fileTable);
+	fileTable = NULL;
+	fileCursor = 0;
+	free(dirBuffers);
+	dirBuffers = NULL;
+	dirBufferCount = dirBufferSize = 0;
+	free(dirFreed);
+	dirFreed = NULL;
+	dirFreedCount = dirFreedSize = 0;
+}
+
+/**
+ * Allocates the inode list, the maps, the flags of the metadata blocks, the
+ * state of the open files and the open file table for the layout of sb, all
+ * of them empty. The inode list is never the one in the memory of the device:
+ * the inode blocks go home at the checkpoint, after the journal logs them.
+ *
+ * @return -1 in error and 0 otherwise
+ */
+static int metaAlloc(void){
+	freeIN();
+	/* the pages of the blocks never used are never touched */
+	inodeList = calloc(sb.inodesBlocks + 1, sizeof(inode_block_t));
+	inodeMap = calloc(sb.imapBlocks + 1, BLOCK_SIZE);
+	blockMap = calloc(sb.bmapBlocks + 1, BLOCK_SIZE);
+	metaFlags = calloc(sb.firstDataBlock + 1, 1);
+	metaList = malloc(sizeof(int) * (sb.firstDataBlock + 1));
+	fileState = calloc(sb.numInodes + 1, sizeof(file_state_t));
+	fileTable = malloc(sizeof(open_file_t) * FILE_TABLE_SIZE);
+	if(inodeList == NULL || inodeMap == NULL || blockMap == NULL || metaFlags == NULL
+	   || metaList == NULL || fileState == NULL || fileTable == NULL){
+		freeIN();
+		return -1;
+	}
+	for(int i = 0; i < FILE_TABLE_SIZE; i++){
+		fileTable[i].inode = -1;
+	}
+	return 0;
+}
+
+/**
+ * Marks a metadata block to be logged by the next commit
+ *
+ * @param block : the block in the device
+ */
+static void metaDirty(int block){
+	if(metaFlags == NULL){
+		return;
+	}
+	metaEnter();
+	if(metaFlags[block] == 0){
+		metaList[metaCount++] = block;
+	}
+	metaFlags[block] |= META_DIRTY;
+	metaLeave();
+}
+
+/**
+ * Marks the superblock, all the inode blocks and all the map blocks
+ */
+static void metaDirtyAll(void){
+	metaDirty(1);
+	for(int i = 0; i < (int) sb.inodesBlocks; i++){
+		metaDirty(sb.firstInode + i);
+	}
+	for(int i = sb.imapStart; i < (int) sb.firstDataBlock; i++){
+		metaDirty(i);
+	}
+}
+
+/**
+ * Returns the memory holding a metadata block, or NULL if it is not one
+ */
+static char *metaBuffer(int block){
+	if(block == 1){
+		return (char *) (&sb);
+	}
+	if(block >= (int) sb.firstInode && block < (int) sb.journalStart){
+		return (char *) (&inodeList[block - sb.firstInode]);
+	}
+	if(block >= (int) sb.imapStart && block < (int) sb.bmapStart){
+		return inodeMap + (long) BLOCK_SIZE * (block - sb.imapStart);
+	}
+	if(block >= (int) sb.bmapStart && block < (int) sb.firstDataBlock){
+		return blockMap + (long) BLOCK_SIZE * (block - sb.bmapStart);
+	}
+	return NULL;
+}
+
+/**
+ * Marks the block of an inode to be written by the next syncIN
+ *
+ * @param inode_id : the position of the inode
+ */
+void dirtyInode(int inode_id){
+	metaDirty(sb.firstInode + inode_id / INODE_PER_BLOCK);
+}
+
+/**
+ * Writes the inode, map and directory blocks changed since the last sync into the disk
+ *
+ * @return -1 in error and 0 otherwise
+ */
+int syncIN(){
+	int *blocks = malloc(sizeof(int) * (metaCount + dirBufferCount + 1));
+	char **buffers = malloc(sizeof(char *) * (metaCount + dirBufferCount + 1));
+	int count = 0, sbLeft = 0;
+	if(blocks == NULL || buffers == NULL){
+		free(blocks);
+		free(buffers);
+		return -1;
+	}
+	/* all the dirty blocks in a single request, in the order of the device */
+	qsort(metaList, metaCount, sizeof(int), blockCompare);
+	for(int i = 0; i < metaCount; i++){
+		if(metaList[i] != 1){
+			blocks[count] = metaList[i];
+			buffers[count] = metaBuffer(metaList[i]);
+			count++;
+		}
+		else{
+			sbLeft = 1;
+		}
+	}
+	for(int i = 0; i < dirBufferCount; i++){
+		blocks[count] = dirBuffers[i].block;
+		buffers[count] = (char *) (&dirBuffers[i].node);
+		count++;
+	}
+	int ret = count == 0 ? 0 : bwritev(deviceImage, blocks, buffers, count);
+	free(blocks);
+	free(buffers);
+	if(ret < 0){
+		return -1;
+	}
+	/* only the superblock is left, first in the sorted list */
+	for(int i = sbLeft; i < metaCount; i++){
+		metaFlags[metaList[i]] = 0;
+	}
+	metaCount = sbLeft;
+	dirBufferCount = 0;
+	return 0;
+}
+
+/**
+ * Gives you the needed blocks to store the input bits or bytes
+ *
+ * @return -1 in case of error and the number of needed blocks otherwise
+ */
+int needed_blocks(int amount, char type){
+	int aux = 0;
+	if(type == 'b'){
+		aux = (amount/8)/SIZE_OF_BLOCK;
+		if(((amount/8)%SIZE_OF_BLOCK) != 0){
+			aux++;
+		}
+	}
+	else if(type == 'B'){
+		aux = amount/SIZE_OF_BLOCK;
+		if((amount%SIZE_OF_BLOCK) != 0){
+			aux++;
+		}
+	}
+	else{
+		return -1;
+	}
+	return aux;
+}
+
+/**
+ * Returns the number of bits of the block map in use: one per data block
+ */
+static int blockMapBits(void){
+	return (int) sb.dataBlockNum;
+}
+
+/**
+ * Loads the word w (bits 64*w to 64*w+63) of a bitmap of the given number of
+ * bits. Bits past the end read as used. Bit i of the map is bit i % 64 of its
+ * word on little-endian hosts.
+ */
+static uint64_t mapWord(char *map, int bits, int w){
+	uint64_t word = 0;
+	int bytes = (bits + 7) / 8 - w * 8;
+	memcpy(&word, map + (long) w * 8, bytes < 8 ? bytes : 8);
+	if(bits - w * 64 < 64){
+		word |= ~0ULL << (bits - w * 64);
+	}
+	return word;
+}
+
+/**
+ * Takes up to n free bits of a bitmap, a whole word at a time, starting at
+ * the cursor and wrapping around, and sets them as used
+ *
+ * @param map, bits : the bitmap and its number of bits
+ * @param home : first block of the map in the device, to mark the blocks changed
+ * @param cursor : bit where the search starts, left after the last bit taken
+ * @param n : number of bits wanted
+ * @param taken : positions of the bits taken, in search order
+ * @return the number of bits taken
+ */
+static int mapTake(char *map, int bits, int home, int *cursor, int n, int *taken){
+	int words = (bits + 63) / 64;
+	int got = 0;
+	if(bits <= 0){
+		return 0;
+	}
+	int w = *cursor / 64;
+	/* the bits before the cursor in its word are visited last, after wrapping */
+	uint64_t used = mapWord(map, bits, w) | ((1ULL << (*cursor % 64)) - 1);
+	for(int visited = 0; got < n && visited <= words; visited++){
+		uint64_t free = ~used;
+		while(free != 0 && got < n){
+			int bit = w * 64 + __builtin_ctzll(free);
+			free &= free - 1; /* next free bit of the word */
+			bitmap_setbit(map, bit, 1);
+			metaDirty(home + bit / MAP_BITS_PER_BLOCK);
+			taken[got++] = bit;
+			*cursor = (bit + 1) % bits;
+		}
+		w = (w + 1) % words;
+		used = mapWord(map, bits, w);
+	}
+	if(got > 0){
+		metaDirty(1); /* the free counts */
+	}
+	return got;
+}
+
+/**
+ * Counts the free inodes and blocks of the maps and rewinds the next-fit cursor.
+ * It must be called whenever the maps are reset; mountFS takes the counts
+ * of the superblock instead.
+ */
+void allocInit(void){
+	freeInodes = 0;
+	for(int w = 0; w < ((int) sb.numInodes + 63) / 64; w++){
+		freeInodes += __builtin_popcountll(~mapWord(inodeMap, sb.numInodes, w));
+	}
+	freeBlocks = 0;
+	for(int w = 0; w < (blockMapBits() + 63) / 64; w++){
+		freeBlocks += __builtin_popcountll(~mapWord(blockMap, blockMapBits(), w));
+	}
+	blockCursor = 0;
+	inodeCursor = 0;
+}
+
+/**
+ * Searches for a free position in the inode map. The lowest free inode number
+ * is taken, searching from the lowest one freed since the last allocation.
+ *
+ * @return 	the position of the free inode. In case of error -1 is returned
+ */
+int ialloc(void){
+	int i;
+	allocEnter();
+	if(freeInodes == 0 || mapTake(inodeMap, sb.numInodes, sb.imapStart, &inodeCursor, 1, &i) != 1){
+		allocLeave();
+		return -1;
+	}
+	freeInodes--;
+	allocLeave();
+	memset(inodeAt(i), 0, sizeof(inode_t) ); /* default values to the inode */
+	dirtyInode(i);
+	return i; /* return the position of the inode */
+}
+
+/**
+ * Searches for a free position in the block map, out of the blocks not promised
+ * to delayed writes. The block is not zeroed: it must be written whole before it is read.
+ *
+ * @return 	the position of the free block. In case of error -1 is returned
+ */
+int alloc(void){
+	int block;
+	if(allocN(1, &block) < 0){
+		return -1;
+	}
+	return block;
+}
+
+/**
+ * Allocates n blocks at once, in ascending order from the next-fit cursor, so
+ * that consecutive calls hand out contiguous runs while the map allows it.
+ * The blocks promised to delayed writes by delayedTotal are not taken.
+ * The blocks are not zeroed.
+ *
+ * @param n : number of blocks
+ * @param blocks : device block numbers of the blocks allocated
+ * @return -1 if there are not n free blocks, with nothing allocated, and 0 otherwise
+ */
+int allocN(int n, int *blocks){
+	return allocKept(n, blocks, NULL);
+}
+
+/**
+ * Allocates n blocks as allocN, taking first the ones of delayedTotal that a
+ * file keeps for its delayed blocks and the extent nodes they need
+ *
+ * @param n : number of blocks
+ * @param blocks : device block numbers of the blocks allocated
+ * @param kept : the blocks kept by the file, spent first; NULL for none
+ * @return -1 if there are not n blocks, with nothing allocated, and 0 otherwise
+ */
+static int allocKept(int n, int *blocks, int *kept){
+	allocEnter();
+	int own = kept == NULL ? 0 : (*kept < n ? *kept : n);
+	if(n <= 0 || n - own > freeBlocks - delayedTotal){
+		allocLeave();
+		return -1;
+	}
+	int got = mapTake(blockMap, blockMapBits(), sb.bmapStart, &blockCursor, n, blocks);
+	if(got < n){
+		/* the free count was wrong: give the blocks back and count again */
+		for(int i = 0; i < got; i++){
+			bitmap_setbit(blockMap, blocks[i], 0);
+		}
+		allocInit();
+		allocLeave();
+		return -1;
+	}
+	freeBlocks -= n;
+	delayedTotal -= own;
+	if(kept != NULL){
+		*kept -= own;
+	}
+	allocLeave();
+	for(int i = 0; i < n; i++){
+		blocks[i] += sb.firstDataBlock;
+	}
+	return 0;
+}
+
+/**
+ * Gets the free blocks that no delayed write was promised
+ *
+ * @return the number of blocks
+ */
+static int allocAvailable(void){
+	allocEnter();
+	int available = freeBlocks - delayedTotal;
+	allocLeave();
+	return available;
+}
+
+/**
+ * Tells whether an inode is in use: its bit of the inode map is set
+ *
+ * @param inode_id : the position of the inode
+ * @return 1 if it is in use and 0 otherwise
+ */
+static int inodeUsed(int inode_id){
+	allocEnter();
+	int used = bitmap_getbit(inodeMap, inode_id) != 0;
+	allocLeave();
+	return used;
+}
+
+/**
+ * Free a position of an inode
+ *
+ * @param inode_id : the position of the inode to be deleted
+ * @return -1 in case of error an 0 otherwise
+ */
+int ifree (int inode_id){
+	/* check the validity of the position of the inode */
+	if(inode_id < 0 || inode_id >= (int) sb.numInodes) { return -1;}
+	/* free inode */
+	allocEnter();
+	if(bitmap_getbit(inodeMap, inode_id) != 0){
+		bitmap_setbit(inodeMap, inode_id, 0);
+		metaDirty(sb.imapStart + inode_id / MAP_BITS_PER_BLOCK);
+		metaDirty(1);
+		freeInodes++;
+		if(inode_id < inodeCursor){
+			inodeCursor = inode_id;
+		}
+	}
+	allocLeave();
+	return 0;
+}
+
+/**
+ * Free a position of a block
+ *
+ * @param block_id : the position of the block to be deleted
+ * @return -1 in case of error an 0 otherwise
+ */
+int bfree (int block_id){
+	/* check the validity of the position of the block */
+	if(block_id < 0 || block_id >= blockMapBits()) { return -1;}
+	/* free block */
+	allocEnter();
+	if(bitmap_getbit(blockMap, block_id) != 0){
+		bitmap_setbit(blockMap, block_id, 0);
+		metaDirty(sb.bmapStart + block_id / MAP_BITS_PER_BLOCK);
+		metaDirty(1);
+		freeBlocks++;
+	}
+	allocLeave();
+	return 0;
+}
+
+/**
+ * Tells whether an inode block was read, and marks it read: with FS_THREADS
+ * the flag is set once the block is, and seen with it by the other threads
+ */
+static inline int inodeBlockLoaded(int block){
+#ifdef FS_THREADS
+	return __atomic_load_n(&inodeLoaded[block], __ATOMIC_ACQUIRE);
+#else
+	return inodeLoaded[block];
+#endif
+}
+
+static inline void inodeBlockSetLoaded(int block){
+#ifdef FS_THREADS
+	__atomic_store_n(&inodeLoaded[block], 1, __ATOMIC_RELEASE);
+#else
+	inodeLoaded[block] = 1;
+#endif
+}
+
+/**
+ * Returns the inode with the given number, reading its block from the
+ * device the first time
+ */
+static inode_t *inodeAt(int inode_id){
+	int block = inode_id / INODE_PER_BLOCK;
+	if(inodeLoaded != NULL && !inodeBlockLoaded(block)){
+		metaEnter();
+		/* a block that cannot be read stays zero and is tried again next time */
+		if(!inodeLoaded[block]
+		   && bread(deviceImage, sb.firstInode + block, (char *) (&inodeList[block])) == 0){
+			inodeBlockSetLoaded(block);
+		}
+		metaLeave();
+	}
+	return &inodeList[block].inodeArray[inode_id % INODE_PER_BLOCK];
+}
+
+/**
+ * Returns the buffer of a directory node changed since the last checkpoint, or NULL
+ */
+static dir_buffer_t *dirBuffer(int block){
+	for(int i = 0; i < dirBufferCount; i++){
+		if(dirBuffers[i].block == block){
+			return &dirBuffers[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Reads a node of a directory, from its buffer if it changed since the last checkpoint
+ *
+ * @return -1 in case of error and 0 otherwise
+ */
+static int nodeRead(int block, dir_node_t *node){
+	dir_buffer_t *buffer = dirBuffer(block);
+	if(buffer != NULL){
+		memcpy(node, &buffer->node, sizeof(dir_node_t));
+		return 0;
+	}
+	return bread(deviceImage, block, (char *) node) < 0 ? -1 : 0;
+}
+
+/**
+ * Writes a node of a directory. Like the inode blocks, it is logged by the
+ * next commit and written home by the checkpoint: until then it is kept in
+ * a buffer.
+ *
+ * @return -1 in case of error and 0 otherwise
+ */
+static int nodeWrite(int block, dir_node_t *node){
+	dir_buffer_t *buffer = dirBuffer(block);
+	if(buffer == NULL){
+		if(dirBufferCount == dirBufferSize){
+			int size = dirBufferSize == 0 ? 16 : 2 * dirBufferSize;
+			dir_buffer_t *grown = realloc(dirBuffers, sizeof(dir_buffer_t) * size);
+			if(grown == NULL){
+				return -1;
+			}
+			dirBuffers = grown;
+			dirBufferSize = size;
+		}
+		buffer = &dirBuffers[dirBufferCount++];
+		buffer->block = block;
+		buffer->flags = 0;
+	}
+	memcpy(&buffer->node, node, sizeof(dir_node_t));
+	buffer->flags |= META_DIRTY;
+	return 0;
+}
+
+/**
+ * Frees the block of a directory node. If the journal holds a copy of it,
+ * the block is freed by the next checkpoint instead: a replay would write
+ * the copy over whatever the block held by then.
+ *
+ * @return -1 in case of error and 0 otherwise
+ */
+static int nodeFree(int block){
+	dir_buffer_t *buffer = dirBuffer(block);
+	int logged = buffer != NULL && (buffer->flags & META_LOGGED);
+	if(buffer != NULL){
+		*buffer = dirBuffers[--dirBufferCount];
+	}
+	if(!logged){
+		return bfree(block - sb.firstDataBlock);
+	}
+	if(dirFreedCount == dirFreedSize){
+		int size = dirFreedSize == 0 ? 16 : 2 * dirFreedSize;
+		int *grown = realloc(dirFreed, sizeof(int) * size);
+		if(grown == NULL){
+			return -1;
+		}
+		dirFreed = grown;
+		dirFreedSize = size;
+	}
+	dirFreed[dirFreedCount++] = block;
+	return 0;
+}
+
+/**
+ * Frees a node of a directory and all the nodes under it
+ *
+ * @return -1 in case of error and 0 otherwise
+ */
+static int nodeFreeTree(int block){
+	dir_node_t node;
+	if(nodeRead(block, &node) < 0){
+		return -1;
+	}
+	for(int i = 0; node.level > 0 && i < node.count; i++){
+		if(nodeFreeTree(node.entry[i].target) < 0){
+			return -1;
+		}
+	}
+	return nodeFree(block);
+}
+
+/**
+ * Binary search of a name in a directory node
+ *
+ * @param node : the node
+ * @param name : the name, NAME_MAX characters padded with zeros
+ * @return the last entry whose name is not greater than name, -1 if all of them are
+ */
+static int nodeSearch(dir_node_t *node, char *name){
+	int low = 0, high = node->count;
+	while(low < high){
+		int mid = (low + high) / 2;
+		if(strncmp(node->entry[mid].name, name, NAME_MAX) <= 0){
+			low = mid + 1;
+		}
+		else{
+			high = mid;
+		}
+	}
+	return low - 1;
+}
+
+/**
+ * Puts an entry at a position of a node that has room for it
+ *
+ * @param name : NAME_MAX characters padded with zeros
+ */
+static void nodePut(dir_node_t *node, int i, char *name, unsigned long long target){
+	memmove(&node->entry[i + 1], &node->entry[i], sizeof(dir_entry_t) * (node->count - i));
+	memcpy(node->entry[i].name, name, NAME_MAX);
+	node->entry[i].target = target;
+	node->count++;
+}
+
+/**
+ * Inserts an entry in the subtree of a node. A full node is split in two
+ * halves and the new one is handed to the parent, which adds an entry for it.
+ *
+ * @param block : the node
+ * @param name, target : the entry
+ * @param right : the node made by a split, 0 if there was none
+ * @param rightName : room for NAME_MAX characters, the first name of right
+ * @return -1 in case of error and 0 otherwise
+ */
+static int nodeInsert(int block, char *name, unsigned long long target, int *right, char *rightName){
+	dir_node_t node, sibling;
+	char childName[NAME_MAX];
+	*right = 0;
+	if(nodeRead(block, &node) < 0){
+		return -1;
+	}
+	int i = nodeSearch(&node, name);
+	if(node.level > 0){
+		int child = i < 0 ? 0 : i, childRight;
+		if(nodeInsert(node.entry[child].target, name, target, &childRight, childName) < 0){
+			return -1;
+		}
+		if(childRight == 0){
+			return 0;
+		}
+		/* the new child follows the one that split */
+		i = child;
+		name = childName;
+		target = childRight;
+	}
+	i++;
+	if(node.count < DIR_NODE_MAX){
+		nodePut(&node, i, name, target);
+		return nodeWrite(block, &node);
+	}
+	int split = alloc();
+	if(split < 0){
+		return -1;
+	}
+	/* the upper half goes to the new node, on the right */
+	int half = DIR_NODE_MAX / 2;
+	memset(&sibling, 0, sizeof(dir_node_t));
+	sibling.level = node.level;
+	sibling.count = node.count - half;
+	memcpy(sibling.entry, &node.entry[half], sizeof(dir_entry_t) * sibling.count);
+	memset(&node.entry[half], 0, sizeof(dir_entry_t) * sibling.count);
+	node.count = half;
+	if(node.level == 0){
+		sibling.next = node.next;
+		node.next = split;
+	}
+	if(i <= half){
+		nodePut(&node, i, name, target);
+	}
+	else{
+		nodePut(&sibling, i - half, name, target);
+	}
+	if(nodeWrite(block, &node) < 0 || nodeWrite(split, &sibling) < 0){
+		return -1;
+	}
+	*right = split;
+	memcpy(rightName, sibling.entry[0].name, NAME_MAX);
+	return 0;
+}
+
+/**
+ * Returns the root node of the B+tree of a directory: the root directory
+ * keeps it in the superblock and the others in their inode
+ */
+static unsigned long long *dirRoot(int dir){
+	return dir == DIR_ROOT ? &sb.rootDir : &inodeAt(dir)->indirectBlock;
+}
+
+/**
+ * Returns the number of entries of a directory, kept next to its root node
+ */
+static unsigned long long *dirEntries(int dir){
+	return dir == DIR_ROOT ? &sb.rootEntries : &inodeAt(dir)->size;
+}
+
+/**
+ * Marks the block that holds the root node of a directory to be logged
+ */
+static void dirTouch(int dir){
+	if(dir == DIR_ROOT){
+		metaDirty(1);
+	}
+	else{
+		dirtyInode(dir);
+	}
+}
+
+/**
+ * Searches a name in a directory, from the root of its B+tree down to a leaf
+ *
+ * @param dir : the inode of the directory, or DIR_ROOT
+ * @param name : NAME_MAX characters padded with zeros
+ * @return the inode of the entry, -1 if there is none and -2 in case of error
+ */
+static int dirLookup(int dir, char *name){
+	dir_node_t node;
+	int block = *dirRoot(dir);
+	while(block != 0){
+		if(nodeRead(block, &node) < 0){
+			return -2;
+		}
+		int i = nodeSearch(&node, name);
+		if(node.level == 0){
+			return i >= 0 && strncmp(node.entry[i].name, name, NAME_MAX) == 0 ? (int) node.entry[i].target : -1;
+		}
+		block = node.entry[i < 0 ? 0 : i].target;
+	}
+	return -1;
+}
+
+/**
+ * Adds an entry to a directory that does not have it. The tree grows a
+ * level when its root splits.
+ *
+ * @param dir : the inode of the directory, or DIR_ROOT
+ * @param name : NAME_MAX characters padded with zeros
+ * @param inode_id : the inode the entry names
+ * @return -1 in case of error and 0 otherwise
+ */
+static int dirInsert(int dir, char *name, int inode_id){
+	dir_node_t node;
+	char rightName[NAME_MAX];
+	unsigned long long *root = dirRoot(dir);
+	int right;
+
+	memset(&node, 0, sizeof(dir_node_t));
+	if(*root != 0 && nodeRead(*root, &node) < 0){
+		return -1;
+	}
+	/* a split on every level and a new root at most: no error half way */
+	if(allocAvailable() < node.level + 2){
+		return -1;
+	}
+	if(*root == 0){
+		int block = alloc();
+		nodePut(&node, 0, name, inode_id);
+		if(block < 0 || nodeWrite(block, &node) < 0){
+			return -1;
+		}
+		*root = block;
+	}
+	else{
+		if(nodeInsert(*root, name, inode_id, &right, rightName) < 0){
+			return -1;
+		}
+		if(right != 0){
+			/* the first name of an inner node is never compared */
+			char noName[NAME_MAX];
+			int block = alloc();
+			int level = node.level + 1;
+			memset(noName, 0, NAME_MAX);
+			memset(&node, 0, sizeof(dir_node_t));
+			node.level = level;
+			nodePut(&node, 0, noName, *root);
+			nodePut(&node, 1, rightName, right);
+			if(block < 0 || nodeWrite(block, &node) < 0){
+				return -1;
+			}
+			*root = block;
+		}
+	}
+	(*dirEntries(dir))++;
+	dirTouch(dir);
+	return 0;
+}
+
+/**
+ * Removes an entry from a directory. The nodes are not merged: a directory
+ * keeps its blocks while it has entries and gives all of them back when the
+ * last one goes.
+ *
+ * @param dir : the inode of the directory, or DIR_ROOT
+ * @param name : NAME_MAX characters padded with zeros
+ * @return 0 if success, -1 if there is no such entry, -2 in case of error
+ */
+static int dirRemove(int dir, char *name){
+	dir_node_t node;
+	unsigned long long *root = dirRoot(dir);
+	int block = *root;
+	while(block != 0){
+		if(nodeRead(block, &node) < 0){
+			return -2;
+		}
+		int i = nodeSearch(&node, name);
+		if(node.level > 0){
+			block = node.entry[i < 0 ? 0 : i].target;
+			continue;
+		}
+		if(i < 0 || strncmp(node.entry[i].name, name, NAME_MAX) != 0){
+			return -1;
+		}
+		node.count--;
+		memmove(&node.entry[i], &node.entry[i + 1], sizeof(dir_entry_t) * (node.count - i));
+		memset(&node.entry[node.count], 0, sizeof(dir_entry_t));
+		unsigned long long *entries = dirEntries(dir);
+		(*entries)--;
+		dirTouch(dir);
+		if(*entries == 0){
+			int ret = nodeFreeTree(*root);
+			*root = 0;
+			return ret < 0 ? -2 : 0;
+		}
+		return nodeWrite(block, &node) < 0 ? -2 : 0;
+	}
+	return -1;
+}
+
+/**
+ * Finds the first entry of a directory whose name is greater than a name,
+ * walking the leaves in order
+ *
+ * @param dir : the inode of the directory, or DIR_ROOT
+ * @param name : NAME_MAX characters padded with zeros
+ * @param next : room for NAME_MAX characters, the name of the entry
+ * @return 1 if there is one, 0 if not and -1 in case of error
+ */
+static int dirNext(int dir, char *name, char *next){
+	dir_node_t node;
+	int block = *dirRoot(dir), i = -1;
+	while(block != 0){
+		if(nodeRead(block, &node) < 0){
+			return -1;
+		}
+		i = nodeSearch(&node, name);
+		if(node.level == 0){
+			break;
+		}
+		block = node.entry[i < 0 ? 0 : i].target;
+	}
+	if(block == 0){
+		return 0;
+	}
+	/* an empty leaf is skipped */
+	for(i++; i >= node.count; i = 0){
+		if(node.next == 0){
+			return 0;
+		}
+		if(nodeRead(node.next, &node) < 0){
+			return -1;
+		}
+	}
+	memcpy(next, node.entry[i].name, NAME_MAX);
+	return 1;
+}
+
+/**
+ * Resolves the directories of a path, whose components are separated by '/'
+ *
+ * @param path : the path, from the root directory with or without a leading '/'
+ * @param dir : the inode of the directory that holds the last component, or DIR_ROOT
+ * @param name : room for NAME_MAX + 1 characters, the last component padded with zeros
+ * @return 0 if success, -1 if a directory of the path does not exist, -2 if a
+ * component is longer than NAME_MAX, the path is empty or in case of error
+ */
+static int pathParent(char *path, int *dir, char *name){
+	*dir = DIR_ROOT;
+	for(;;){
+		while(*path == '/'){
+			path++;
+		}
+		int length = strcspn(path, "/");
+		char *next = path + length;
+		while(*next == '/'){
+			next++;
+		}
+		if(length > NAME_MAX || length == 0){
+			return -2;
+		}
+		memset(name, 0, NAME_MAX + 1);
+		memcpy(name, path, length);
+		if(*next == '\0'){
+			return 0;
+		}
+		int child = dirLookup(*dir, name);
+		if(child == -2){
+			return -2;
+		}
+		if(child < 0 || inodeAt(child)->type != INODE_DIR){
+			return -1;
+		}
+		*dir = child;
+		path = next;
+	}
+}
+
+/**
+ * Resolves a path: a path with no component is the root directory
+ *
+ * @param inode_id : the inode the path names, or DIR_ROOT
+ * @return 0 if success, -1 if it does not exist, -2 if a component is longer than NAME_MAX or in case of error
+ */
+static int pathLookup(char *path, int *inode_id){
+	char name[NAME_MAX + 1];
+	int dir;
+	if(path[strspn(path, "/")] == '\0'){
+		*inode_id = DIR_ROOT;
+		return 0;
+	}
+	int ret = pathParent(path, &dir, name);
+	if(ret < 0){
+		return ret;
+	}
+	*inode_id = dirLookup(dir, name);
+	return *inode_id < 0 ? *inode_id : 0;
+}
+
+/**
+ * Get the position of the inode of a file or directory
+ *
+ * @param fname : the path of the file
+ * @return -1 in case of error an the position of the inode otherwise
+ */
+int getInodePosition(char *fname){
+	int inode;
+	if(pathLookup(fname, &inode) < 0 || inode == DIR_ROOT){
+		return -1;
+	}
+	return inode;
+}
+
+/**
+ * Reads and sets the inode of a descriptor of the open file table: with FS_THREADS
+ * the calls on a descriptor read it before they lock the inode, so it is atomic
+ */
+static inline int fileTableInode(int fileDescriptor){
+#ifdef FS_THREADS
+	return __atomic_load_n(&fileTable[fileDescriptor].inode, __ATOMIC_ACQUIRE);
+#else
+	return fileTable[fileDescriptor].inode;
+#endif
+}
+
+static inline void fileTableSetInode(int fileDescriptor, int inode_id){
+#ifdef FS_THREADS
+	__atomic_store_n(&fileTable[fileDescriptor].inode, inode_id, __ATOMIC_RELEASE);
+#else
+	fileTable[fileDescriptor].inode = inode_id;
+#endif
+}
+
+/**
+ * Returns a descriptor of the open file table
+ *
+ * @param fileDescriptor : the descriptor
+ * @return the descriptor, NULL if it is not open
+ */
+static open_file_t *fileAt(int fileDescriptor){
+	if(fileTable == NULL || fileDescriptor < 0 || fileDescriptor >= FILE_TABLE_SIZE || fileTableInode(fileDescriptor) < 0){
+		return NULL;
+	}
+	return &fileTable[fileDescriptor];
+}
+
+/**
+ * Returns the inode a descriptor is open on
+ *
+ * @param fileDescriptor : the descriptor
+ * @return the inode, -1 if the descriptor is not open
+ */
+static int fileInode(int fileDescriptor){
+	return fileAt(fileDescriptor) == NULL ? -1 : fileTableInode(fileDescriptor);
+}
+
+/**
+ * Takes the lowest free descriptor of the open file table for a file, with its
+ * seek pointer at the beginning. Nothing but the table and the count of opens
+ * of the file changes.
+ *
+ * @param inode_id : the inode of the file
+ * @return the descriptor, -2 if the table is full
+ */
+static int fileOpen(int inode_id){
+	tableEnter();
+	int fd = fileCursor;
+	while(fd < FILE_TABLE_SIZE && fileTable[fd].inode >= 0){
+		fd++;
+	}
+	if(fd == FILE_TABLE_SIZE){
+		tableLeave();
+		return -2;
+	}
+	/* a read from the beginning counts as sequential */
+	fileTable[fd].flags = 0;
+	fileTable[fd].ptr = 0;
+	memset(&fileTable[fd].extentHint, 0, sizeof(extent_t));
+	fileTable[fd].raNext = 0;
+	fileTable[fd].raWindow = 0;
+	fileTable[fd].raEnd = 0;
+	fileTableSetInode(fd, inode_id);
+	fileCursor = fd + 1;
+	tableLeave();
+	fileState[inode_id].opens++;
+	return fd;
+}
+
+/**
+ * Gives a descriptor back to the open file table. The last close of a file
+ * releases the root of its extent tree kept in memory.
+ *
+ * @param fileDescriptor : the descriptor of the open file
+ */
+static void fileRelease(int fileDescriptor){
+	int inode_id = fileTable[fileDescriptor].inode;
+	if(--fileState[inode_id].opens == 0){
+		extentCacheDrop(inode_id);
+	}
+	tableEnter();
+	fileTableSetInode(fileDescriptor, -1);
+	if(fileDescriptor < fileCursor){
+		fileCursor = fileDescriptor;
+	}
+	tableLeave();
+}
+
+/**
+ * Gives back all the descriptors of a file that is removed. What the file keeps
+ * in memory is left to the remove.
+ *
+ * @param inode_id : the inode of the file
+ */
+static void fileReleaseAll(int inode_id){
+	tableEnter();
+	for(int fd = 0; fd < FILE_TABLE_SIZE; fd++){
+		if(fileTable[fd].inode == inode_id){
+			fileTableSetInode(fd, -1);
+			if(fd < fileCursor){
+				fileCursor = fd;
+			}
+		}
+	}
+	tableLeave();
+	fileState[inode_id].opens = 0;
+}
 
-	/* NF3 */
-	if( (inodeList[aux].inodeArray[position].size + numBytes) > MAX_FILE_SIZE) return -1;
+/**
+ * Translates n consecutive blocks of a file open on a descriptor into device
+ * blocks. While they stay in the last extent of the descriptor they are mapped
+ * from it, without walking the extent tree; otherwise the walk leaves there the
+ * extent of the last block, where the next sequential call starts.
+ *
+ * @param fileDescriptor : the descriptor of the open file
+ * @param fileBlock : first block of the file
+ * @param n : number of blocks
+ * @param blocks : device blocks, 0 for the blocks no extent maps
+ * @return -1 in case of error and 0 otherwise
+ */
+static int fileLookup(int fileDescriptor, int fileBlock, int n, int *blocks){
+	open_file_t *file = &fileTable[fileDescriptor];
+	extent_t hint;
+	streamEnter(file->inode);
+	hint = file->extentHint;
+	streamLeave(file->inode);
+	/* the extents of a file only grow: the blocks they map keep their device blocks */
+	if(fileBlock >= (int) hint.fileBlock && fileBlock + n <= (int) (hint.fileBlock + hint.length)){
+		for(int i = 0; i < n; i++){
+			blocks[i] = (int) (hint.start + (fileBlock + i - hint.fileBlock));
+		}
+		return 0;
+	}
+	if(extentLookup(file->inode, fileBlock, n, blocks, &hint) < 0){
+		return -1;
+	}
+	streamEnter(file->inode);
+	file->extentHint = hint;
+	streamLeave(file->inode);
+	return 0;
+}
 
-	/* If the file is not opened we proceed to open it */
-	if(inodeList[aux].inodeArray[position].opened == 0){
-	  openFile(inodeList[aux].inodeArray[position].name);
+/**
+ * Gets the root of the extent tree of a file: the extents in the inode, or
+ * the node of indirectBlock. The root node of an open file is read once and
+ * kept in its fileState until closeFile.
+ *
+ * @param inode_id : the inode of the file
+ * @param room : room for the root node, used if the file is not open
+ * @param extents : the entries of the root, sorted by fileBlock; extents when the depth is 0 or 1
+ * @return -1 in case of error and the number of entries otherwise
+ */
+static int extentLoad(int inode_id, extent_block_t *room, extent_t **extents){
+	inode_t *inode = inodeAt(inode_id);
+	file_state_t *st = &fileState[inode_id];
+	if(inode->depth == 0){
+		if(inode->extents > EXTENT_INLINE){ return -1;}
+		*extents = inode->extent;
+		return inode->extents;
+	}
+	if(inode->extents > EXTENT_PER_BLOCK || inode->depth > EXTENT_MAX_DEPTH){
+		return -1;
+	}
+	if(st->extentCache == NULL && st->opens > 0 && extentCacheAdd(inode_id) == 0){
+		if(bread(deviceImage, inode->indirectBlock, (char *) st->extentCache) < 0){
+			extentCacheDrop(inode_id);
+			return -1;
+		}
 	}
-
-	/* Calculate the number of blocks needed to write */
-	needed_blocks = blocks_toWrite(numBytes, inodeList[aux].inodeArray[position].size, BLOCK_SIZE);
-	
-	block_free = alloc();
-
-	for (int i = 0; i <= needed_blocks; i++) {
-		dummy.pos[i] = alloc();
-		bwrite(DEVICE_IMAGE, sb.firstDataBlock + dummy.pos[i], buffer+BLOCK_SIZE*i);
-		bitmap_setbit(sb.b_map, dummy.pos[i], 1);
+	if(st->extentCache != NULL){
+		*extents = st->extentCache->extentArray;
+		return inode->extents;
+	}
+	if(bread(deviceImage, inode->indirectBlock, (char *) room) < 0){
+		return -1;
 	}
+	*extents = room->extentArray;
+	return inode->extents;
+}
 
-	memcpy(buffer_w, &dummy, BLOCK_SIZE);
-  	/* Update the size of the file and the pointer */
-	inodeList[aux].inodeArray[position].size += numBytes;
-	inodeList[aux].inodeArray[position].ptr += numBytes;
+/**
+ * Walks the extent tree of a file from the root down to the leaf that maps a
+ * block of the file, with a binary search in every node: as many nodes as the
+ * depth of the tree, the ones under the root read through the block cache.
+ *
+ * @param inode_id : the inode of the file
+ * @param fileBlock : the block of the file; past the last extent, the last leaf is found
+ * @param room : room for a node
+ * @param extents : the extents of the leaf, sorted by fileBlock; they must not be modified
+ * @return -1 in case of error and the number of extents of the leaf otherwise
+ */
+static int extentWalk(int inode_id, int fileBlock, extent_block_t *room, extent_t **extents){
+	int count = extentLoad(inode_id, room, extents);
+	for(int level = inodeAt(inode_id)->depth - 1; count > 0 && level > 0; level--){
+		int e = extentSearch(*extents, count, fileBlock);
+		int block = (int) (*extents)[e < 0 ? 0 : e].start;
+		count = (*extents)[e < 0 ? 0 : e].length;
+		if(count > EXTENT_PER_BLOCK || bread(deviceImage, block, (char *) room) < 0){
+			return -1;
+		}
+		*extents = room->extentArray;
+	}
+	return count;
+}
 
-	/* Write the indirectBlock in disk */
-	bwrite(DEVICE_IMAGE,block_free,buffer_w); /* store indirect in disk */
-	inodeList[aux].inodeArray[position].indirectBlock = block_free;
-	syncFS();
-	return numBytes;
+/**
+ * Translates n consecutive blocks of a file into device blocks, walking the
+ * extent tree once per leaf they span
+ *
+ * @param inode_id : the inode of the file
+ * @param fileBlock : first block of the file
+ * @param n : number of blocks
+ * @param blocks : device blocks, 0 for the blocks no extent maps
+ * @param last : if not NULL, the extent of the last block, with length 0 if none maps it
+ * @return -1 in case of error and 0 otherwise
+ */
+static int extentLookup(int inode_id, int fileBlock, int n, int *blocks, extent_t *last){
+	extent_block_t room;
+	extent_t *extents;
+	if(last != NULL){
+		memset(last, 0, sizeof(extent_t));
+	}
+	for(int done = 0; done < n; ){
+		int count = extentWalk(inode_id, fileBlock + done, &room, &extents);
+		if(count < 0){
+			return -1;
+		}
+		/* the next leaf starts where the extents of this one end */
+		int length = extentEnd(extents, count) - (fileBlock + done);
+		if(length <= 0 || length > n - done){
+			length = n - done;
+		}
+		extentMap(extents, count, fileBlock + done, length, blocks + done);
+		done += length;
+		/* the leaf of the last block is the one at hand */
+		if(done == n && last != NULL && blocks[n - 1] != 0){
+			*last = extents[extentSearch(extents, count, fileBlock + n - 1)];
+		}
+	}
+	return 0;
 }
 
-/*
- * @brief	Modifies the position of the seek pointer of a file according to a given reference and offset.
+/**
+ * Gets the number of blocks of a file mapped by its extents: the end of the
+ * last extent of the rightmost leaf
  *
- * @param fileDescriptor: file descriptor.
- * @param whence: Constant value acting as reference for the seek operation. This could be: FS SEEK CUR, FS SEEK BEGIN or FSSEEKEND.
- * @param offset: Number of bytes to displace the seek pointer from the FS SEEK CUR position.
- * This value can be either positive or negative, although it will never allow positioning the seek pointer outside the limits of the file.
- * If whence is set to FS SEEK BEGIN or FS SEEK END, the file pointer must be set to this position, regardless of the offset value.
+ * @param inode_id : the inode of the file
+ * @return -1 in case of error and the number of blocks otherwise
+ */
+static int extentBlocks(int inode_id){
+	extent_block_t room;
+	extent_t *extents;
+	/* no file has more blocks than the device */
+	int count = extentWalk(inode_id, sb.dataBlockNum, &room, &extents);
+	return count < 0 ? -1 : extentEnd(extents, count);
+}
+
+/**
+ * Writes a node of the rightmost path of the extent tree of a file: the root
+ * in the inode or in the fileState of the file, the others to their block
  *
- * @return	0 if success, -1 otherwise.
+ * @param inode_id : the inode of the file
+ * @param level : 0 for the root, one more for every node under it
+ * @param block : device block of the node
+ * @param node : the entries of the node, the start of an extent_block_t but for the inode
+ * @return -1 in case of error and 0 otherwise
  */
-int lseekFile(int fileDescriptor, long offset, int whence)
-{
-	/* know in what block of inodes it is */
-	int aux = fileDescriptor / INODE_PER_BLOCK;
-	/* position inside the block */
-	int bPosition = fileDescriptor % INODE_PER_BLOCK;
+static int extentPathWrite(int inode_id, int level, int block, extent_t *node){
+	file_state_t *st = &fileState[inode_id];
+	if(level == 0 && inodeAt(inode_id)->depth == 0){
+		dirtyInode(inode_id);
+		return 0;
+	}
+	if(level == 0 && st->extentCache != NULL && node == st->extentCache->extentArray){
+		st->extentDirty = 1;
+		return 0;
+	}
+	return bwrite(deviceImage, block, (char *) node);
+}
 
-	/* If the file is closed we cannot move its pointer */
-	if(inodeList[aux].inodeArray[bPosition].opened == 0){
+/**
+ * Adds a level to the extent tree of a file whose root is full. The extents
+ * of the inode move to a new block, the root of a tree of depth 1; a root
+ * node moves down to a new block and keeps one entry, pointing to it.
+ *
+ * @param inode_id : the inode of the open file
+ * @param root, count : the entries of the root, from extentLoad
+ * @return -1 in case of error and 0 otherwise
+ */
+static int extentGrow(int inode_id, extent_t *root, int count){
+	inode_t *inode = inodeAt(inode_id);
+	file_state_t *st = &fileState[inode_id];
+	extent_block_t down;
+	int block;
+	if(inode->depth >= EXTENT_MAX_DEPTH || allocKept(1, &block, &st->delayedKept) < 0){
 		return -1;
 	}
-
-	/* If the file descriptor does not exist or no bytes to read or the offset is larger than the file size */
-	if(fileDescriptor < 0 || fileDescriptor > sb.numInodes || abs(offset) > inodeList[aux].inodeArray[bPosition].size){
+	memset(&down, 0, sizeof(extent_block_t));
+	memcpy(down.extentArray, root, sizeof(extent_t) * count);
+	if(inode->depth == 0 && fileState[inode_id].opens > 0 && extentCacheAdd(inode_id) == 0){
+		/* written by extentFlush, before the inode that points to it */
+		memcpy(st->extentCache, &down, sizeof(extent_block_t));
+		st->extentDirty = 1;
+	}
+	else if(bwrite(deviceImage, block, (char *) &down) < 0){
+		bfree(block - sb.firstDataBlock);
 		return -1;
 	}
-
-	/* Modify the position from the current one */
-	if(whence == FS_SEEK_CUR){
-		if((inodeList[aux].inodeArray[bPosition].ptr + offset) > inodeList[aux].inodeArray[bPosition].size){
+	if(inode->depth == 0){
+		memset(inode->extent, 0, sizeof(inode->extent));
+		inode->indirectBlock = block;
+		inode->extents = count;
+	}
+	else{
+		memset(root, 0, sizeof(extent_block_t));
+		root[0].fileBlock = down.extentArray[0].fileBlock;
+		root[0].length = count;
+		root[0].start = block;
+		if(extentPathWrite(inode_id, 0, inode->indirectBlock, root) < 0){
 			return -1;
 		}
-		if((inodeList[aux].inodeArray[bPosition].ptr + offset) < 0){
+		inode->extents = 1;
+	}
+	inode->depth++;
+	dirtyInode(inode_id);
+	return 0;
+}
+
+/**
+ * Appends an extent to the extent tree of a file, or lengthens its last
+ * extent when the new one follows it on the device. Only the nodes of the
+ * rightmost path are read and written: a full leaf gets a sibling under the
+ * lowest node of the path with room, and the tree gets a level when every
+ * node of the path is full. The entry of an index node that points to a
+ * child keeps the number of entries of the child in its length.
+ *
+ * @param inode_id : the inode of the open file
+ * @param extent : the extent, starting at the first block past the last one
+ * @return -1 in case of error and 0 otherwise
+ */
+static int extentPush(int inode_id, extent_t *extent){
+	inode_t *inode = inodeAt(inode_id);
+	extent_block_t room[EXTENT_MAX_DEPTH];
+	extent_t *node[EXTENT_MAX_DEPTH];
+	int count[EXTENT_MAX_DEPTH], block[EXTENT_MAX_DEPTH];
+	int depth = inode->depth;
+	int leaf = depth == 0 ? 0 : depth - 1;
+	int room0 = depth == 0 ? EXTENT_INLINE : EXTENT_PER_BLOCK;
+
+	/* the rightmost path, from the root down to the last leaf */
+	count[0] = extentLoad(inode_id, &room[0], &node[0]);
+	if(count[0] < 0){
+		return -1;
+	}
+	block[0] = inode->indirectBlock;
+	for(int i = 1; i <= leaf; i++){
+		extent_t *parent = &node[i-1][count[i-1] - 1];
+		block[i] = parent->start;
+		count[i] = parent->length;
+		node[i] = room[i].extentArray;
+		if(count[i] > EXTENT_PER_BLOCK || bread(deviceImage, block[i], (char *) &room[i]) < 0){
 			return -1;
 		}
-		inodeList[aux].inodeArray[bPosition].ptr += offset;
 	}
-	/* Modify the position from the beginning of the file */
-	else if(whence == FS_SEEK_BEGIN){
-		inodeList[aux].inodeArray[bPosition].ptr = 0;
+	extent_t *last = count[leaf] > 0 ? &node[leaf][count[leaf] - 1] : NULL;
+	if(last != NULL && last->start + last->length == extent->start){
+		last->length += extent->length;
+		return extentPathWrite(inode_id, leaf, block[leaf], node[leaf]);
 	}
-	/* Modify the position from the end of the file */
-	else if(whence == FS_SEEK_END){
-		inodeList[aux].inodeArray[bPosition].ptr = inodeList[aux].inodeArray[bPosition].size;
+
+	/* the lowest node of the path with room takes the new entry */
+	int i = leaf;
+	while(i >= 0 && count[i] == (i == 0 ? room0 : EXTENT_PER_BLOCK)){
+		i--;
 	}
-	else{
-		/* The whence has a wrong value */
+	if(i < 0){
+		return extentGrow(inode_id, node[0], count[0]) < 0 ? -1 : extentPush(inode_id, extent);
+	}
+	/* under it, a new node per level down to a new leaf, holding one entry each */
+	extent_t entry = *extent;
+	int chain = leaf - i;
+	int fresh[EXTENT_MAX_DEPTH];
+	if(chain > 0 && allocKept(chain, fresh, &fileState[inode_id].delayedKept) < 0){
 		return -1;
 	}
-	return 0;
+	for(int j = chain - 1; j >= 0; j--){
+		memset(&room[i + 1 + j], 0, sizeof(extent_block_t));
+		room[i + 1 + j].extentArray[0] = entry;
+		if(bwrite(deviceImage, fresh[j], (char *) &room[i + 1 + j]) < 0){
+			for(int k = 0; k < chain; k++) bfree(fresh[k] - sb.firstDataBlock);
+			return -1;
+		}
+		entry.start = fresh[j];
+		entry.length = 1;
+	}
+	node[i][count[i]++] = entry;
+	if(extentPathWrite(inode_id, i, block[i], node[i]) < 0){
+		return -1;
+	}
+	if(i == 0){
+		inode->extents = count[0];
+		dirtyInode(inode_id);
+		return 0;
+	}
+	node[i-1][count[i-1] - 1].length = count[i];
+	return extentPathWrite(inode_id, i - 1, block[i-1], node[i-1]);
 }
 
-/*
- * @brief 	Verifies the integrity of the file system metadata.
- * @return 	0 if the file system is correct, -1 if the file system is corrupted, -2 in case of error.
+/**
+ * Adds an open file to fileCached, the list walked by extentFlushAll and
+ * delayFlushAll, before it keeps the root of its extent tree or delayed blocks in memory.
+ * A file already in the list is not added again.
+ *
+ * @param inode_id : the inode of the open file
+ * @return -1 in case of error and 0 otherwise
  */
-int checkFS(void)
-{
-	return -2;
+static int fileCacheJoin(int inode_id){
+	file_state_t *st = &fileState[inode_id];
+	if(st->extentCache != NULL || st->delayed != NULL){
+		return 0;
+	}
+	metaEnter();
+	if(fileCachedCount == fileCachedSize){
+		int size = fileCachedSize == 0 ? 16 : 2 * fileCachedSize;
+		int *grown = realloc(fileCached, sizeof(int) * size);
+		if(grown == NULL){
+			metaLeave();
+			return -1;
+		}
+		fileCached = grown;
+		fileCachedSize = size;
+	}
+	fileCached[fileCachedCount++] = inode_id;
+	metaLeave();
+	return 0;
 }
 
-/*
- * @brief 	Verifies the integrity of a file.
- * @return 	0 if the file is correct, -1 if the file is corrupted, -2 in case of error.
+/**
+ * Removes a file from fileCached once it keeps nothing in memory
+ *
+ * @param inode_id : the inode of the file
  */
-int checkFile(char *fileName)
-{
-	return -2;
+static void fileCacheLeave(int inode_id){
+	file_state_t *st = &fileState[inode_id];
+	if(st->extentCache != NULL || st->delayed != NULL){
+		return;
+	}
+	metaEnter();
+	for(int i = 0; i < fileCachedCount; i++){
+		if(fileCached[i] == inode_id){
+			fileCached[i] = fileCached[--fileCachedCount];
+			break;
+		}
+	}
+	metaLeave();
 }
 
 /**
- * Writes the default File System into the disk
- * @return -1 in error and 0 otherwise
+ * Keeps the root node of the extent tree of an open file in memory: the cache is allocated
+ * empty and the file joins fileCached
+ *
+ * @param inode_id : the inode of the open file
+ * @return -1 in case of error and 0 otherwise
  */
-int umount (void){
-	/* check that all the files are closed  */
-	for(int i = 0; i < sb.numInodes; i++){
-		if((bitmap_getbit(sb.i_map, i)) == 1){ /* check if the inode is in used */
-			return -1; /* inode in used  */
-		}
+static int extentCacheAdd(int inode_id){
+	file_state_t *st = &fileState[inode_id];
+	if(fileCacheJoin(inode_id) < 0){
+		return -1;
 	}
-
-	/* flush metadata on disk */
-	if( syncFS() < 0){ /* check errors in sync */
+	st->extentCache = malloc(sizeof(extent_block_t));
+	if(st->extentCache == NULL){
+		fileCacheLeave(inode_id);
 		return -1;
 	}
+	st->extentDirty = 0;
 	return 0;
 }
 
 /**
- * Writes the metadata into the disk
+ * Releases the root node kept in memory for a file, written or not
  *
- * @return -1 in error and 0 otherwise
+ * @param inode_id : the inode of the file
  */
-int syncFS (void){
-	/* write the superblock into the first block of the disk */
-	if(syncSP() < 0){ return -1;}
-	/* write the inode list to disk */
-	if(syncIN() < 0) { return -1;}
-	return 0;
+static void extentCacheDrop(int inode_id){
+	file_state_t *st = &fileState[inode_id];
+	if(st->extentCache == NULL){
+		return;
+	}
+	free(st->extentCache);
+	st->extentCache = NULL;
+	st->extentDirty = 0;
+	fileCacheLeave(inode_id);
 }
 
 /**
- * Writes the superblock into the disk
+ * Writes the root node of a file kept in memory if it changed since it was read
  *
- * @return -1 in error and 0 otherwise
+ * @param inode_id : the inode of the file
+ * @return -1 in case of error and 0 otherwise
  */
-int syncSP(){
-	/* write the superblock into the first block of the disk */
-	if( bwrite(DEVICE_IMAGE, 1, (char *) (&sb)) < 0){
+static int extentFlush(int inode_id){
+	file_state_t *st = &fileState[inode_id];
+	if(st->extentCache == NULL || !st->extentDirty){
+		return 0;
+	}
+	if(bwrite(deviceImage, inodeAt(inode_id)->indirectBlock, (char *) st->extentCache) < 0){
 		return -1;
 	}
+	st->extentDirty = 0;
 	return 0;
 }
 
 /**
- * Writes the inode_block_t into the disk
+ * Writes the root nodes of the open files that changed. The inodes that
+ * point to them may be logged next: like the data blocks, they reach the
+ * device first.
  *
- * @return -1 in error and 0 otherwise
+ * @return -1 in case of error and 0 otherwise
  */
-int syncIN(){
-	for(int i = 0; i < sb.inodesBlocks; i++){
-		if( bwrite(DEVICE_IMAGE, i+sb.firstInode, (char *) (&inodeList) + i*BLOCK_SIZE) < 0){
+static int extentFlushAll(void){
+	for(int i = 0; i < fileCachedCount; i++){
+		if(extentFlush(fileCached[i]) < 0){
 			return -1;
 		}
 	}
@@ -533,140 +3451,404 @@ int syncIN(){
 }
 
 /**
- * Gives you the needed blocks to store the input bits or bytes
+ * Counts the blocks the extent tree of a file may take to map count more blocks
+ * after its mapped ones, each of them an extent in the worst case: the levels
+ * the tree gets, up to the depth that holds all the extents, and under the root
+ * a new node per level for every EXTENT_PER_BLOCK entries the level gets.
  *
- * @return -1 in case of error and the number of needed blocks otherwise
+ * @param inode_id : the inode of the file
+ * @param mapped : blocks of the file mapped by its extents
+ * @param count : blocks mapped after them
+ * @return the number of blocks
  */
-int needed_blocks(int amount, char type){
-	int aux = 0;
-	if(type == 'b'){
-		aux = (amount/8)/SIZE_OF_BLOCK;
-		if(((amount/8)%SIZE_OF_BLOCK) != 0){
-			aux++;
-		}
+static int extentReserve(int inode_id, int mapped, int count){
+	int depth = inodeAt(inode_id)->depth;
+	long extents = (long) mapped + count;
+	int levels = 0;
+	for(long room = EXTENT_INLINE; room < extents && levels < EXTENT_MAX_DEPTH; levels++){
+		room = levels == 0 ? EXTENT_PER_BLOCK : room * EXTENT_PER_BLOCK;
 	}
-	else if(type == 'B'){
-		aux = amount/SIZE_OF_BLOCK;
-		if((amount%SIZE_OF_BLOCK) != 0){
-			aux++;
+	if(levels < depth){
+		levels = depth;
+	}
+	int blocks = levels - depth;
+	for(int level = 1; level < levels; level++){
+		count = (count + EXTENT_PER_BLOCK - 1) / EXTENT_PER_BLOCK;
+		blocks += count;
+	}
+	return blocks;
+}
+
+/**
+ * Copies bytes written past the blocks mapped by the extents of an open file
+ * into its delayed blocks, which grow up to the last block written. They take
+ * device blocks at delayFlush, all at once, and delayFlush runs on its own once
+ * they reach DELAY_MAX_BLOCKS.
+ *
+ * @param inode_id : the inode of the open file
+ * @param mapped : blocks of the file mapped by its extents, the first delayed block
+ * @param offset, numBytes : where in the file the bytes go, at or after block mapped, and how many
+ * @param iov, iovcnt, at : the buffers of the bytes written, from byte at of their run on
+ * @return -1 in case of error and 0 otherwise
+ */
+static int delayWrite(int inode_id, int mapped, long offset, const struct iovec *iov, int iovcnt, long at, int numBytes){
+	file_state_t *st = &fileState[inode_id];
+	int blocks = (offset + numBytes + BLOCK_SIZE - 1) / BLOCK_SIZE - mapped;
+	if(st->delayed == NULL){
+		st->delayedSize = inodeAt(inode_id)->size;
+	}
+	if(blocks > st->delayedBlocks){
+		/* the write fails now if the blocks, and the extent nodes that map them,
+		   would not be there at delayFlush */
+		int keep = blocks + extentReserve(inode_id, mapped, blocks);
+		int more = keep > st->delayedKept ? keep - st->delayedKept : 0;
+		allocEnter();
+		if(delayedTotal + more > freeBlocks || fileCacheJoin(inode_id) < 0){
+			allocLeave();
+			return -1;
 		}
+		char *grown = realloc(st->delayed, (long) blocks * BLOCK_SIZE);
+		if(grown == NULL){
+			fileCacheLeave(inode_id);
+			allocLeave();
+			return -1;
+		}
+		memset(grown + (long) st->delayedBlocks * BLOCK_SIZE, 0, (long) (blocks - st->delayedBlocks) * BLOCK_SIZE);
+		st->delayed = grown;
+		delayedTotal += more;
+		st->delayedKept += more;
+		st->delayedBlocks = blocks;
+		allocLeave();
 	}
-	else{
-		return -1;
+	iovCopy(iov, iovcnt, at, st->delayed + offset - (long) mapped * BLOCK_SIZE, numBytes, 0);
+	if(offset + numBytes > st->delayedSize){
+		st->delayedSize = offset + numBytes;
 	}
-	return aux;
+	return st->delayedBlocks >= DELAY_MAX_BLOCKS ? delayFlush(inode_id) : 0;
 }
 
 /**
- * Searches for a free position in the inode map
+ * Gives device blocks to the delayed blocks of a file, in one allocation so that
+ * they are contiguous while the map allows it, writes them and appends them
+ * to its extent tree. The last extent grows when they follow it on the device.
+ * The blocks, and the extent nodes, come out of the ones the file keeps.
  *
- * @return 	the position of the free inode. In case of error -1 is returned
+ * @param inode_id : the inode of the file
+ * @return -1 in case of error, with the delayed blocks that got no device block kept, and 0 otherwise
  */
-int ialloc(void){
-    for(int i = 0; i < sb.numInodes; i++){
-		if(bitmap_getbit(sb.i_map, i) == 0){ /* check if the position is free */
-			bitmap_setbit(sb.i_map, i, 1); /* inode busy */
-			/* know in what block of inodes it is */
-			int position = i;
-			int aux = position / INODE_PER_BLOCK;
-			position = position % INODE_PER_BLOCK;
-            memset(&(inodeList[aux].inodeArray[position]), 0, sizeof(inode_t) ); /* default values to the inode */
-            return i; /* return the position of the inode */
-        }
-    }
-    return -1;
+static int delayFlush(int inode_id){
+	file_state_t *st = &fileState[inode_id];
+	int n = st->delayedBlocks;
+	if(st->delayed == NULL){
+		return 0;
+	}
+	int mapped = extentBlocks(inode_id);
+	if(mapped < 0){
+		return -1;
+	}
+	int *blockNumbers = malloc(sizeof(int) * n);
+	char **buffers = malloc(sizeof(char *) * n);
+	extent_t *added = malloc(sizeof(extent_t) * n);
+	if(blockNumbers == NULL || buffers == NULL || added == NULL || allocKept(n, blockNumbers, &st->delayedKept) < 0){
+		free(blockNumbers);
+		free(buffers);
+		free(added);
+		return -1;
+	}
+	int count = extentBuild(mapped, blockNumbers, n, added);
+	for(int i = 0; i < n; i++){
+		buffers[i] = st->delayed + (long) i * BLOCK_SIZE;
+	}
+	int ret = bwritev(deviceImage, blockNumbers, buffers, n);
+	int pushed = 0;
+	for(int e = 0; ret == 0 && e < count; e++){
+		ret = extentPush(inode_id, &added[e]);
+		if(ret == 0){
+			pushed += added[e].length;
+		}
+	}
+	/* the device blocks that did not join the tree are given back, and kept again for the delayed blocks left */
+	allocEnter();
+	delayedTotal += n - pushed;
+	st->delayedKept += n - pushed;
+	allocLeave();
+	for(int i = pushed; i < n; i++){
+		bfree(blockNumbers[i] - sb.firstDataBlock);
+	}
+	if(pushed > 0){
+		long size = (long) (mapped + pushed) * BLOCK_SIZE;
+		inodeAt(inode_id)->size = size < st->delayedSize ? size : st->delayedSize;
+		dirtyInode(inode_id);
+	}
+	if(ret == 0){
+		delayDrop(inode_id);
+	}
+	else if(pushed > 0){
+		/* the delayed blocks left start at the new end of the extents */
+		memmove(st->delayed, st->delayed + (long) pushed * BLOCK_SIZE, (long) (n - pushed) * BLOCK_SIZE);
+		st->delayedBlocks -= pushed;
+	}
+	free(blockNumbers);
+	free(buffers);
+	free(added);
+	return ret;
 }
 
 /**
- * Searches for a free position in the block map
+ * Gets the size of a file, counting the bytes of its delayed blocks that the inode does not count yet
  *
- * @return 	the position of the free block. In case of error -1 is returned
+ * @param inode_id : the inode of the file
+ * @return the size in bytes
  */
-int alloc(void){
-    char b[BLOCK_SIZE];
-    for(int i = 0; i < sb.dataBlockNum; i++){
-        if(bitmap_getbit(sb.b_map, i) == 0){ /* check if the position is free */
-			bitmap_setbit(sb.b_map, i, 1); /* block busy */
-            memset(b, 0, BLOCK_SIZE); /* default values to the block */
-            bwrite(DEVICE_IMAGE, i + sb.firstDataBlock, b); /* write the empty block in the position found */
-            return (i + sb.firstDataBlock); /* return the position of the block */
-        }
-    }
-    return -1;
+static long fileSize(int inode_id){
+	file_state_t *st = &fileState[inode_id];
+	return st->delayed != NULL ? st->delayedSize : (long) inodeAt(inode_id)->size;
 }
 
 /**
- * Free a position of an inode
+ * Throws away the delayed blocks of a file
  *
- * @param inode_id : the position of the inode to be deleted
- * @return -1 in case of error an 0 otherwise
+ * @param inode_id : the inode of the file
  */
-int ifree (int inode_id){
-	/* check the validity of the position of the inode */
-	if(inode_id > sb.numInodes) { return -1;}
-	/* free inode */
-	bitmap_setbit(sb.i_map, inode_id, 0);
-	return 0;
+static void delayDrop(int inode_id){
+	file_state_t *st = &fileState[inode_id];
+	if(st->delayed == NULL){
+		return;
+	}
+	free(st->delayed);
+	st->delayed = NULL;
+	allocEnter();
+	delayedTotal -= st->delayedKept;
+	allocLeave();
+	st->delayedKept = 0;
+	st->delayedBlocks = 0;
+	st->delayedSize = 0;
+	fileCacheLeave(inode_id);
 }
 
 /**
- * Free a position of a block
+ * Gives device blocks to the delayed blocks of the open files
  *
- * @param block_id : the position of the block to be deleted
- * @return -1 in case of error an 0 otherwise
+ * @return -1 in case of error and 0 otherwise
  */
-int bfree (int block_id){
-	/* check the validity of the position of the block */
-	if(block_id > sb.dataBlockNum) { return -1;}
-	/* free block */
-	bitmap_setbit(sb.b_map, block_id, 0);
+static int delayFlushAll(void){
+	for(int i = fileCachedCount - 1; i >= 0; i--){
+		/* delayFlush may take the file out of fileCached */
+		if(i < fileCachedCount && delayFlush(fileCached[i]) < 0){
+			return -1;
+		}
+	}
 	return 0;
 }
 
 /**
- * Get the position of the given inode
+ * Builds the extents of a list of device blocks holding consecutive blocks of
+ * a file: every run of adjacent device blocks becomes one extent
  *
- * @param inode : the inode to extract the position
- * @return -1 in case of error an the position of the inode otherwise
+ * @param fileBlock : block of the file held by blocks[0]
+ * @param blocks, n : the device blocks
+ * @param extents : room for n extents
+ * @return the number of extents
  */
-int getInodePosition(char *fname){
+static int extentBuild(int fileBlock, int *blocks, int n, extent_t *extents){
 	int count = 0;
-	for(int i = 0; i < sb.inodesBlocks; i++){ /* go through all the inode blocks */
-		inode_block_t inodeListAux = inodeList[i]; /* copy the list of inodes of the current block */
-		for(int j = 0; j <= INODE_PER_BLOCK; j++){ /* go through all the inodes from a block */
-			if(count > INODE_MAX_NUMBER){ /* already checked all the inodes */
-				return -1;
-			}
-			else if(strcmp(inodeListAux.inodeArray[j].name, fname) == 0) {
-				/* Return file position */
-				return i;
+	for(int i = 0; i < n; i++){
+		if(count > 0 && blocks[i] == (int) (extents[count-1].start + extents[count-1].length)){
+			extents[count-1].length++;
+			continue;
+		}
+		extents[count].fileBlock = fileBlock + i;
+		extents[count].start = blocks[i];
+		extents[count].length = 1;
+		count++;
+	}
+	return count;
+}
+
+/**
+ * Searches the entries of a node of an extent tree, sorted by fileBlock
+ *
+ * @param extents, count : the entries
+ * @param fileBlock : the block of the file
+ * @return the last entry that starts at or before fileBlock, -1 if none does
+ */
+static int extentSearch(extent_t *extents, int count, int fileBlock){
+	int low = 0, high = count;
+	while(low < high){
+		int mid = (low + high) / 2;
+		if((int) extents[mid].fileBlock <= fileBlock){
+			low = mid + 1;
+		}
+		else{
+			high = mid;
+		}
+	}
+	return low - 1;
+}
+
+/**
+ * Translates n consecutive blocks of a file into device blocks with the
+ * extents of a leaf, searching the extent of the first one and walking the
+ * following ones
+ *
+ * @param extents, count : the extents of the file, sorted by fileBlock
+ * @param fileBlock : first block of the file
+ * @param n : number of blocks
+ * @param blocks : device blocks, 0 for the blocks no extent maps
+ */
+static void extentMap(extent_t *extents, int count, int fileBlock, int n, int *blocks){
+	int e = extentSearch(extents, count, fileBlock);
+	for(int i = 0; i < n; i++){
+		int b = fileBlock + i;
+		while(e + 1 < count && (int) extents[e+1].fileBlock <= b){
+			e++;
+		}
+		if(e >= 0 && b < (int) (extents[e].fileBlock + extents[e].length)){
+			blocks[i] = (int) (extents[e].start + (b - extents[e].fileBlock));
+		}
+		else{
+			blocks[i] = 0;
+		}
+	}
+}
+
+/**
+ * Returns the first block of the file past its last extent
+ */
+static int extentEnd(extent_t *extents, int count){
+	return count == 0 ? 0 : (int) (extents[count-1].fileBlock + extents[count-1].length);
+}
+
+/**
+ * Frees the data blocks mapped by the entries of a node of an extent tree,
+ * and the nodes under it
+ *
+ * @param extents, count : the entries of the node
+ * @param level : height of the node, 0 for a leaf
+ * @return -1 in case of error and 0 otherwise
+ */
+static int extentRelease(extent_t *extents, int count, int level){
+	extent_block_t node;
+	for(int e = 0; e < count; e++){
+		if(level == 0){
+			for(int i = 0; i < (int) extents[e].length; i++){
+				bfree(extents[e].start + i - sb.firstDataBlock);
 			}
-			count++;
+			continue;
 		}
+		if(extents[e].length > EXTENT_PER_BLOCK || bread(deviceImage, extents[e].start, (char *) &node) < 0){
+			return -1;
+		}
+		if(extentRelease(node.extentArray, extents[e].length, level - 1) < 0){
+			return -1;
+		}
+		bfree(extents[e].start - sb.firstDataBlock);
 	}
-	return -1;
+	return 0;
+}
+
+/**
+ * Frees the data blocks of a file and the nodes of its extent tree
+ *
+ * @param inode_id : the inode of the file
+ * @return -1 in case of error and 0 otherwise
+ */
+static int extentFree(int inode_id){
+	extent_block_t room;
+	extent_t *extents;
+	inode_t *inode = inodeAt(inode_id);
+	int count = extentLoad(inode_id, &room, &extents);
+	if(count < 0 || extentRelease(extents, count, inode->depth == 0 ? 0 : inode->depth - 1) < 0){
+		return -1;
+	}
+	if(inode->depth != 0){
+		bfree(inode->indirectBlock - sb.firstDataBlock);
+	}
+	/* nothing to write for the blocks given back */
+	extentCacheDrop(inode_id);
+	memset(inode->extent, 0, sizeof(inode->extent));
+	inode->indirectBlock = 0;
+	inode->depth = 0;
+	inode->extents = 0;
+	return 0;
 }
 
 /**
- * Get the direct block from the inode in the given position
+ * Get the device block holding a byte of a file, walking its extent tree:
+ * one node per level
  *
  * @param inode_position : the position of the inode
- * @return -1 in case of error an the direct block of the inode otherwise
+ * @param offset : the byte of the file
+ * @return -1 in case of error or if no block holds the byte, and the device block otherwise
  */
-int bmap(int inode_position, int offset){
+int bmap(int inode_position, long offset){
+	int block;
 	/* position is not valid */
-	if(inode_position > sb.numInodes){
+	if(inode_position < 0 || inode_position >= (int) sb.numInodes || offset < 0){
+		return -1;
+	}
+	if(extentLookup(inode_position, offset / BLOCK_SIZE, 1, &block, NULL) < 0){
 		return -1;
 	}
+	return block == 0 ? -1 : block;
+}
 
-	/* return the inode block */
-	if(offset < SIZE_OF_BLOCK){
-		/* know in what block of inodes it is */
-		int aux = inode_position / INODE_PER_BLOCK;
-		inode_position = inode_position % INODE_PER_BLOCK;
-		return inodeList[aux].inodeArray[inode_position].indirectBlock;
+/**
+ * Prefetches the blocks of a read into the block cache, with as many blocks
+ * after them as the readahead window of the file when the reads are sequential.
+ * The window starts at RA_MIN_BLOCKS, doubles up to RA_MAX_BLOCKS each time
+ * the reader gets within half a window of the prefetched blocks, and
+ * collapses on the first read that does not continue the previous one.
+ *
+ * Every descriptor has its own window, so readers of the same file do not break
+ * each other's sequence.
+ *
+ * @param fileDescriptor : the descriptor of the open file
+ * @param blockNumbers : device blocks of the file from the one of offset
+ * @param offset : first byte of the read
+ * @param numBytes : bytes of the read, from offset and within the file
+ * @param blocks : number of blocks of the file with a device block
+ * @return -1 in case of error and 0 otherwise
+ */
+int readahead(int fileDescriptor, int *blockNumbers, long offset, int numBytes, int blocks){
+	open_file_t *st = fileAt(fileDescriptor);
+	if(st == NULL){
+		return -1;
 	}
-	return -1;
+	long pointer = offset;
+	int first = pointer / BLOCK_SIZE;
+	int last = (pointer + numBytes - 1) / BLOCK_SIZE;
+	int end = last + 1; /* first file block not requested */
+
+	streamEnter(st->inode);
+	if(pointer != st->raNext){
+		/* random access: only the blocks of the read */
+		st->raWindow = 0;
+		st->raEnd = 0;
+	}
+	else if(st->raWindow == 0){
+		st->raWindow = RA_MIN_BLOCKS;
+		end += st->raWindow;
+	}
+	else if(st->raEnd - last <= st->raWindow / 2){
+		/* close to the end of the prefetched blocks: fetch a larger window */
+		if(st->raWindow < RA_MAX_BLOCKS){
+			st->raWindow *= 2;
+		}
+		end += st->raWindow;
+	}
+	if(end > blocks){
+		end = blocks;
+	}
+	if(end > st->raEnd){
+		st->raEnd = end;
+	}
+	st->raNext = pointer + numBytes;
+	streamLeave(st->inode);
+	if(end <= first){
+		return 0;
+	}
+	return bprefetch(deviceImage, blockNumbers, end - first);
 }
 
 /**
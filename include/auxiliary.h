@@ -6,16 +6,24 @@
  * @date	01/03/2017
  */
 int umount (void); /* write the default File System into the disk */
-int syncFS(void); /* writes the metadata into the disk */
+int syncFS(void); /* ends a metadata operation, committed to the journal in batches */
+int journalCommit(void);
+int journalCheckpoint(void);
+int journalReplay(void);
 
 int needed_blocks(int bits, char type);
 int blocks_toWrite();
 int getInodePosition(char *fileName);
 int ialloc (void);
 int alloc (void);
+int allocN(int n, int *blocks);
+void allocInit(void);
 int ifree (int inode_id);
 int bfree (int block_id);
-int bmap(int inode_position, int offset);
+int bmap(int inode_position, long offset);
+int readahead(int fileDescriptor, int *blockNumbers, long offset, int numBytes, int blocks);
 int syncSP();
 int syncIN();
+void dirtyInode(int inode_id);
+void freeIN();
 int blocks_toWrite(int bytesToWrite, int fileSize, int blockSize);
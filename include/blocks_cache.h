@@ -17,6 +17,143 @@
 #include <unistd.h>
 
 #define BLOCK_SIZE 2048
+#define DEVICE_NAME_MAX 256
+#define BLOCK_RUN_MAX 512               /* Maximum blocks moved by one vectored call */
+
+/* Backends of the mounted device */
+#define DEVICE_FD 0                     /* Image file, positional I/O on a descriptor, with block cache */
+#define DEVICE_MMAP 1                   /* Image file, shared mapping of the whole file */
+#define DEVICE_RAM 2                    /* RAM disk created with bramdisk */
+#define RAMDISK_MAX 8                   /* Maximum RAM disks per process */
+
+struct dev_ops;                         /* Operations table of a backend (devices.h) */
+
+/* Engines for the multi-block transfers of DEVICE_FD */
+#define IO_SYNC 0                       /* One blocking vectored call per contiguous run */
+#define IO_URING 1                      /* All the runs queued to io_uring and reaped together */
+
+/* Block cache of the mounted device */
+#define CACHE_LRU 0                     /* Evict the least recently used block */
+#define CACHE_CLOCK 1                   /* Evict with the second chance clock */
+#define CACHE_DEFAULT_BLOCKS 64         /* Default capacity in blocks */
+
+/* Block I/O counters */
+typedef struct{
+    unsigned long reads;                /* Blocks requested through bread */
+    unsigned long writes;               /* Blocks requested through bwrite */
+    unsigned long syscalls;             /* System calls issued to serve them */
+    unsigned long hits;                 /* Requests served by the cache */
+    unsigned long misses;               /* Requests that had to allocate a cache entry */
+    unsigned long evictions;            /* Blocks dropped to make room */
+    unsigned long writebacks;           /* Dirty blocks written to the device */
+    unsigned long queued;               /* Runs issued through the io_uring engine */
+    unsigned long prefetched;           /* Blocks loaded into the cache by bprefetch */
+} bstats_t;
+
+
+/*******************/
+/* Device session. */
+/*******************/
+
+/*
+ * Attaches the device once with a backend and caches its size. While the
+ * session is open, bread/bwrite on that device use positional I/O on a
+ * single descriptor (DEVICE_FD), memory copies on a mapping of the whole
+ * image (DEVICE_MMAP) or memory copies on a RAM disk (DEVICE_RAM).
+ * Without a session every call opens and closes the image file.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bmount(char *deviceName, int backend);
+
+/*
+ * Attaches the device once with a custom operations table.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bmountops(char *deviceName, const struct dev_ops *ops);
+
+/*
+ * Writes the dirty cached blocks back and closes the device session opened by bmount.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bumount(void);
+
+/*
+ * Returns 1 if there is a session opened on the given device and 0 otherwise.
+ */
+int bmounted(char *deviceName);
+
+/*
+ * Creates a RAM disk of the given size in bytes filled with zeros, to be
+ * mounted with DEVICE_RAM. An existing RAM disk with the same name is replaced.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bramdisk(char *deviceName, long size);
+
+/*
+ * Destroys a RAM disk. It cannot be mounted.
+ * Returns 0 if correct, -1 if it does not exist or -2 if it is mounted.
+ */
+int bramfree(char *deviceName);
+
+/****************/
+/* Block cache. */
+/****************/
+
+/*
+ * Sets the capacity in blocks (0 disables the cache) and the eviction
+ * policy (CACHE_LRU or CACHE_CLOCK) of the cache of the mounted device.
+ * While enabled, bwrite only updates the cached copy, which reaches the
+ * device on bflush, bumount or eviction.
+ * Cached blocks are written back and dropped first.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bsetcache(int blocks, int policy);
+
+/*
+ * Writes every dirty block of the cache back to the device and flushes
+ * the backend (msync for DEVICE_MMAP).
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bflush(void);
+
+/*
+ * Loads count blocks of the mounted device into the cache with a single
+ * backend request, so that the following reads of them are hits. Blocks
+ * already cached are skipped; at most half of the cache is filled.
+ * Does nothing if the device is not mounted or has no cache.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bprefetch(char *deviceName, int *blockNumbers, int count);
+
+/*
+ * Returns the address of the block inside the memory of the device, for
+ * zero-copy access, or NULL if it is not mounted with DEVICE_MMAP or DEVICE_RAM.
+ * bwrite of a block from its own address does not copy anything.
+ */
+char *bpeek(char *deviceName, int blockNumber);
+
+/*
+ * Sets the engine used for multi-block transfers of the DEVICE_FD backend:
+ * IO_SYNC or IO_URING (default). If io_uring is not available on the host
+ * kernel the device falls back to IO_SYNC. It applies to the next bmount.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bsetengine(int engine);
+
+/*
+ * Returns the engine in use on the mounted device.
+ */
+int bgetengine(void);
+
+/*
+ * Copies the block I/O counters into stats.
+ */
+void bgetstats(bstats_t *stats);
+
+/*
+ * Sets all the block I/O counters to zero.
+ */
+void bresetstats(void);
 
 
 /****************/
@@ -35,4 +172,23 @@ int bread(char *deviceName, int blockNumber, char *buffer);
  * Returns 0 if correct or -1 in case of error.
  */
 int bwrite(char *deviceName, int blockNumber, char*buffer);
+
+/*
+ * Reads count blocks from the device, blockNumbers[i] into buffers[i].
+ * Physically contiguous blocks are merged into a single vectored read,
+ * the reads of different runs are queued together with IO_URING,
+ * and cached blocks are served from the cache.
+ * Returns 0 if correct or -1 in case of error, including short
+ * read.
+ */
+int breadv(char *deviceName, int *blockNumbers, char **buffers, int count);
+
+/*
+ * Writes count blocks to the device, buffers[i] into blockNumbers[i].
+ * Physically contiguous blocks are merged into a single vectored write.
+ * Cached blocks are only updated in the cache, as bwrite does; the rest
+ * are written around it.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bwritev(char *deviceName, int *blockNumbers, char **buffers, int count);
 #endif
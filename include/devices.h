@@ -0,0 +1,36 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	devices.h
+ * @brief 	Operations table implemented by every device backend.
+ * @date	01/03/2017
+ */
+
+#ifndef _DEVICES_H_
+#define _DEVICES_H_
+
+#include "blocks_cache.h"
+
+/*
+ * Operations of a device backend. The block layer checks the bounds of
+ * every request against size() before calling read/write.
+ */
+typedef struct dev_ops{
+    char *name;                                             /* Name of the backend */
+    int (*open)(char *deviceName);                          /* Attaches the device, 0 or -1 */
+    int (*close)(void);                                     /* Detaches the device, 0 or -1 */
+    off_t (*size)(void);                                    /* Size of the device in bytes */
+    int (*read)(int *blockNumbers, char **buffers, int count);  /* Reads count blocks, 0 or -1 */
+    int (*write)(int *blockNumbers, char **buffers, int count); /* Writes count blocks, 0 or -1 */
+    int (*flush)(void);                                     /* Makes the writes durable, 0 or -1 */
+    char *(*peek)(int blockNumber);                         /* Address of the block or NULL */
+    int cached;                                             /* The block cache sits on top */
+} dev_ops_t;
+
+extern const dev_ops_t fileDevice;      /* DEVICE_FD */
+extern const dev_ops_t mmapDevice;      /* DEVICE_MMAP */
+extern const dev_ops_t ramDevice;       /* DEVICE_RAM */
+
+extern bstats_t devStats;               /* Block I/O counters, shared with the backends */
+
+#endif
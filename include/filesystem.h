@@ -11,14 +11,52 @@
 #ifndef _USER_H_
 #define _USER_H_
 
+#include <sys/uio.h>			// struct iovec
 #include "blocks_cache.h"	// Headers for block managing (read/write)
 
+/*
+ * Built with -DFS_THREADS, the default of the Makefile, the calls may come from several
+ * threads at once: readFileAt of the same file or of different files go on in parallel,
+ * the other calls on a file take turns and the ones that change the names take turns too.
+ */
+
 #define DEVICE_IMAGE "disk.dat"		// Device name
-#define MAX_FILE_SIZE 1048576			// Maximum file size, in bytes
+#define MAX_FILE_SIZE 1048576			// Former limit of the file size, kept as a reference size by the tests: the limit is sb.maxFileSize, set by mkFS
 #define FS_SEEK_CUR 0
 #define FS_SEEK_END 1
 #define FS_SEEK_BEGIN 2
 
+/* Entry points reported by fsGetStats */
+#define FS_OP_MKFS 0
+#define FS_OP_MOUNT 1
+#define FS_OP_UNMOUNT 2
+#define FS_OP_CREATE 3
+#define FS_OP_REMOVE 4
+#define FS_OP_OPEN 5
+#define FS_OP_CLOSE 6
+#define FS_OP_READ 7
+#define FS_OP_WRITE 8
+#define FS_OP_LSEEK 9
+#define FS_OP_MKDIR 10
+#define FS_OP_RMDIR 11
+#define FS_OP_READDIR 12
+#define FS_OP_COUNT 13
+#define FS_LATENCY_BUCKETS 32		// Bucket i counts calls that took [2^i, 2^(i+1)) ns
+
+/* Counters of one entry point */
+typedef struct{
+	unsigned long calls;						// Calls, failed ones included
+	unsigned long bytes;						// Bytes read or written
+	unsigned long blockReads;					// Blocks requested from the block layer
+	unsigned long blockWrites;					// Blocks handed to the block layer
+	unsigned long latency[FS_LATENCY_BUCKETS];	// Log2 histogram of the latency in ns
+} fs_op_stats_t;
+
+/* Counters of the file system, collected when built with -DFS_STATS */
+typedef struct fs_stats{
+	fs_op_stats_t op[FS_OP_COUNT];				// Indexed by FS_OP_*
+} fs_stats_t;
+
 
 /*
  * @brief 	Generates the proper file system structure in a storage device, as designed by the student.
@@ -31,12 +69,28 @@ int mkFS(long deviceSize);
  */
 int mountFS(void);
 
+/*
+ * @brief 	Selects the device and backend (DEVICE_FD, DEVICE_MMAP or DEVICE_RAM) used by
+ * 			mkFS and mountFS. The default is DEVICE_IMAGE with DEVICE_FD.
+ * @return 	0 if success, -1 otherwise.
+ */
+int setDevice(char *deviceName, int backend);
+
+/*
+ * @brief 	Mounts a file system in the simulated device using the given device backend
+ * 			(DEVICE_FD, DEVICE_MMAP or DEVICE_RAM).
+ * @return 	0 if success, -1 otherwise.
+ */
+int mountFSBackend(int backend);
+
 /*
  * @brief 	Unmounts the file system from the simulated device.
  * @return 	0 if success, -1 otherwise.
  */
 int unmountFS(void);
 
+/* Files and directories are named by their path from the root directory, components separated by '/' */
+
 /*
  * @brief	Creates a new file, provided it it doesn't exist in the file system.
  * @return	0 if success, -1 if the file already exists, -2 in case of error.
@@ -44,19 +98,22 @@ int unmountFS(void);
 int createFile(char *fileName);
 
 /*
- * @brief	Deletes a file, provided it exists in the file system.
+ * @brief	Deletes a file, provided it exists in the file system. Its descriptors are closed.
  * @return	0 if success, -1 if the file does not exist, -2 in case of error..
  */
 int removeFile(char *fileName);
 
 /*
- * @brief	Opens an existing file.
- * @return	The file descriptor if possible, -1 if file does not exist, -2 in case of error..
+ * @brief	Opens an existing file. Every open takes a descriptor of its own, with its seek pointer
+ * 			at the beginning of the file: a file may be open several times at once.
+ * @return	The file descriptor if possible, -1 if file does not exist, -2 in case of error or if
+ * 			the open file table is full..
  */
 int openFile(char *fileName);
 
 /*
- * @brief	Closes a file.
+ * @brief	Closes a descriptor of a file. The close of a descriptor that wrote makes the file
+ * 			durable; any other close writes nothing.
  * @return	0 if success, -1 otherwise.
  */
 int closeFile(int fileDescriptor);
@@ -73,12 +130,70 @@ int readFile(int fileDescriptor, void *buffer, int numBytes);
  */
 int writeFile(int fileDescriptor, void *buffer, int numBytes);
 
+/*
+ * @brief	Reads a number of bytes from a file, starting at offset, without moving its seek pointer.
+ * 			Counted with readFile in FS_OP_READ.
+ * @return	Number of bytes properly read, 0 from the end of the file on, -1 in case of error.
+ */
+int readFileAt(int fileDescriptor, void *buffer, int numBytes, long offset);
+
+/*
+ * @brief	Writes a number of bytes into a file, starting at offset, without moving its seek pointer.
+ * 			offset is at most the size of the file. An overwrite writes no metadata.
+ * 			Counted with writeFile in FS_OP_WRITE.
+ * @return	Number of bytes properly written, -1 in case of error.
+ */
+int writeFileAt(int fileDescriptor, void *buffer, int numBytes, long offset);
+
+/*
+ * @brief	Reads from the seek pointer of a file into the iovcnt buffers of iov, filled in order,
+ * 			as a single readFile of all their bytes. Counted with readFile in FS_OP_READ.
+ * @return	Number of bytes properly read, -1 in case of error.
+ */
+int readFileV(int fileDescriptor, const struct iovec *iov, int iovcnt);
+
+/*
+ * @brief	Writes the iovcnt buffers of iov, in order, from the seek pointer of a file, as a single
+ * 			writeFile of all their bytes. Counted with writeFile in FS_OP_WRITE.
+ * @return	Number of bytes properly written, -1 in case of error.
+ */
+int writeFileV(int fileDescriptor, const struct iovec *iov, int iovcnt);
+
 /*
  * @brief	Modifies the position of the seek pointer of a file.
  * @return	0 if succes, -1 otherwise.
  */
 int lseekFile(int fileDescriptor, long offset, int whence);
 
+/*
+ * @brief	Creates a new directory, provided it doesn't exist in the file system.
+ * @return	0 if success, -1 if the directory already exists, -2 in case of error.
+ */
+int makeDir(char *dirName);
+
+/*
+ * @brief	Deletes a directory, provided it exists and is empty.
+ * @return	0 if success, -1 if the directory does not exist or is not empty, -2 in case of error.
+ */
+int removeDir(char *dirName);
+
+/*
+ * @brief	Gets the entry of a directory that follows name in alphabetical order, the first one if name is "".
+ * @return	1 if name holds the next entry, 0 if there are no more, -1 in case of error.
+ */
+int readDir(char *dirName, char *name);
+
+/*
+ * @brief 	Copies the counters of every entry point into stats.
+ * @return 	0 if success, -1 if the file system was built without FS_STATS (stats is zeroed).
+ */
+int fsGetStats(struct fs_stats *stats);
+
+/*
+ * @brief 	Sets all the counters of fsGetStats to zero.
+ */
+void fsResetStats(void);
+
 /*
  * @brief 	Verifies the integrity of the file system metadata.
  * @return 	0 if the file system is correct, -1 if the file system is corrupted, -2 in case of error.
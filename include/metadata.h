@@ -5,19 +5,28 @@
  * @brief 	Definition of the structures and data types of the file system.
  * @date	01/03/2017
  */
-#define SIZE_OF_BLOCK 1024 * 2      /* The file system block size will be 2048 bytes */
-#define INODE_MAX_NUMBER 40         /* Maximum number of i-nodes in the device */
-#define MAX_SIZE_FILE 1024 * 1024   /* Maximum file size in bytes */
+#define SIZE_OF_BLOCK (1024 * 2)    /* The file system block size will be 2048 bytes */
+#define FS_VERSION 5                /* Revision of the format: inodes without the state of the open files */
+#define INODE_MIN_NUMBER 40         /* Fewest i-nodes of a device */
+#define INODE_MAX_NUMBER (1 << 22)  /* Most i-nodes of a device */
+#define BYTES_PER_INODE (16 * 1024) /* Device bytes per i-node made by mkFS */
 #define NAME_MAX 32                 /* NF2 The maximum length of the file name will be 32 characters */
-#define MAX_BLOCK_PER_FILE 512      /* Maximum number of blocks per file */
-#define IMAP_SIZE (INODE_MAX_NUMBER / 8) /* Maximum number of imap entries */
-#define BMAP_SIZE ( (((MAX_FILE_SYSTEM_SIZE) / (SIZE_OF_BLOCK)) -1)  / 8) /* Maximum number of bmap entries */
+#define RA_MIN_BLOCKS 4             /* Readahead window when sequential access starts */
+#define RA_MAX_BLOCKS 32            /* Largest readahead window */
+#define DELAY_MAX_BLOCKS 64         /* Blocks an open file writes to memory before they take device blocks */
+#define INODE_LOCKS 1024            /* Locks of the inodes with FS_THREADS: inode i takes lock i % INODE_LOCKS */
+#define FILE_TABLE_SIZE 1024        /* Descriptors of the open file table, files open at once */
+#define JOURNAL_MIN_BLOCKS 6        /* Smallest journal: a descriptor and the blocks of a create */
+#define JOURNAL_MAX_BLOCKS 64       /* Largest journal, in blocks */
+#define JOURNAL_BATCH 8             /* Operations grouped in a journal commit */
+#define JOURNAL_MAGIC 0x4A524E4C    /* Magic number of a journal descriptor */
+#define MAP_BITS_PER_BLOCK ((SIZE_OF_BLOCK) * 8) /* Bits of a map held by one block */
 
 /* Variables used in mkFS for validating the size of the device */
 #define MIN_FILE_SYSTEM_SIZE 50 * 1024    /* Minimum file system size */
-#define MAX_FILE_SYSTEM_SIZE 10 * 1024 * 1024 /* Maximum file system size */
+#define MAX_FILE_SYSTEM_SIZE ((long long) (SIZE_OF_BLOCK) << 31) /* Maximum file system size: blocks are int in memory */
 
-#define bitmap_getbit(bitmap_, i_) (bitmap_[i_ >> 3] & (1 << (i_ & 0x07)))
+#define bitmap_getbit(bitmap_, i_) ((bitmap_)[(i_) >> 3] & (1 << ((i_) & 0x07)))
 static inline void bitmap_setbit(char *bitmap_, int i_, int val_) {
   if (val_)
     bitmap_[(i_ >> 3)] |= (1 << (i_ & 0x07));
@@ -27,49 +36,105 @@ static inline void bitmap_setbit(char *bitmap_, int i_, int val_) {
 
 /**  Unsigned Short range: 0 to 65,535
  *   Unsigned Int range: 0 to 4,294,967,295
+ *   Unsigned Long Long range: 0 to 18,446,744,073,709,551,615 (block addresses)
  */
 
 /*
  * Size of superblock_t:
- * shorts: 5
- * Ints: 2
- * Chars: IMAP_SIZE + BMAP_SIZE
+ * shorts: 2
+ * Ints: 3
+ * Long longs: 15
  */
-#define SUPERBLOCK_SIZE (5 * 2) + (2 * 4) + (IMAP_SIZE) + (BMAP_SIZE)
+#define SUPERBLOCK_SIZE (2 * 2) + (3 * 4) + (15 * 8)
 #define SUPERBLOCK_PADDING (SIZE_OF_BLOCK) - (SUPERBLOCK_SIZE) /* Padding size for the superblock */
 
+/*
+ * Layout of the device: block 0 unused, the superblock, the inode table,
+ * the journal, the inode map, the block map and the data blocks.
+ */
 typedef struct{
     unsigned short magicNum;              /* Magic number of the superblock */
-    unsigned short numInodes;             /* Number of i-nodes in the device */
-    unsigned short firstInode;            /* Number of the 1st i-node in the device */
-    unsigned int dataBlockNum;            /* Number of data blocks in the device */
-    unsigned short firstDataBlock;        /* Number of the 1st data block */
-    unsigned int deviceSize;              /* Total disk space in bytes */
-    unsigned short inodesBlocks;          /* Number of blocks for the inodes */
-    char i_map [IMAP_SIZE];               /* inode map */
-    char b_map [BMAP_SIZE];               /* block map */
+    unsigned short version;               /* Revision of the format, FS_VERSION */
+    unsigned int numInodes;               /* Number of i-nodes in the device */
+    unsigned long long deviceSize;        /* Total disk space in bytes */
+    unsigned long long maxFileSize;       /* Largest file in bytes */
+    unsigned long long firstInode;        /* Number of the 1st i-node block */
+    unsigned long long inodesBlocks;      /* Number of blocks for the inodes */
+    unsigned long long journalStart;      /* Number of the 1st block of the journal */
+    unsigned long long journalBlocks;     /* Number of blocks for the journal */
+    unsigned long long imapStart;         /* Number of the 1st block of the inode map */
+    unsigned long long imapBlocks;        /* Number of blocks for the inode map */
+    unsigned long long bmapStart;         /* Number of the 1st block of the block map */
+    unsigned long long bmapBlocks;        /* Number of blocks for the block map */
+    unsigned long long firstDataBlock;    /* Number of the 1st data block */
+    unsigned long long dataBlockNum;      /* Number of data blocks in the device */
+    unsigned long long freeBlocks;        /* Free bits of the block map */
+    unsigned long long rootDir;           /* Root node of the entries of the root directory, 0 if empty */
+    unsigned long long rootEntries;       /* Number of entries of the root directory */
+    unsigned int freeInodes;              /* Free bits of the inode map */
+    unsigned int journalSeq;              /* Sequence number of the 1st transaction to replay */
     char padding[SUPERBLOCK_PADDING];     /* Padding field for fulfilling a block */
 } superblock_t;
 
 /*
- * Size of inode_t:
- * shorts: 2
+ * Size of extent_t:
  * Ints: 2
+ * Long longs: 1
+ */
+#define EXTENT_SIZE (2 * 4) + (1 * 8)      /* Size of an extent in bytes */
+#define EXTENT_INLINE 4                    /* Extents stored in the inode itself */
+#define EXTENT_MAX_DEPTH 5                 /* Most levels of the extent tree of a file */
+#define INODE_INLINE_SIZE (EXTENT_INLINE) * (EXTENT_SIZE) /* Files up to this size are stored in the inode, in place of the extents */
+
+/*
+ * Run of blocks of a file that are also contiguous in the device. In an index
+ * node of the extent tree it points to a child node instead: fileBlock is the
+ * first block of the file under the child, length the number of entries of
+ * the child and start its device block.
+ */
+typedef struct{
+    unsigned int fileBlock;             /* First block of the file in the run */
+    unsigned int length;                /* Number of blocks of the run */
+    unsigned long long start;           /* Device block of fileBlock */
+} extent_t;
+
+/*
+ * Size of inode_t:
+ * shorts: 4
+ * Long longs: 2
+ * Extents: EXTENT_INLINE
  * Chars: NAME_MAX
  */
-  #define INODE_SIZE (2 * 2) + (2 * 4) + (NAME_MAX)  /* Size of an inode in bytes */
+  #define INODE_SIZE (4 * 2) + (2 * 8) + (EXTENT_INLINE * (EXTENT_SIZE)) + (NAME_MAX)  /* Size of an inode in bytes */
+
+#define INODE_FILE 0                    /* Type of the inode of a file */
+#define INODE_DIR 1                     /* Type of the inode of a directory */
 
 typedef struct{
-    char name[NAME_MAX];                /* file name */
-    unsigned int size;                  /* Current file size in Bytes */
-    unsigned int indirectBlock;         /* Indirect block number */
-    unsigned short opened;              /* To know if a file is opened or closed */
-    unsigned short ptr;
+    char name[NAME_MAX];                /* file name, the last component of its path */
+    unsigned long long size;            /* Current file size in Bytes, number of entries of a directory */
+    unsigned long long indirectBlock;   /* Root node of the extent tree when depth is not 0, root node of the entries of a directory */
+    unsigned short extents;             /* Number of extents in the inode, or of entries of the root node */
+    unsigned short depth;               /* 0: extents inline, otherwise levels of the extent tree, 1 when the root is a leaf */
+    unsigned short type;                /* INODE_FILE or INODE_DIR */
+    unsigned short reserved;            /* Keeps the extents aligned */
+    union{
+        extent_t extent[EXTENT_INLINE]; /* Extents of the file sorted by fileBlock, when depth is 0 */
+        char data[INODE_INLINE_SIZE];   /* Contents of a file of up to INODE_INLINE_SIZE bytes */
+    };
 } inode_t;
 
+/*
+ * Size of extent_block_t:
+ * EXTENT_PER_BLOCK * EXTENT_SIZE
+ */
+#define EXTENT_PER_BLOCK (int) ( (SIZE_OF_BLOCK) / (EXTENT_SIZE)) /* Amount of extents which fit in a block */
+#define EXTENT_BLOCK_PADDING (SIZE_OF_BLOCK) - (EXTENT_PER_BLOCK) * (EXTENT_SIZE) /* Padding size for the extent_block_t */
+
 typedef struct{
-    unsigned int pos[512];                /* Max file indexes of blocks */
-} index_file_t;
+    extent_t extentArray [EXTENT_PER_BLOCK]; /* Extents of a leaf or entries of an index node, sorted by fileBlock */
+    char padding[EXTENT_BLOCK_PADDING];  /* Padding field for fulfilling a block */
+} extent_block_t;
 
 /*
  * Size of inode_block_t:
@@ -83,3 +148,90 @@ typedef struct{
     inode_t inodeArray [INODE_PER_BLOCK]; /* Inode array */
     char padding[INODE_BLOCK_PADDING];    /* Padding field for fulfilling a block */
 } inode_block_t;
+
+/*
+ * Size of dir_entry_t:
+ * Chars: NAME_MAX
+ * Long longs: 1
+ */
+#define DIR_ENTRY_SIZE (NAME_MAX) + (1 * 8)   /* Size of a directory entry in bytes */
+#define DIR_NODE_HEADER (2 * 2) + (1 * 4) + (1 * 8) /* Size of the fields of dir_node_t before the entries */
+
+/* Entry of a directory node: a name and the inode it names, or the first name under a child node */
+typedef struct{
+    char name[NAME_MAX];                /* name, padded with zeros */
+    unsigned long long target;          /* Inode in a leaf, block of the child node otherwise */
+} dir_entry_t;
+
+/*
+ * Size of dir_node_t:
+ * DIR_NODE_HEADER + DIR_NODE_MAX * DIR_ENTRY_SIZE
+ */
+#define DIR_NODE_MAX (int) (((SIZE_OF_BLOCK) - (DIR_NODE_HEADER)) / (DIR_ENTRY_SIZE)) /* Entries which fit in a node */
+#define DIR_NODE_PADDING (SIZE_OF_BLOCK) - (DIR_NODE_HEADER) - (DIR_NODE_MAX) * (DIR_ENTRY_SIZE) /* Padding size for the dir_node_t */
+
+/* Node of the B+tree of the entries of a directory, sorted by name */
+typedef struct{
+    unsigned short level;               /* 0 for a leaf, one more than its children otherwise */
+    unsigned short count;               /* Entries in use */
+    unsigned int reserved;              /* Keeps next aligned */
+    unsigned long long next;            /* Next leaf in order of name, 0 for the last one and the inner nodes */
+    dir_entry_t entry[DIR_NODE_MAX];    /* Entries sorted by name */
+    char padding[DIR_NODE_PADDING];     /* Padding field for fulfilling a block */
+} dir_node_t;
+
+/*
+ * Size of journal_desc_t:
+ * Ints: 4
+ * Long longs: JOURNAL_DESC_MAX
+ */
+#define JOURNAL_DESC_MAX (int) (((SIZE_OF_BLOCK) - (4 * 4)) / 8) /* Blocks logged by a transaction at most */
+
+/* First block of a transaction of the journal, followed by the blocks it logs */
+typedef struct{
+    unsigned int magic;                   /* JOURNAL_MAGIC */
+    unsigned int seq;                     /* Sequence number of the transaction */
+    unsigned int count;                   /* Number of blocks logged after the descriptor */
+    unsigned int crc;                     /* CRC32 of the blocks logged and of home */
+    unsigned long long home[JOURNAL_DESC_MAX]; /* Device block where each logged block belongs */
+} journal_desc_t;
+
+/*
+ * In-memory state of a file while it is open, shared by all its descriptors. It is not stored in the device.
+ */
+typedef struct{
+    int opens;                          /* Descriptors of the open file table on the file */
+    extent_block_t *extentCache;        /* Root node of the extent tree, read once per open; NULL until then */
+    int extentDirty;                    /* extentCache changed since it was written */
+    char *delayed;                      /* Blocks written after the last extent, without device blocks yet; NULL if none */
+    int delayedBlocks;                  /* Blocks held by delayed */
+    long delayedSize;                   /* Size of the file counting delayed, which inode->size does not */
+    int delayedKept;                    /* Blocks of delayedTotal kept for delayed and the extent nodes that will map it */
+} file_state_t;
+
+#define FILE_WRITTEN 1                  /* The descriptor wrote the file: its close makes the writes durable */
+
+/*
+ * Descriptor of the open file table, one per openFile: each open has its own seek
+ * pointer, readahead window and last extent, so that the blocks the reads stay in
+ * are mapped without walking the extent tree. It is not stored in the device.
+ */
+typedef struct{
+    int inode;                          /* Inode of the file, -1 if the descriptor is free */
+    int flags;                          /* FILE_WRITTEN */
+    long ptr;                           /* Seek pointer */
+    extent_t extentHint;                /* Extent of the last block looked up, length 0 if none */
+    long raNext;                        /* Offset where the next sequential read starts */
+    int raWindow;                       /* Blocks prefetched ahead of the reader, 0 if not sequential */
+    int raEnd;                          /* First file block not prefetched yet */
+} open_file_t;
+
+/*
+ * Directory node changed since the last checkpoint. It is not stored in the device:
+ * the journal logs it and the checkpoint writes it home.
+ */
+typedef struct{
+    int block;                          /* Device block of the node */
+    int flags;                          /* META_DIRTY and META_LOGGED */
+    dir_node_t node;                    /* Contents of the node */
+} dir_buffer_t;
@@ -0,0 +1,50 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	uring.h
+ * @brief 	Headers of the io_uring engine used by blocks_cache.c to queue block transfers.
+ * @date	01/03/2017
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define URING_DEPTH 64      /* Maximum transfers in flight */
+
+/*
+ * Sets up a ring for transfers on the descriptor fd.
+ * Returns 0 if correct or -1 if io_uring is not available on this kernel.
+ */
+int uringInit(int fd);
+
+/*
+ * Tears down the ring. Queued transfers must have been submitted.
+ */
+void uringExit(void);
+
+/*
+ * Returns 1 if the ring is set up and 0 otherwise.
+ */
+int uringReady(void);
+
+/*
+ * Queues a vectored transfer of the buffers of iov to consecutive positions
+ * of the device starting at offset. iov must stay valid until uringSubmit.
+ * Returns the number of the transfer in the batch or -1 if the ring is full.
+ */
+int uringQueue(off_t offset, struct iovec *iov, int count, int writing);
+
+/*
+ * Submits the queued transfers and waits for all of them. failed[i] is set
+ * to 1 for every transfer i of the batch that failed, was short or could not
+ * be submitted, so that the caller can redo it synchronously, and to 0
+ * otherwise. It returns once the kernel is done with every buffer queued, or
+ * once the ring fails while waiting, which tears it down (see uringReady).
+ * Returns the number of system calls issued.
+ */
+int uringSubmit(char *failed);
+
+#endif
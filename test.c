@@ -10,6 +10,7 @@
 #include <string.h>
 #include "include/filesystem.h"
 #include "filesystem.c"
+#include "include/devices.h"
 
 
 // Color definitions for asserts
@@ -20,6 +21,13 @@
 
 #define N_BLOCKS	25						// Number of blocks in the device
 #define DEV_SIZE 	N_BLOCKS * BLOCK_SIZE	// Device size, in bytes
+#define RA_FILE_SIZE	10 * BLOCK_SIZE			// Size of the file read by the readahead tests
+#define SCALE_IMAGE	"scale.dat"				// Sparse image of the scale tests
+#define SCALE_SIZE	(64L * 1024 * 1024)		// Size of the scale image, in bytes
+#define SCALE_FILES	2000					// Files created by the scale tests
+#define THREADS		4						// Threads of the concurrency tests
+#define THREAD_FILE_SIZE	(20 * BLOCK_SIZE)	// Size of the files read by the concurrency tests
+#define THREAD_ROUNDS	200					// Calls of every thread of the concurrency tests
 
 /* mkFS tests */
 int test_mkFS();
@@ -30,12 +38,126 @@ int cmpDisk (int startPoint, int blocks, char * structToComp);
 /* mountFS tests */
 int test_mountFS();
 
+/* block cache tests */
+int test_cache();
+int checkCacheHit();
+int checkCacheWriteBack();
+int checkCacheEviction();
+int rawRead(int block, char *buf);
+
+/* vectored block I/O tests */
+int test_vector();
+int checkVectorRuns();
+
 /* unmountFS tests */
 int test_unmountFS();
 int checkUnmountFS();
 
 int testOutput(int ret, char * msg);
 
+/* mmap backend tests */
+int test_mmap();
+int checkMmapInodes();
+int checkMmapSync();
+
+/* readahead tests */
+int test_readahead();
+int checkReadaheadSeq();
+int checkReadaheadRandom();
+int checkReadaheadSpan();
+
+/* fsGetStats tests */
+int test_stats();
+int checkStatsCounts();
+int checkStatsHistogram();
+
+/* name index tests */
+int test_nameIndex();
+int checkNameIndexLookup();
+int checkNameIndexRemount();
+
+/* allocator tests */
+int test_alloc();
+int checkAllocRuns();
+int checkAllocFull();
+
+/*** Tests of extents ***/
+int test_extent();
+int checkExtentInline();
+int checkExtentBlock();
+int checkExtentCache();
+
+/*** Tests of metadata sync ***/
+int test_dirty();
+int checkDirtyRead();
+int checkDirtyWrite();
+
+/*** Tests of the journal ***/
+int test_journal();
+int checkJournalBatch();
+int checkJournalReplay();
+int checkJournalTorn();
+int checkJournalCrash();
+
+/* RAM disk backend tests */
+int test_ramdisk();
+int checkRamPersist();
+int checkRamBusy();
+
+/*** Tests of the format sized by mkFS ***/
+int test_scale();
+int checkScaleFormat();
+int checkScaleFiles();
+int checkScaleBigFile();
+int checkScaleExtentTree();
+int checkScaleDir();
+
+/* directory tests */
+int test_dir();
+int checkDirCreate();
+int checkDirList();
+int checkDirRemount();
+int checkDirRemove();
+
+/*** Tests of writes from the seek pointer ***/
+int test_overwrite();
+int checkOverwriteInPlace();
+int checkOverwriteAppend();
+
+/*** Tests of delayed allocation ***/
+int test_delay();
+int checkDelayInterleave();
+int checkDelayRemove();
+int checkDelayFull();
+
+/*** Tests of the reads and writes at an offset ***/
+int test_positional();
+int checkReadAt();
+int checkWriteAt();
+int checkWriteV();
+int checkReadV();
+
+/*** Tests of the open file table ***/
+int test_open();
+int checkOpenShared();
+int checkOpenClose();
+int checkOpenWriter();
+int checkOpenFull();
+
+/*** Tests of the calls from several threads ***/
+#ifdef FS_THREADS
+#include <pthread.h>
+int test_threads();
+int checkThreadsRead();
+int checkThreadsSeek();
+int checkThreadsWrite();
+#endif
+
+/* inline data tests */
+int test_inline();
+int checkInlineSmall();
+int checkInlinePromote();
+
 /* createFile tests */
 int test_createFile();
 int checkCreateFile();
@@ -142,13 +264,13 @@ int checkCreateFile(){
 	if(inodeList[0].inodeArray[0].size != 0){ /* check number of blocks for the inode map */
 		return -1;
 	}
-	if(inodeList[0].inodeArray[0].indirectBlock != sb.firstDataBlock){ /* check number of blocks for the data map */
+	if(inodeList[0].inodeArray[0].extents != 0 || inodeList[0].inodeArray[0].indirectBlock != 0){ /* check that no block is taken before a write */
 		return -1;
 	}
-	if(inodeList -> inodeArray[0].opened != 0){ /* check file created is closed */
+	if(fileState[0].opens != 0){ /* check file created is closed */
 		return -1;
 	}
-	if(sb.i_map[0] != 1){
+	if(inodeMap[0] != 1){
 		return -1;
 	}
 	return 0;
@@ -188,10 +310,9 @@ int checkMaxFiles(){
 	if(unmountFS() < 0){
 		return -1; /* Error in the unmount */
 	}
-	for(int i = 0; i < INODE_MAX_NUMBER; i++){
-		char aux = i + '0';
-		char name [10];
-		strcpy(name, &aux);
+	for(int i = 0; i < sb.numInodes; i++){
+		char name [12];
+		sprintf(name, "%d", i);
 		if(createFile(name) < 0) { /* create all the files */
 			return -1; /* error before arriving to the maximum number of files */
 		}
@@ -219,10 +340,10 @@ int checkRemoveFile(){
 	if(inodeList[0].inodeArray[0].indirectBlock == 44){ /* check number of blocks for the data map */
 		return -1;
 	}
-	if(inodeList[0].inodeArray[0].opened != 0){ /* check number of blocks for the data map */
+	if(fileState[0].opens != 0){ /* check number of blocks for the data map */
 		return -1;
 	}
-	if(sb.i_map[0] != 0){
+	if(inodeMap[0] != 0){
 		return -1;
 	}
 	return 0;
@@ -289,7 +410,7 @@ int test_closeFile(){
  * @return 0 if all the tests are correct and -1 otherwise
  */
 int checkCloseFile(){
-	if(inodeList[0].inodeArray[0].opened != 0){ /* check the file is closed */
+	if(fileState[0].opens != 0){ /* check the file is closed */
 		return -1;
 	}
 	
@@ -403,7 +524,7 @@ int test_read(){
 	char  buf [1049287];
 	unmountFS();
 	createFile("quijote.txt");
-	writeFile(0,"#INIT#Por cuanto por parte de vos, Miguel de Cervantes, nos fue fecha relación\n"
+	char *quijote = "#INIT#Por cuanto por parte de vos, Miguel de Cervantes, nos fue fecha relación\n"
                 "que habíades compuesto un libro intitulado El ingenioso hidalgo de la\n"
                 "Mancha, el cual os había costado mucho trabajo y era muy útil y provechoso,\n"
                 "nos pedistes y suplicastes os mandásemos dar licencia y facultad para le\n"
@@ -445,8 +566,10 @@ int test_read(){
                 "premáticas destos nuestros reinos. Y mandamos a los del nuestro Consejo, y\n"
                 "a otras cualesquier justicias dellos, guarden y cumplan esta nuestra cédula\n"
                 "y lo en ella contenido. Fecha en Valladolid, a veinte y seis días del mes\n"
-                "de setiembre de mil y seiscientos y cuatro años.#FINAL#",3315);
-	if(testOutput(readFile(0, buf, 3000), "readFile") < 0) {return -1;}
+                "de setiembre de mil y seiscientos y cuatro años.#FINAL#";
+	int fd = openFile("quijote.txt");
+	writeFile(fd, quijote, strlen(quijote));
+	if(testOutput(readFile(fd, buf, 3000), "readFile") < 0) {return -1;}
 	return 0;
 }
 
@@ -460,10 +583,11 @@ int checkMakeFS(){
 	if(sb.magicNum != 1){ /* check magic number */
 		return -1;
 	}
-	if(sb.numInodes != INODE_MAX_NUMBER){ /* check number of inodes */
+	if(sb.version != FS_VERSION){ /* check the revision of the format */
 		return -1;
 	}
-	if(sb.dataBlockNum != needed_blocks(DEV_SIZE, 'B')){ /* check the number of data blocks */
+	/* check number of inodes: the fewest for a small device, filling the inode blocks */
+	if(sb.numInodes < INODE_MIN_NUMBER || sb.numInodes != sb.inodesBlocks * INODE_PER_BLOCK){
 		return -1;
 	}
 	if(sb.deviceSize != DEV_SIZE){ /* check the size of the File System */
@@ -472,14 +596,26 @@ int checkMakeFS(){
 	if(sb.firstInode != ( 2 )){ /* check the correct position of the first inode */
 		return -1;
 	}
-	if(sb.inodesBlocks != (int) ((INODE_MAX_NUMBER / INODE_PER_BLOCK)+1)){
+	if(sb.inodesBlocks != (int) ((INODE_MIN_NUMBER / INODE_PER_BLOCK)+1)){
+		return -1;
+	}
+	if(sb.journalStart != ( sb.firstInode + sb.inodesBlocks ) || sb.journalBlocks < JOURNAL_MIN_BLOCKS){ /* check the journal after the inodes */
+		return -1;
+	}
+	if(sb.imapStart != ( sb.journalStart + sb.journalBlocks ) || sb.bmapStart != ( sb.imapStart + sb.imapBlocks )){ /* check the maps after the journal */
 		return -1;
 	}
-	if(sb.firstDataBlock != ( sb.firstInode + sb.inodesBlocks )){ /* check the correct position of the first data block */
+	if(sb.firstDataBlock != ( sb.bmapStart + sb.bmapBlocks )){ /* check the correct position of the first data block */
+		return -1;
+	}
+	if(sb.dataBlockNum != needed_blocks(DEV_SIZE, 'B') - sb.firstDataBlock){ /* check the number of data blocks */
+		return -1;
+	}
+	if(sb.freeInodes != sb.numInodes || sb.freeBlocks != sb.dataBlockNum){ /* check the free counts */
 		return -1;
 	}
 	for(int i = 0; i < sb.numInodes; i++){
-		if(sb.i_map[i] != 0 || sb.b_map[i] != 0){
+		if(inodeMap[i] != 0 || blockMap[i] != 0){
 			return -1;
 		}
 	}
@@ -498,7 +634,7 @@ int checkSyncFS(){
 
 	/* compare the inodes with the ones at the disk */
 	for(int i = 0; i < sb.inodesBlocks; i++){
-		if(cmpDisk(i + sb.firstInode, SIZE_OF_BLOCK , (char*) (&inodeList)) < 0){ return -1;}
+		if(cmpDisk(i + sb.firstInode, SIZE_OF_BLOCK , (char*) (&inodeList[i])) < 0){ return -1;}
 	}
 
 	return 0;
@@ -520,12 +656,9 @@ int cmpDisk (int startPoint, int blocks, char * structToComp){
         printf("Error in bread (mountFS)\n");
         return -1;
     }
-    char * checkBuf = malloc(sizeof(char) * blocks); /* auxiliary buffer */
-    for(int i = 0; i < SIZE_OF_BLOCK; i++){
-		checkBuf[i] = structToComp[i];
-    }
-	checkBuf[SIZE_OF_BLOCK] = '\0';
-    if(strcmp(deviceBuf, checkBuf) != 0){ return -1;} /* the first blocks are different */
+    int ret = memcmp(deviceBuf, structToComp, blocks); /* compare the blocks */
+    free(deviceBuf);
+    if(ret != 0){ return -1;} /* the first blocks are different */
     return 0;
 }
 
@@ -545,6 +678,147 @@ int test_mountFS(){
 	return 0;
 }
 
+/**
+ * Test all the funtionalities of the block cache of the mounted device
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_cache(){
+	/* Repeated reads are served from memory */
+	if(testOutput(checkCacheHit(), "checkCacheHit") < 0) {return -1;}
+	/* Writes reach the device only when flushed */
+	if(testOutput(checkCacheWriteBack(), "checkCacheWriteBack") < 0) {return -1;}
+	/* A full cache evicts blocks with both policies */
+	if(testOutput(checkCacheEviction(), "checkCacheEviction") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks that a block read twice is only read once from the device
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkCacheHit(){
+	char buf[BLOCK_SIZE];
+	bstats_t st;
+	bresetstats();
+	if(bread(DEVICE_IMAGE, 1, buf) < 0 || bread(DEVICE_IMAGE, 1, buf) < 0){ return -1;}
+	bgetstats(&st);
+	if(st.hits < 1 || st.syscalls > 1){ return -1;}
+	if(memcmp(buf, &sb, BLOCK_SIZE) != 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Reads a block of the device image bypassing the block layer
+ *
+ * @return 0 if success and -1 otherwise
+ */
+int rawRead(int block, char *buf){
+	int fd = open(DEVICE_IMAGE, O_RDONLY);
+	if(fd < 0){ return -1;}
+	int ret = pread(fd, buf, BLOCK_SIZE, (off_t) block * BLOCK_SIZE);
+	close(fd);
+	return ret == BLOCK_SIZE ? 0 : -1;
+}
+
+/**
+ * Checks that a written block stays in the cache until it is flushed
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkCacheWriteBack(){
+	char old[BLOCK_SIZE], buf[BLOCK_SIZE], raw[BLOCK_SIZE];
+	int block = N_BLOCKS - 1;
+	if(bread(DEVICE_IMAGE, block, old) < 0){ return -1;}
+	memcpy(buf, old, BLOCK_SIZE);
+	buf[0] = ~buf[0];
+	if(bwrite(DEVICE_IMAGE, block, buf) < 0){ return -1;}
+	/* the device still holds the old contents */
+	if(rawRead(block, raw) < 0 || memcmp(raw, old, BLOCK_SIZE) != 0){ return -1;}
+	if(bflush() < 0){ return -1;}
+	if(rawRead(block, raw) < 0 || memcmp(raw, buf, BLOCK_SIZE) != 0){ return -1;}
+	/* restore the block */
+	if(bwrite(DEVICE_IMAGE, block, old) < 0 || bflush() < 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks the eviction of blocks with a cache smaller than the working set
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkCacheEviction(){
+	char buf[BLOCK_SIZE];
+	bstats_t st;
+	int policies[2] = {CACHE_LRU, CACHE_CLOCK};
+	for(int p = 0; p < 2; p++){
+		if(bsetcache(2, policies[p]) < 0){ return -1;}
+		bresetstats();
+		for(int i = 0; i < 4; i++){
+			if(bread(DEVICE_IMAGE, i, buf) < 0){ return -1;}
+		}
+		/* the last block read is still cached */
+		if(bread(DEVICE_IMAGE, 3, buf) < 0){ return -1;}
+		bgetstats(&st);
+		if(st.evictions != 2 || st.misses != 4 || st.hits != 1){ return -1;}
+	}
+	return bsetcache(CACHE_DEFAULT_BLOCKS, CACHE_LRU);
+}
+
+/**
+ * Test all the funtionalities of the vectored block I/O
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_vector(){
+	/* Contiguous blocks move in a single call per run */
+	if(testOutput(checkVectorRuns(), "checkVectorRuns") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks that breadv/bwritev merge contiguous blocks and split the rest,
+ * queueing the runs of a request together with io_uring
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkVectorRuns(){
+	char old[4][BLOCK_SIZE], data[4][BLOCK_SIZE], check[4][BLOCK_SIZE];
+	char *oldBufs[4], *dataBufs[4], *checkBufs[4];
+	/* two runs: three contiguous blocks and a separate one */
+	int blocks[4] = {N_BLOCKS - 5, N_BLOCKS - 4, N_BLOCKS - 3, N_BLOCKS - 1};
+	bstats_t st;
+	int ret = 0;
+
+	for(int i = 0; i < 4; i++){
+		oldBufs[i] = old[i];
+		dataBufs[i] = data[i];
+		checkBufs[i] = check[i];
+		memset(data[i], 'a' + i, BLOCK_SIZE);
+	}
+	if(bsetcache(0, CACHE_LRU) < 0){ return -1;}
+	if(breadv(DEVICE_IMAGE, blocks, oldBufs, 4) < 0){ return -1;}
+
+	bresetstats();
+	if(bwritev(DEVICE_IMAGE, blocks, dataBufs, 4) < 0){ ret = -1;}
+	if(breadv(DEVICE_IMAGE, blocks, checkBufs, 4) < 0){ ret = -1;}
+	bgetstats(&st);
+	/* one call per run, or one submission per request with io_uring */
+	if(bgetengine() == IO_URING && (st.syscalls != 2 || st.queued != 4)){ ret = -1;}
+	if(bgetengine() == IO_SYNC && st.syscalls != 4){ ret = -1;}
+	if(memcmp(data, check, sizeof(data)) != 0){ ret = -1;}
+
+	/* restore the blocks */
+	if(bwritev(DEVICE_IMAGE, blocks, oldBufs, 4) < 0){ ret = -1;}
+	if(bsetcache(CACHE_DEFAULT_BLOCKS, CACHE_LRU) < 0){ ret = -1;}
+	return ret;
+}
+
 /**
  * Test all the funtionalities of the method unmountFS
  *
@@ -562,90 +836,1911 @@ int test_unmountFS(){
 }
 
 /**
- * Checks that the file system has been correctly unmount from the simulated device
+ * Test all the funtionalities of the mmap device backend
  *
  * @return 0 if all the tests are correct and -1 otherwise
  */
-int checkUnmountFS(){
-	/* check if the inode map is empty */
-	if(strcmp(sb.i_map, "") != 0){ return -1;}
+int test_mmap(){
+	/* Normal execution of mountFSBackend */
+	if(testOutput(mountFSBackend(DEVICE_MMAP), "mountFSBackend") < 0) {return -1;}
+	/* The inode list is a copy of the mapping */
+	if(testOutput(checkMmapInodes(), "checkMmapInodes") < 0) {return -1;}
+	/* Metadata updates reach the device image at the checkpoint */
+	if(testOutput(checkMmapSync(), "checkMmapSync") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (mmap)") < 0) {return -1;}
 
-	/* check if the inode map is empty */
-	if(strcmp(sb.b_map, "") != 0){ return -1;}
+	printf("\n");
+	return 0;
+}
 
-	int count = 0;
+/**
+ * Checks that the inode list is not the mapping and matches the disk
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkMmapInodes(){
+	if((char *) inodeList == bpeek(DEVICE_IMAGE, sb.firstInode)){ return -1;}
+	for(int i = 0; i < sb.inodesBlocks; i++){
+		inodeAt(i * INODE_PER_BLOCK);
+		if(cmpDisk(i + sb.firstInode, SIZE_OF_BLOCK , (char*) (&inodeList[i])) < 0){ return -1;}
+	}
+	return 0;
+}
 
-	/* check if the inodes are empty */
-	for(int i = 0; i < sb.inodesBlocks; i++){ /* check all the blocks of inodes */
-		inode_block_t inodeListAux = inodeList[i]; /* copy the list of inodes of the current block */
-		for(int j = 0; j <= INODE_PER_BLOCK; j++){ /* go through all the inodes from a block */
-			if(count > INODE_MAX_NUMBER){ /* already checked all the inodes */
-				return 0;
-			}
-			if(strcmp(inodeListAux.inodeArray[j].name, "") != 0){ return -1;}
-			count++;
-		}
+/**
+ * Checks that a created file reaches its inode block in the image at the
+ * checkpoint, and not before: until then only the journal may hold it
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkMmapSync(){
+	char raw[BLOCK_SIZE];
+	if(createFile("mapped.txt") < 0 || bflush() < 0){ return -1;}
+	int inode = getInodePosition("mapped.txt");
+	if(inode < 0 || rawRead(sb.firstInode + inode / INODE_PER_BLOCK, raw) < 0){ return -1;}
+	if(((inode_block_t *) raw)->inodeArray[inode % INODE_PER_BLOCK].name[0] != '\0'){ return -1;}
+	if(journalCheckpoint() < 0 || rawRead(sb.firstInode + inode / INODE_PER_BLOCK, raw) < 0){ return -1;}
+	if(strcmp(((inode_block_t *) raw)->inodeArray[inode % INODE_PER_BLOCK].name, "mapped.txt") != 0){ return -1;}
+	if(removeFile("mapped.txt") < 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Test the readahead of sequential reads on a new file system
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_readahead(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (readahead)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (readahead)") < 0) {return -1;}
+	/* Small sequential reads are served by blocks prefetched in batches */
+	if(testOutput(checkReadaheadSeq(), "checkReadaheadSeq") < 0) {return -1;}
+	/* Reads out of sequence only fetch their own blocks */
+	if(testOutput(checkReadaheadRandom(), "checkReadaheadRandom") < 0) {return -1;}
+	/* A read starting and ending inside blocks fills only the bytes asked for */
+	if(testOutput(checkReadaheadSpan(), "checkReadaheadSpan") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (readahead)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks that a file read front to back in small chunks never misses the cache
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkReadaheadSeq(){
+	static char data[RA_FILE_SIZE], check[RA_FILE_SIZE];
+	bstats_t st;
+	for(int i = 0; i < RA_FILE_SIZE; i++){
+		data[i] = i * 7 % 251;
 	}
-    return 0;
+	if(createFile("ra.txt") < 0){ return -1;}
+	int fd = openFile("ra.txt");
+	if(fd < 0 || writeFile(fd, data, RA_FILE_SIZE) != RA_FILE_SIZE || closeFile(fd) < 0){ return -1;}
+
+	/* start with a cold cache */
+	if(bsetcache(CACHE_DEFAULT_BLOCKS, CACHE_LRU) < 0){ return -1;}
+	fd = openFile("ra.txt");
+	if(fd < 0){ return -1;}
+	bresetstats();
+	for(int offset = 0; offset < RA_FILE_SIZE; offset += 512){
+		if(readFile(fd, check + offset, 512) != 512){ return -1;}
+	}
+	bgetstats(&st);
+	if(readFile(fd, check, 512) != 0 || closeFile(fd) < 0){ return -1;}
+	if(memcmp(data, check, RA_FILE_SIZE) != 0){ return -1;}
+	/* the extents are inline in the inode: no indirect block to read */
+	if(st.misses != 0 || st.prefetched != RA_FILE_SIZE / BLOCK_SIZE){ return -1;}
+	return 0;
 }
 
 /**
- * Print the output message of a test method
+ * Checks that the readahead window collapses on seeks and restarts on sequential reads
  *
- * @param ret: the return value of the method executed
- * @param msg: String to print which is the name of the method executed
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkReadaheadRandom(){
+	static char data[RA_FILE_SIZE];
+	char check[100];
+	for(int i = 0; i < RA_FILE_SIZE; i++){
+		data[i] = i * 7 % 251;
+	}
+	int fd = openFile("ra.txt");
+	if(fd < 0){ return -1;}
+	if(lseekFile(fd, 6 * BLOCK_SIZE, FS_SEEK_CUR) < 0 || readFile(fd, check, 100) != 100){ return -1;}
+	if(memcmp(check, data + 6 * BLOCK_SIZE, 100) != 0 || fileTable[fd].raWindow != 0){ return -1;}
+	if(lseekFile(fd, -4 * BLOCK_SIZE, FS_SEEK_CUR) < 0 || readFile(fd, check, 100) != 100){ return -1;}
+	if(memcmp(check, data + 2 * BLOCK_SIZE + 100, 100) != 0 || fileTable[fd].raWindow != 0){ return -1;}
+	/* continuing from there is sequential again */
+	if(readFile(fd, check, 100) != 100 || fileTable[fd].raWindow != RA_MIN_BLOCKS){ return -1;}
+	if(memcmp(check, data + 2 * BLOCK_SIZE + 200, 100) != 0){ return -1;}
+	return closeFile(fd);
+}
+
+/**
+ * Checks reads from the seek pointer over a partial head block, whole blocks
+ * and a partial tail block, and that nothing is written past the bytes read
  *
  * @return 0 if all the tests are correct and -1 otherwise
  */
-int testOutput(int ret, char * msg){
-    if(ret != 0) {
-        fprintf(stdout, "%s%s%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST " ,msg, " ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
-        return -1;
-    }
-    fprintf(stdout, "%s%s%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST ", msg, " ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
-    return 0;
+int checkReadaheadSpan(){
+	static char data[RA_FILE_SIZE], check[RA_FILE_SIZE + 1];
+	for(int i = 0; i < RA_FILE_SIZE; i++){
+		data[i] = i * 7 % 251;
+	}
+	int fd = openFile("ra.txt");
+	if(fd < 0){ return -1;}
+	/* head, three whole blocks and tail */
+	memset(check, '#', sizeof(check));
+	int n = 3 * BLOCK_SIZE + 1000;
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || lseekFile(fd, 300, FS_SEEK_CUR) < 0 || readFile(fd, check, n) != n){ return -1;}
+	if(memcmp(check, data + 300, n) != 0 || check[n] != '#'){ return -1;}
+	/* whole blocks only, up to the end of the file */
+	memset(check, '#', sizeof(check));
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || lseekFile(fd, 4 * BLOCK_SIZE, FS_SEEK_CUR) < 0
+		|| readFile(fd, check, RA_FILE_SIZE) != 6 * BLOCK_SIZE){ return -1;}
+	if(memcmp(check, data + 4 * BLOCK_SIZE, 6 * BLOCK_SIZE) != 0 || check[6 * BLOCK_SIZE] != '#'){ return -1;}
+	return closeFile(fd);
 }
 
-int main() {
-	/*** test for making the File System ***/
-	test_mkFS();
+/**
+ * Test the counters of the entry points
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_stats(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (stats)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (stats)") < 0) {return -1;}
+	/* Calls, bytes and block I/O are counted per entry point */
+	if(testOutput(checkStatsCounts(), "checkStatsCounts") < 0) {return -1;}
+	/* Every call lands in one latency bucket */
+	if(testOutput(checkStatsHistogram(), "checkStatsHistogram") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (stats)") < 0) {return -1;}
 
-	/*** test for mounting the File System ***/
-	test_mountFS();
+	printf("\n");
+	return 0;
+}
 
-	/*** test for unmounting the File System ***/
-	test_unmountFS();
+/**
+ * Checks the counters after a known sequence of calls
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkStatsCounts(){
+	char data[3000], check[2 * BLOCK_SIZE];
+	fs_stats_t st;
+	memset(data, 's', 3000);
+
+	fsResetStats();
+	if(createFile("stats.txt") < 0){ return -1;}
+	int fd = openFile("stats.txt");
+	if(fd < 0 || writeFile(fd, data, 3000) != 3000){ return -1;}
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0){ return -1;}
+	if(readFile(fd, check, 1000) != 1000 || readFile(fd, check, 1000) != 1000){ return -1;}
+	/* failed calls are counted too */
+	if(lseekFile(fd, 5000, FS_SEEK_CUR) != -1 || closeFile(fd) < 0){ return -1;}
+#ifndef FS_STATS
+	/* built without the counters: fsGetStats reports none, zeroed */
+	return fsGetStats(&st) == -1 && st.op[FS_OP_CREATE].calls == 0 ? 0 : -1;
+#endif
+	if(fsGetStats(&st) < 0){ return -1;}
+
+	if(st.op[FS_OP_CREATE].calls != 1 || st.op[FS_OP_OPEN].calls != 1 || st.op[FS_OP_CLOSE].calls != 1){ return -1;}
+	/* the blocks of the write wait in memory for the close, and the reads find them there */
+	if(st.op[FS_OP_WRITE].calls != 1 || st.op[FS_OP_WRITE].bytes != 3000 || st.op[FS_OP_WRITE].blockWrites != 0){ return -1;}
+	if(st.op[FS_OP_CLOSE].blockWrites < 2){ return -1;}
+	if(st.op[FS_OP_READ].calls != 2 || st.op[FS_OP_READ].bytes != 2000 || st.op[FS_OP_READ].blockReads != 0){ return -1;}
+	if(st.op[FS_OP_LSEEK].calls != 2 || st.op[FS_OP_LSEEK].blockReads != 0 || st.op[FS_OP_REMOVE].calls != 0){ return -1;}
+	return 0;
+}
 
-	/*** test for creating a file ***/
-	test_createFile();
+/**
+ * Checks that the latency histogram of every entry point adds up to its calls
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkStatsHistogram(){
+	fs_stats_t st;
+#ifndef FS_STATS
+	/* built without the counters: resetting them does nothing */
+	fsResetStats();
+	return fsGetStats(&st) == -1 ? 0 : -1;
+#endif
+	if(fsGetStats(&st) < 0){ return -1;}
+	for(int op = 0; op < FS_OP_COUNT; op++){
+		unsigned long calls = 0;
+		for(int b = 0; b < FS_LATENCY_BUCKETS; b++){
+			calls += st.op[op].latency[b];
+		}
+		if(calls != st.op[op].calls){ return -1;}
+	}
+	fsResetStats();
+	if(fsGetStats(&st) < 0 || st.op[FS_OP_READ].calls != 0){ return -1;}
+	return 0;
+}
 
-	/*** test for removing a file ***/
-	test_removeFile();
+/**
+ * Test the hash index of the file names
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_nameIndex(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (name index)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (name index)") < 0) {return -1;}
+	/* Lookups follow creations and removals */
+	if(testOutput(checkNameIndexLookup(), "checkNameIndexLookup") < 0) {return -1;}
+	/* The entries are found in the device after a remount */
+	if(testOutput(checkNameIndexRemount(), "checkNameIndexRemount") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (name index)") < 0) {return -1;}
 
-	/* create the file to continue testing */
-	createFile("test.txt");
+	printf("\n");
+	return 0;
+}
 
-	/*** test for opening a file ***/
-	test_openFile();
+/**
+ * Checks that every file is found at its own inode and removed files are not found
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkNameIndexLookup(){
+	char name[NAME_MAX];
+	for(int i = 0; i < 16; i++){
+		sprintf(name, "index%d.txt", i);
+		if(createFile(name) < 0){ return -1;}
+	}
+	/* remove every third file, which breaks probe sequences of the index */
+	for(int i = 0; i < 16; i += 3){
+		sprintf(name, "index%d.txt", i);
+		if(removeFile(name) < 0 || getInodePosition(name) != -1 || removeFile(name) != -1){ return -1;}
+	}
+	for(int i = 0; i < 16; i++){
+		sprintf(name, "index%d.txt", i);
+		int inode = getInodePosition(name);
+		if(i % 3 == 0 ? inode != -1 : strcmp(inodeAt(inode)->name, name) != 0){ return -1;}
+	}
+	/* a removed name can be created again */
+	if(createFile("index3.txt") < 0 || createFile("index3.txt") != -1){ return -1;}
+	if(getInodePosition("") != -1 || getInodePosition("missing") != -1){ return -1;}
+	return 0;
+}
 
-	unmountFS();
-	createFile("text.txt");
-	openFile("text.txt");
+/**
+ * Checks that the files are found after unmounting and mounting again
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkNameIndexRemount(){
+	char name[NAME_MAX];
+	if(bflush() < 0 || unmountFS() < 0 || mountFS() < 0){ return -1;}
+	for(int i = 1; i < 16; i++){
+		sprintf(name, "index%d.txt", i);
+		int inode = getInodePosition(name);
+		if(i % 3 == 0 && i != 3){
+			if(inode != -1){ return -1;}
+		}
+		else if(inode < 0 || strcmp(inodeAt(inode)->name, name) != 0){
+			return -1;
+		}
+	}
+	return 0;
+}
 
-	test_write1();
-	test_write2();
-	test_write3();
-	test_write4();
-	test_write5();
-	test_write6();	
+/**
+ * Test the allocator of data blocks
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_alloc(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (alloc)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (alloc)") < 0) {return -1;}
+	/* Runs of blocks are handed out in order without writing them */
+	if(testOutput(checkAllocRuns(), "checkAllocRuns") < 0) {return -1;}
+	/* A full map fails at once and freed blocks are found after wrapping */
+	if(testOutput(checkAllocFull(), "checkAllocFull") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (alloc)") < 0) {return -1;}
 
-	/*** test for moving the pointer of a file ***/
-	test_lseek();
+	printf("\n");
+	return 0;
+}
 
-	/*** test for closing a file ***/
-	test_closeFile();
+/**
+ * Checks that allocN takes contiguous blocks from the cursor with no device writes
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkAllocRuns(){
+	int blocks[10];
+	int free = freeBlocks;
+	bstats_t st;
+	bresetstats();
+	if(allocN(10, blocks) < 0){ return -1;}
+	bgetstats(&st);
+	for(int i = 0; i < 10; i++){
+		if(blocks[i] != sb.firstDataBlock + i){ return -1;}
+	}
+	if(freeBlocks != free - 10 || st.writes != 0){ return -1;}
+	/* next-fit: the freed block is not taken again before the cursor wraps */
+	if(bfree(blocks[2] - sb.firstDataBlock) < 0 || freeBlocks != free - 9){ return -1;}
+	if(alloc() != sb.firstDataBlock + 10){ return -1;}
+	return 0;
+}
 
-	test_read();
+/**
+ * Checks the allocation of every free block and the reuse of freed ones
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkAllocFull(){
+	int free = freeBlocks;
+	int blocks[free + 1];
+	if(allocN(free + 1, blocks) != -1 || freeBlocks != free){ return -1;}
+	if(allocN(free, blocks) < 0 || freeBlocks != 0 || alloc() != -1){ return -1;}
+	/* the last block taken was the one freed by checkAllocRuns: the cursor is after it */
+	if(bfree(2) < 0 || bfree(5) < 0){ return -1;}
+	if(alloc() != sb.firstDataBlock + 5 || alloc() != sb.firstDataBlock + 2 || alloc() != -1){ return -1;}
+	return 0;
+}
+
+/**
+ * Test the extents that map the blocks of the files
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_extent(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (extent)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (extent)") < 0) {return -1;}
+	/* A contiguous file is a single extent in the inode */
+	if(testOutput(checkExtentInline(), "checkExtentInline") < 0) {return -1;}
+	/* A fragmented file keeps its extents in an extent block */
+	if(testOutput(checkExtentBlock(), "checkExtentBlock") < 0) {return -1;}
+	/* An open file reads its extent block once and writes it when it changed */
+	if(testOutput(checkExtentCache(), "checkExtentCache") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (extent)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks that bmap translates every byte of a contiguous file through its inline extent
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkExtentInline(){
+	static char data[8 * BLOCK_SIZE];
+	memset(data, 'e', sizeof(data));
+	if(createFile("inline.txt") < 0){ return -1;}
+	int fd = openFile("inline.txt");
+	if(fd < 0 || writeFile(fd, data, sizeof(data)) != sizeof(data) || closeFile(fd) < 0){ return -1;}
+	int inode_id = getInodePosition("inline.txt");
+	inode_t *inode = &inodeList[inode_id / INODE_PER_BLOCK].inodeArray[inode_id % INODE_PER_BLOCK];
+	if(inode->extents != 1 || inode->depth != 0 || inode->indirectBlock != 0 || inode->extent[0].length != 8){ return -1;}
+	for(int offset = 0; offset < sizeof(data); offset += 1000){
+		if(bmap(inode_id, offset) != inode->extent[0].start + offset / BLOCK_SIZE){ return -1;}
+	}
+	if(bmap(inode_id, sizeof(data)) != -1){ return -1;}
+	/* removing the file gives its blocks back */
+	int free = freeBlocks;
+	if(removeFile("inline.txt") < 0 || freeBlocks != free + 8){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks a file written over a fragmented block map
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkExtentBlock(){
+	static char data[5 * BLOCK_SIZE], check[5 * BLOCK_SIZE];
+	int blocks[10];
+	for(int i = 0; i < sizeof(data); i++){
+		data[i] = i * 13 % 251;
+	}
+	/* the journal logged the leaf of the root directory: it is free after the checkpoint */
+	if(journalCheckpoint() < 0){ return -1;}
+	/* leave a hole every other block at the start of the map */
+	allocInit();
+	if(allocN(10, blocks) < 0 || blocks[0] != sb.firstDataBlock){ return -1;}
+	for(int i = 0; i < 10; i += 2){
+		bfree(blocks[i] - sb.firstDataBlock);
+	}
+	allocInit();
+	/* the leaf of the root directory takes the first hole */
+	if(createFile("frag.txt") < 0 || sb.rootDir != blocks[0]){ return -1;}
+	int fd = openFile("frag.txt"), inode_id = fileInode(fd);
+	/* the delayed blocks of the write take their device blocks all at once */
+	if(fd < 0 || writeFile(fd, data, sizeof(data)) != sizeof(data) || delayFlush(inode_id) < 0){ return -1;}
+	inode_t *inode = &inodeList[inode_id / INODE_PER_BLOCK].inodeArray[inode_id % INODE_PER_BLOCK];
+	/* five single blocks: the other four holes and the first block after them */
+	if(inode->extents != 5 || inode->depth != 1 || inode->indirectBlock == 0){ return -1;}
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || readFile(fd, check, sizeof(check)) != sizeof(check)){ return -1;}
+	if(memcmp(data, check, sizeof(data)) != 0){ return -1;}
+	/* an overwrite keeps the blocks of the file and its extent block */
+	for(int i = 1; i < 10; i += 2){
+		bfree(blocks[i] - sb.firstDataBlock);
+	}
+	int extentBlock = inode->indirectBlock;
+	int free = freeBlocks;
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || writeFile(fd, data, BLOCK_SIZE) != BLOCK_SIZE){ return -1;}
+	if(freeBlocks != free || inode->depth != 1 || inode->extents != 5 || inode->indirectBlock != extentBlock){ return -1;}
+	/* removing the file gives back the extent block too */
+	if(closeFile(fd) < 0 || removeFile("frag.txt") < 0){ return -1;}
+	if(bitmap_getbit(blockMap, (extentBlock - sb.firstDataBlock)) != 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks that an open file keeps its extent block in memory: small reads pay
+ * for their data block only, and a write changes the extent block on the
+ * device at the next commit or at closeFile
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkExtentCache(){
+	static char data[5 * BLOCK_SIZE], check[5 * BLOCK_SIZE];
+	extent_block_t block;
+	bstats_t st;
+	int blocks[12];
+	for(int i = 0; i < sizeof(data); i++){
+		data[i] = i * 7 % 253;
+	}
+	if(createFile("cache.txt") < 0 || journalCheckpoint() < 0){ return -1;}
+	/* six holes: five for the data and one for the extent block */
+	int free = freeBlocks;
+	allocInit();
+	if(free != 11 || allocN(free, blocks) < 0){ return -1;}
+	memset(&block, 0, sizeof(extent_block_t));
+	for(int i = 0; i < free; i += 2){
+		if(bwrite(deviceImage, blocks[i], (char *) &block) < 0){ return -1;}
+		bfree(blocks[i] - sb.firstDataBlock);
+	}
+	allocInit();
+	int fd = openFile("cache.txt"), inode_id = fileInode(fd);
+	if(fd < 0 || writeFile(fd, data, sizeof(data)) != sizeof(data) || delayFlush(inode_id) < 0){ return -1;}
+	inode_t *inode = inodeAt(inode_id);
+	if(inode->depth != 1 || fileState[inode_id].extentCache == NULL || !fileState[inode_id].extentDirty){ return -1;}
+	/* nothing written yet: the commit writes it before the inode that points to it */
+	if(bread(deviceImage, inode->indirectBlock, (char *) &block) < 0 || block.extentArray[0].length != 0){ return -1;}
+	if(journalCommit() < 0 || fileState[inode_id].extentDirty){ return -1;}
+	if(bread(deviceImage, inode->indirectBlock, (char *) &block) < 0
+		|| memcmp(block.extentArray, fileState[inode_id].extentCache->extentArray, sizeof(extent_t) * inode->extents) != 0){ return -1;}
+	if(closeFile(fd) < 0 || fileState[inode_id].extentCache != NULL){ return -1;}
+	/* the first read of an open loads the extent block, the next ones only read their data block */
+	fd = openFile("cache.txt");
+	bresetstats();
+	if(fd < 0 || readFile(fd, check, 100) != 100){ return -1;}
+	bgetstats(&st);
+	if(st.reads != 2){ return -1;}
+	for(int offset = 100; offset < sizeof(check); offset += 100){
+		int n = offset + 100 > sizeof(check) ? sizeof(check) - offset : 100;
+		bresetstats();
+		if(readFile(fd, check + offset, n) != n){ return -1;}
+		bgetstats(&st);
+		if(st.reads != (offset / BLOCK_SIZE != (offset + n - 1) / BLOCK_SIZE) + 1){ return -1;}
+	}
+	if(memcmp(data, check, sizeof(data)) != 0 || closeFile(fd) < 0){ return -1;}
+	/* the extents survive a remount */
+	if(unmountFS() < 0 || mountFS() < 0){ return -1;}
+	fd = openFile("cache.txt");
+	memset(check, 0, sizeof(check));
+	if(fd < 0 || readFile(fd, check, sizeof(check)) != sizeof(check) || memcmp(data, check, sizeof(data)) != 0){ return -1;}
+	return closeFile(fd);
+}
+
+/**
+ * Test that the syncs only write the metadata that changed
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_dirty(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (dirty)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (dirty)") < 0) {return -1;}
+	/* Opening, reading and closing a file writes nothing */
+	if(testOutput(checkDirtyRead(), "checkDirtyRead") < 0) {return -1;}
+	/* A write logs the superblock and the inode block of the file only */
+	if(testOutput(checkDirtyWrite(), "checkDirtyWrite") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (dirty)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks that a read only workload makes no block writes, even after a remount
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkDirtyRead(){
+	char data[3000], check[3000];
+	bstats_t st;
+	memset(data, 'd', sizeof(data));
+	if(createFile("dirty.txt") < 0){ return -1;}
+	int fd = openFile("dirty.txt");
+	/* the file is still open in the inode written by writeFile */
+	if(fd < 0 || writeFile(fd, data, sizeof(data)) != sizeof(data)){ return -1;}
+	if(bflush() < 0 || unmountFS() < 0 || mountFS() < 0){ return -1;}
+	bresetstats();
+	for(int i = 0; i < 3; i++){
+		fd = openFile("dirty.txt");
+		if(fd < 0 || readFile(fd, check, sizeof(check)) != sizeof(check) || closeFile(fd) < 0){ return -1;}
+	}
+	bgetstats(&st);
+	if(st.writes != 0 || memcmp(data, check, sizeof(data)) != 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks the blocks written by a one block write
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkDirtyWrite(){
+	char data[100];
+	bstats_t st;
+	memset(data, 'w', sizeof(data));
+	int fd = openFile("dirty.txt");
+	bresetstats();
+	if(fd < 0 || writeFile(fd, data, sizeof(data)) != sizeof(data)){ return -1;}
+	bgetstats(&st);
+	/* the data block, overwritten in place: the metadata waits in the running transaction */
+	if(st.writes != 1){ return -1;}
+	/* no block was allocated and the size is the same: the close has nothing to commit */
+	if(closeFile(fd) < 0){ return -1;}
+	bgetstats(&st);
+	if(st.writes != 1 || sb.inodesBlocks < 2){ return -1;}
+	return 0;
+}
+
+/**
+ * Test writes that start at the seek pointer of the file
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_overwrite(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (overwrite)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (overwrite)") < 0) {return -1;}
+	/* A write inside the file keeps its blocks and the bytes around it */
+	if(testOutput(checkOverwriteInPlace(), "checkOverwriteInPlace") < 0) {return -1;}
+	/* Small appends stay in memory, then rewrite the last block of the file only */
+	if(testOutput(checkOverwriteAppend(), "checkOverwriteAppend") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (overwrite)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks a write over a partial head block, a whole block and a partial tail
+ * block in the middle of a file
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkOverwriteInPlace(){
+	static char data[4 * BLOCK_SIZE], patch[2 * BLOCK_SIZE], check[4 * BLOCK_SIZE];
+	for(int i = 0; i < sizeof(data); i++){
+		data[i] = i * 11 % 241;
+	}
+	memset(patch, 'p', sizeof(patch));
+	if(createFile("patch.bin") < 0){ return -1;}
+	int fd = openFile("patch.bin");
+	if(fd < 0 || writeFile(fd, data, sizeof(data)) != sizeof(data) || closeFile(fd) < 0){ return -1;}
+	fd = openFile("patch.bin");
+	inode_t *inode = inodeAt(fileInode(fd));
+	extent_t extent = inode->extent[0];
+	int free = freeBlocks;
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || lseekFile(fd, BLOCK_SIZE - 500, FS_SEEK_CUR) < 0){ return -1;}
+	if(writeFile(fd, patch, sizeof(patch)) != sizeof(patch) || fileTable[fd].ptr != 3 * BLOCK_SIZE - 500){ return -1;}
+	if(freeBlocks != free || inode->size != sizeof(data) || inode->extents != 1 || memcmp(&extent, &inode->extent[0], sizeof(extent_t)) != 0){ return -1;}
+	memcpy(data + BLOCK_SIZE - 500, patch, sizeof(patch));
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || readFile(fd, check, sizeof(check)) != sizeof(check)){ return -1;}
+	if(memcmp(data, check, sizeof(data)) != 0 || closeFile(fd) < 0){ return -1;}
+	/* and on the device */
+	if(unmountFS() < 0 || mountFS() < 0){ return -1;}
+	memset(check, 0, sizeof(check));
+	fd = openFile("patch.bin");
+	if(fd < 0 || readFile(fd, check, sizeof(check)) != sizeof(check) || memcmp(data, check, sizeof(data)) != 0){ return -1;}
+	return closeFile(fd);
+}
+
+/**
+ * Checks that appends of a few bytes stay in memory until the close, and that
+ * once the file has its blocks an append rewrites the last one only
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkOverwriteAppend(){
+	static char data[4 * BLOCK_SIZE], check[4 * BLOCK_SIZE];
+	bstats_t st;
+	for(int i = 0; i < sizeof(data); i++){
+		data[i] = 'a' + i % 26;
+	}
+	if(createFile("append.log") < 0 || journalCommit() < 0){ return -1;}
+	int free = freeBlocks;
+	int fd = openFile("append.log");
+	/* two blocks and a half in memory, taken in one run at the close */
+	int half = 2 * BLOCK_SIZE + BLOCK_SIZE / 2;
+	bresetstats();
+	for(int offset = 0; offset < half; offset += 100){
+		int n = offset + 100 > half ? half - offset : 100;
+		if(writeFile(fd, data + offset, n) != n){ return -1;}
+	}
+	bgetstats(&st);
+	inode_t *inode = inodeAt(fileInode(fd));
+	if(st.writes != 0 || freeBlocks != free || inode->size != 0 || fileSize(fileInode(fd)) != half){ return -1;}
+	if(closeFile(fd) < 0 || freeBlocks != free - 3 || inode->size != half || inode->extents != 1){ return -1;}
+	/* the last block of the file is rewritten in place */
+	fd = openFile("append.log");
+	if(fd < 0 || lseekFile(fd, 0, FS_SEEK_END) < 0){ return -1;}
+	for(int offset = half; offset < half + 500; offset += 100){
+		bresetstats();
+		if(writeFile(fd, data + offset, 100) != 100){ return -1;}
+		bgetstats(&st);
+		/* unless the journal commits its group */
+		if(st.writes != 1 && journalOps != 0){ return -1;}
+	}
+	/* past it, the rest waits in memory again */
+	int tail = sizeof(data) - half - 500;
+	if(writeFile(fd, data + half + 500, tail) != tail || inode->size != 3 * BLOCK_SIZE || freeBlocks != free - 3){ return -1;}
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || readFile(fd, check, sizeof(check)) != sizeof(check)){ return -1;}
+	if(memcmp(data, check, sizeof(data)) != 0 || closeFile(fd) < 0){ return -1;}
+	if(inode->size != sizeof(data) || inode->extents != 1 || inode->extent[0].length != 4){ return -1;}
+	return 0;
+}
+
+/**
+ * Test the blocks a file writes in memory before they take device blocks
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_delay(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (delay)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (delay)") < 0) {return -1;}
+	/* Files written at the same time still get one run of blocks each */
+	if(testOutput(checkDelayInterleave(), "checkDelayInterleave") < 0) {return -1;}
+	/* The delayed blocks of a removed file never reach the device */
+	if(testOutput(checkDelayRemove(), "checkDelayRemove") < 0) {return -1;}
+	/* The blocks promised to delayed writes are not taken by new files or directories */
+	if(testOutput(checkDelayFull(), "checkDelayFull") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (delay)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks two files written a block at a time in turns
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkDelayInterleave(){
+	static char data[4 * BLOCK_SIZE], check[4 * BLOCK_SIZE];
+	for(int i = 0; i < sizeof(data); i++){
+		data[i] = i * 3 % 239;
+	}
+	if(createFile("one.bin") < 0 || createFile("two.bin") < 0){ return -1;}
+	int one = openFile("one.bin"), two = openFile("two.bin");
+	if(one < 0 || two < 0){ return -1;}
+	for(int offset = 0; offset < sizeof(data); offset += BLOCK_SIZE){
+		if(writeFile(one, data + offset, BLOCK_SIZE) != BLOCK_SIZE){ return -1;}
+		if(writeFile(two, data + offset, BLOCK_SIZE) != BLOCK_SIZE){ return -1;}
+	}
+	/* still in memory after the commits of the journal */
+	if(journalCommit() < 0 || fileState[fileInode(one)].delayedBlocks != 4 || fileState[fileInode(two)].delayedBlocks != 4){ return -1;}
+	if(closeFile(one) < 0 || closeFile(two) < 0){ return -1;}
+	inode_t *inodeOne = inodeAt(getInodePosition("one.bin")), *inodeTwo = inodeAt(getInodePosition("two.bin"));
+	if(inodeOne->extents != 1 || inodeOne->extent[0].length != 4 || inodeTwo->extents != 1 || inodeTwo->extent[0].length != 4){ return -1;}
+	one = openFile("two.bin");
+	if(one < 0 || readFile(one, check, sizeof(check)) != sizeof(check) || memcmp(data, check, sizeof(data)) != 0){ return -1;}
+	return closeFile(one);
+}
+
+/**
+ * Checks that removing an open file with delayed blocks writes and takes no block
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkDelayRemove(){
+	static char data[3 * BLOCK_SIZE];
+	memset(data, 'r', sizeof(data));
+	if(createFile("gone.tmp") < 0){ return -1;}
+	int free = freeBlocks;
+	int fd = openFile("gone.tmp");
+	if(fd < 0 || writeFile(fd, data, sizeof(data)) != sizeof(data)){ return -1;}
+	int inode_id = fileInode(fd);
+	/* the remove closes the descriptor too */
+	if(removeFile("gone.tmp") < 0 || journalCheckpoint() < 0 || fileInode(fd) != -1){ return -1;}
+	if(freeBlocks != free || fileState[inode_id].delayed != NULL || fileState[inode_id].opens != 0 || delayedTotal != 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks a file whose delayed blocks fill the device, with a directory and
+ * a file created behind them, and that its data is all there after a remount
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkDelayFull(){
+	static char data[N_BLOCKS * BLOCK_SIZE], check[N_BLOCKS * BLOCK_SIZE];
+	for(int i = 0; i < sizeof(data); i++){
+		data[i] = i * 7 % 251;
+	}
+	if(createFile("full.bin") < 0){ return -1;}
+	int fd = openFile("full.bin");
+	long size = 0;
+	while(fd >= 0 && size < sizeof(data) && writeFile(fd, data + size, BLOCK_SIZE) == BLOCK_SIZE){
+		size += BLOCK_SIZE;
+	}
+	if(fd < 0 || size == 0 || size == sizeof(data)){ return -1;}
+	/* no block left for them: they fail before they take a promised one */
+	int dir = makeDir("d"), file = dir < 0 ? -1 : createFile("d/b");
+	if(freeBlocks < delayedTotal || closeFile(fd) < 0 || delayedTotal != 0){ return -1;}
+	if(unmountFS() < 0 || mountFS() < 0){ return -1;}
+	fd = openFile("full.bin");
+	if(fd < 0 || readFile(fd, check, sizeof(check)) != size || memcmp(data, check, size) != 0 || closeFile(fd) < 0){ return -1;}
+	if((file == 0 && removeFile("d/b") < 0) || (dir == 0 && removeDir("d") < 0)){ return -1;}
+	return removeFile("full.bin");
+}
+
+/**
+ * Test readFileAt, writeFileAt, readFileV and writeFileV
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_positional(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (positional)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (positional)") < 0) {return -1;}
+	/* Reads anywhere in the file leave the seek pointer where it was */
+	if(testOutput(checkReadAt(), "checkReadAt") < 0) {return -1;}
+	/* An overwrite at an offset writes its data blocks and no metadata */
+	if(testOutput(checkWriteAt(), "checkWriteAt") < 0) {return -1;}
+	/* A record of a header and a payload is one write: its block is read and written once */
+	if(testOutput(checkWriteV(), "checkWriteV") < 0) {return -1;}
+	/* One read fills several buffers in order */
+	if(testOutput(checkReadV(), "checkReadV") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (positional)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks readFileAt on a small file and on a file of three blocks
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkReadAt(){
+	static char data[3 * BLOCK_SIZE], check[3 * BLOCK_SIZE];
+	for(int i = 0; i < sizeof(data); i++){
+		data[i] = i * 5 % 247;
+	}
+	if(createFile("small.at") < 0 || createFile("big.at") < 0){ return -1;}
+	int small = openFile("small.at"), big = openFile("big.at");
+	if(small < 0 || big < 0 || writeFile(small, data, 40) != 40 || writeFile(big, data, sizeof(data)) != sizeof(data)){ return -1;}
+	if(closeFile(big) < 0 || (big = openFile("big.at")) < 0 || lseekFile(big, 0, FS_SEEK_BEGIN) < 0 || lseekFile(big, 100, FS_SEEK_CUR) < 0){ return -1;}
+	/* from the inode */
+	if(readFileAt(small, check, 30, 20) != 20 || memcmp(check, data + 20, 20) != 0 || fileTable[small].ptr != 40){ return -1;}
+	/* across the blocks, backwards */
+	for(long offset = sizeof(data) - 1000; offset >= 0; offset -= 1000){
+		if(readFileAt(big, check + offset, 1000, offset) != 1000){ return -1;}
+	}
+	if(readFileAt(big, check, 1000 - sizeof(data) % 1000, 0) != 1000 - sizeof(data) % 1000){ return -1;}
+	if(memcmp(data, check, sizeof(data)) != 0 || fileTable[big].ptr != 100){ return -1;}
+	/* nothing past the end, and no negative offset */
+	if(readFileAt(big, check, 10, sizeof(data)) != 0 || readFileAt(big, check, 10, sizeof(data) + 10) != 0 || readFileAt(big, check, 10, -1) != -1){ return -1;}
+	if(readFileAt(big, check, 10, sizeof(data) - 4) != 4 || memcmp(check, data + sizeof(data) - 4, 4) != 0){ return -1;}
+	return closeFile(small) < 0 || closeFile(big) < 0 ? -1 : 0;
+}
+
+/**
+ * Checks writeFileAt over the blocks of a file and at its end
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkWriteAt(){
+	static char data[3 * BLOCK_SIZE], check[3 * BLOCK_SIZE];
+	bstats_t st;
+	memset(data, 'w', sizeof(data));
+	int fd = openFile("big.at");
+	if(fd < 0 || readFile(fd, check, 10) != 10 || journalCommit() < 0){ return -1;}
+	/* over the first two blocks: two data blocks written, the tail one after reading it */
+	bresetstats();
+	if(writeFileAt(fd, data, BLOCK_SIZE + 10, 0) != BLOCK_SIZE + 10){ return -1;}
+	bgetstats(&st);
+	if(st.writes != 2 || st.reads != 1 || journalOps != 0 || fileTable[fd].ptr != 10){ return -1;}
+	if(readFileAt(fd, check, sizeof(check), 0) != sizeof(check) || memcmp(check, data, BLOCK_SIZE + 10) != 0 || check[BLOCK_SIZE + 10] == 'w'){ return -1;}
+	/* at the end the file grows; past it there would be a hole */
+	if(writeFileAt(fd, data, 100, sizeof(data) + 1) != -1 || writeFileAt(fd, data, 100, -1) != -1){ return -1;}
+	if(writeFileAt(fd, data, 100, sizeof(data)) != 100 || fileSize(fileInode(fd)) != sizeof(data) + 100 || fileTable[fd].ptr != 10){ return -1;}
+	if(readFileAt(fd, check, 200, sizeof(data) - 100) != 200 || memcmp(check + 100, data, 100) != 0){ return -1;}
+	if(closeFile(fd) < 0 || inodeAt(getInodePosition("big.at"))->size != sizeof(data) + 100){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks records of a header and a payload written with writeFileV over the
+ * blocks of a file
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkWriteV(){
+	char header[16], payload[100], check[sizeof(header) + sizeof(payload)];
+	static char first[BLOCK_SIZE / 2], second[BLOCK_SIZE + BLOCK_SIZE / 2], whole[2 * BLOCK_SIZE];
+	struct iovec iov[2] = {{header, sizeof(header)}, {payload, sizeof(payload)}};
+	struct iovec halves[2] = {{first, sizeof(first)}, {second, sizeof(second)}};
+	bstats_t st;
+	memset(header, 'h', sizeof(header));
+	memset(payload, 'p', sizeof(payload));
+	int fd = openFile("big.at");
+	if(fd < 0 || lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || lseekFile(fd, 200, FS_SEEK_CUR) < 0){ return -1;}
+	/* two partial writes would read and write the block twice */
+	bresetstats();
+	if(writeFileV(fd, iov, 2) != sizeof(check)){ return -1;}
+	bgetstats(&st);
+	if(st.reads != 1 || st.writes != 1 || fileTable[fd].ptr != 200 + sizeof(check)){ return -1;}
+	if(readFileAt(fd, check, sizeof(check), 200) != sizeof(check)){ return -1;}
+	if(memcmp(check, header, sizeof(header)) != 0 || memcmp(check + sizeof(header), payload, sizeof(payload)) != 0){ return -1;}
+	/* two whole blocks, the first across both buffers: written from a bounce block, none read back */
+	memset(first, 'f', sizeof(first));
+	memset(second, 's', sizeof(second));
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0){ return -1;}
+	bresetstats();
+	if(writeFileV(fd, halves, 2) != sizeof(whole)){ return -1;}
+	bgetstats(&st);
+	if(st.reads != 0 || st.writes != 2 || fileTable[fd].ptr != sizeof(whole)){ return -1;}
+	if(readFileAt(fd, whole, sizeof(whole), 0) != sizeof(whole)){ return -1;}
+	if(memcmp(whole, first, sizeof(first)) != 0 || memcmp(whole + sizeof(first), second, sizeof(second)) != 0){ return -1;}
+	/* no buffer, or no byte */
+	iov[0].iov_len = 0;
+	iov[1].iov_len = 0;
+	if(writeFileV(fd, iov, 2) != -1 || writeFileV(fd, iov, 0) != -1 || writeFileV(fd, NULL, 1) != -1){ return -1;}
+	return closeFile(fd);
+}
+
+/**
+ * Checks readFileV over buffers of several sizes, with the last one past the end of the file
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkReadV(){
+	static char whole[3 * BLOCK_SIZE + 100], a[10], b[BLOCK_SIZE + 5], c[3 * BLOCK_SIZE];
+	struct iovec iov[3] = {{a, sizeof(a)}, {b, sizeof(b)}, {c, sizeof(c)}};
+	int fd = openFile("big.at");
+	if(fd < 0 || readFile(fd, whole, sizeof(whole)) != sizeof(whole) || lseekFile(fd, 0, FS_SEEK_BEGIN) < 0){ return -1;}
+	if(lseekFile(fd, 7, FS_SEEK_CUR) < 0 || readFileV(fd, iov, 3) != sizeof(whole) - 7 || fileTable[fd].ptr != sizeof(whole)){ return -1;}
+	if(memcmp(a, whole + 7, sizeof(a)) != 0 || memcmp(b, whole + 7 + sizeof(a), sizeof(b)) != 0){ return -1;}
+	if(memcmp(c, whole + 7 + sizeof(a) + sizeof(b), sizeof(whole) - 7 - sizeof(a) - sizeof(b)) != 0){ return -1;}
+	/* at the end of the file */
+	if(readFileV(fd, iov, 3) != 0){ return -1;}
+	return closeFile(fd);
+}
+
+/**
+ * Test the open file table: descriptors of the same file
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_open(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (open)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (open)") < 0) {return -1;}
+	/* Two readers of a file, each with its seek pointer and readahead, and no metadata written */
+	if(testOutput(checkOpenShared(), "checkOpenShared") < 0) {return -1;}
+	/* Closing a descriptor leaves the others open and its number for the next open */
+	if(testOutput(checkOpenClose(), "checkOpenClose") < 0) {return -1;}
+	/* The close of the writer flushes its blocks, a reader goes on; a remove closes both */
+	if(testOutput(checkOpenWriter(), "checkOpenWriter") < 0) {return -1;}
+	/* A file opened until the table is full */
+	if(testOutput(checkOpenFull(), "checkOpenFull") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (open)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks that two descriptors of a file read it independently and that opening,
+ * reading and closing it writes nothing
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkOpenShared(){
+	static char data[8 * BLOCK_SIZE];
+	char check[100];
+	bstats_t st;
+	for(int i = 0; i < sizeof(data); i++){
+		data[i] = i * 13 % 251;
+	}
+	if(createFile("shared.txt") < 0){ return -1;}
+	int fd = openFile("shared.txt");
+	if(fd < 0 || writeFile(fd, data, sizeof(data)) != sizeof(data) || closeFile(fd) < 0 || journalCheckpoint() < 0){ return -1;}
+	int inode_id = getInodePosition("shared.txt");
+	bresetstats();
+	int one = openFile("shared.txt"), two = openFile("shared.txt");
+	if(one < 0 || two < 0 || one == two || fileState[inode_id].opens != 2){ return -1;}
+	/* interleaved, both stay sequential */
+	for(int offset = 0; offset < 300; offset += 100){
+		if(readFile(one, check, 100) != 100 || memcmp(check, data + offset, 100) != 0){ return -1;}
+		if(readFile(two, check, 100) != 100 || memcmp(check, data + offset, 100) != 0){ return -1;}
+	}
+	if(fileTable[one].raWindow == 0 || fileTable[two].raWindow == 0){ return -1;}
+	if(lseekFile(two, 0, FS_SEEK_BEGIN) < 0 || lseekFile(two, 4 * BLOCK_SIZE, FS_SEEK_CUR) < 0){ return -1;}
+	if(readFile(two, check, 100) != 100 || memcmp(check, data + 4 * BLOCK_SIZE, 100) != 0){ return -1;}
+	if(fileTable[one].ptr != 300 || fileTable[two].ptr != 4 * BLOCK_SIZE + 100){ return -1;}
+	if(closeFile(one) < 0 || closeFile(two) < 0 || fileState[inode_id].opens != 0){ return -1;}
+	bgetstats(&st);
+	if(st.writes != 0 || metaCount != 0 || journalOps != 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks that a closed descriptor can no longer be used and is the next one taken
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkOpenClose(){
+	char check[100];
+	int fds[3];
+	for(int i = 0; i < 3; i++){
+		if((fds[i] = openFile("shared.txt")) < 0){ return -1;}
+	}
+	if(closeFile(fds[1]) < 0 || closeFile(fds[1]) != -1 || readFile(fds[1], check, 100) != -1){ return -1;}
+	if(readFile(fds[0], check, 100) != 100 || readFile(fds[2], check, 100) != 100){ return -1;}
+	if(openFile("shared.txt") != fds[1]){ return -1;}
+	for(int i = 0; i < 3; i++){
+		if(closeFile(fds[i]) < 0){ return -1;}
+	}
+	return closeFile(-1) == -1 && closeFile(FILE_TABLE_SIZE) == -1 ? 0 : -1;
+}
+
+/**
+ * Checks a writer and a reader of the same file
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkOpenWriter(){
+	static char data[2 * BLOCK_SIZE], check[2 * BLOCK_SIZE];
+	memset(data, 'o', sizeof(data));
+	if(createFile("writer.txt") < 0){ return -1;}
+	int inode_id = getInodePosition("writer.txt");
+	int writer = openFile("writer.txt"), reader = openFile("writer.txt");
+	if(writer < 0 || reader < 0 || writeFile(writer, data, sizeof(data)) != sizeof(data)){ return -1;}
+	/* the reader sees the blocks still in memory */
+	if(fileState[inode_id].delayed == NULL || readFile(reader, check, BLOCK_SIZE) != BLOCK_SIZE || memcmp(check, data, BLOCK_SIZE) != 0){ return -1;}
+	if(closeFile(writer) < 0 || fileState[inode_id].delayed != NULL || inodeAt(inode_id)->size != sizeof(data)){ return -1;}
+	if(readFile(reader, check, sizeof(check)) != BLOCK_SIZE || memcmp(check, data + BLOCK_SIZE, BLOCK_SIZE) != 0){ return -1;}
+	writer = openFile("writer.txt");
+	if(writer < 0 || removeFile("writer.txt") < 0){ return -1;}
+	if(readFile(reader, check, 10) != -1 || closeFile(writer) != -1 || fileState[inode_id].opens != 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks that a file can be opened once per descriptor of the table and no more
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkOpenFull(){
+	for(int i = 0; i < FILE_TABLE_SIZE; i++){
+		if(openFile("shared.txt") != i){ return -1;}
+	}
+	if(openFile("shared.txt") != -2){ return -1;}
+	for(int i = 0; i < FILE_TABLE_SIZE; i++){
+		if(closeFile(i) < 0){ return -1;}
+	}
+	return fileState[getInodePosition("shared.txt")].opens == 0 ? 0 : -1;
+}
+
+/**
+ * Test the journal of the metadata
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_journal(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (journal)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (journal)") < 0) {return -1;}
+	/* Operations are committed in groups and written home at the checkpoint */
+	if(testOutput(checkJournalBatch(), "checkJournalBatch") < 0) {return -1;}
+	/* The transactions committed before a crash are replayed by mountFS */
+	if(testOutput(checkJournalReplay(), "checkJournalReplay") < 0) {return -1;}
+	/* A torn transaction is not replayed */
+	if(testOutput(checkJournalTorn(), "checkJournalTorn") < 0) {return -1;}
+	/* A crash at any write of a commit leaves no file pointing to blocks without its data */
+	if(testOutput(checkJournalCrash(), "checkJournalCrash") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (journal)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks that JOURNAL_BATCH creations make a single commit and no write home
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkJournalBatch(){
+	char name[NAME_MAX], raw[BLOCK_SIZE];
+	bstats_t st;
+	unsigned int seq = journalNextSeq;
+	bresetstats();
+	for(int i = 0; i < JOURNAL_BATCH; i++){
+		sprintf(name, "batch%d.txt", i);
+		if(createFile(name) < 0){ return -1;}
+		if(journalNextSeq != seq + (i == JOURNAL_BATCH - 1)){ return -1;}
+	}
+	bgetstats(&st);
+	/* a descriptor, the superblock, the first inode block, the maps and the leaf of the root directory */
+	if(st.writes != 6 || journalHead != 6){ return -1;}
+	if(rawRead(sb.firstInode, raw) < 0 || ((inode_block_t *) raw)->inodeArray[0].name[0] != '\0'){ return -1;}
+	/* the checkpoint writes the inodes home and empties the journal */
+	if(journalCheckpoint() < 0 || journalHead != 0){ return -1;}
+	if(rawRead(sb.firstInode, raw) < 0 || strcmp(((inode_block_t *) raw)->inodeArray[0].name, "batch0.txt") != 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks that a file created and committed before a crash is found after mounting again
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkJournalReplay(){
+	char raw[BLOCK_SIZE];
+	if(createFile("crash.txt") < 0 || journalCommit() < 0){ return -1;}
+	int inode = getInodePosition("crash.txt");
+	if(inode < 0){ return -1;}
+	/* crash: the device goes away with the inode only in the journal */
+	if(bumount() < 0){ return -1;}
+	if(rawRead(sb.firstInode + inode / INODE_PER_BLOCK, raw) < 0){ return -1;}
+	if(((inode_block_t *) raw)->inodeArray[inode % INODE_PER_BLOCK].name[0] != '\0'){ return -1;}
+	if(mountFS() < 0 || getInodePosition("crash.txt") != inode || bitmap_getbit(inodeMap, inode) == 0){ return -1;}
+	/* the replay left the journal empty */
+	if(rawRead(1, raw) < 0 || ((superblock_t *) raw)->journalSeq != journalNextSeq){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks that a transaction whose blocks do not match its checksum is ignored
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkJournalTorn(){
+	char raw[BLOCK_SIZE];
+	if(createFile("torn.txt") < 0 || journalCommit() < 0){ return -1;}
+	if(bumount() < 0){ return -1;}
+	/* damage the last block logged, as a write cut by the crash would */
+	if(rawRead(sb.journalStart + 2, raw) < 0){ return -1;}
+	raw[100] ^= 1;
+	int fd = open(DEVICE_IMAGE, O_RDWR);
+	if(fd < 0 || pwrite(fd, raw, BLOCK_SIZE, (off_t) BLOCK_SIZE * (sb.journalStart + 2)) != BLOCK_SIZE){ return -1;}
+	close(fd);
+	if(mountFS() < 0 || getInodePosition("torn.txt") != -1 || getInodePosition("crash.txt") < 0){ return -1;}
+	return 0;
+}
+
+/* Write calls the device of checkJournalCrash still takes before the crash, -1 for all of them */
+static int crashWrites = -1;
+
+/* Write of the device of checkJournalCrash: the ones after the crash are lost */
+static int crashWrite(int *blockNumbers, char **buffers, int count){
+	if(crashWrites == 0){ return 0;}
+	if(crashWrites > 0){ crashWrites--;}
+	return fileDevice.write(blockNumbers, buffers, count);
+}
+
+/**
+ * Checks that a crash after any write of the commit of an append leaves the file either
+ * as it was or with its data: the last block of the file, which the append changes in the
+ * cache, reaches the device before the blocks logged, and these before the descriptor
+ * that commits them
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkJournalCrash(){
+	char data[BLOCK_SIZE + 300], check[sizeof(data)], name[NAME_MAX];
+	dev_ops_t crashDevice = fileDevice;
+	int fd;
+	crashDevice.write = crashWrite;
+	for(int cut = 0; cut < 16; cut++){
+		sprintf(name, "cut%d.txt", cut);
+		memset(data, 'a' + cut, sizeof(data));
+		if(createFile(name) < 0 || (fd = openFile(name)) < 0){ return -1;}
+		if(writeFile(fd, data, BLOCK_SIZE + 100) != BLOCK_SIZE + 100 || closeFile(fd) < 0 || journalCheckpoint() < 0){ return -1;}
+		/* the device loses the writes from the cut on */
+		if(bumount() < 0 || bmountops(DEVICE_IMAGE, &crashDevice) < 0){ return -1;}
+		crashWrites = cut;
+		if((fd = openFile(name)) < 0 || lseekFile(fd, 0, FS_SEEK_END) < 0){ return -1;}
+		/* the append changes the cached last block and the size, which the commit logs */
+		if(writeFile(fd, data + BLOCK_SIZE + 100, 200) != 200 || journalCommit() < 0 || closeFile(fd) < 0){ return -1;}
+		int crashed = crashWrites == 0;
+		crashWrites = -1;
+		if(bumount() < 0 || mountFS() < 0 || (fd = openFile(name)) < 0){ return -1;}
+		int n = readFile(fd, check, sizeof(check));
+		if(n < BLOCK_SIZE + 100 || memcmp(check, data, n) != 0 || (!crashed && n != sizeof(data)) || closeFile(fd) < 0){ return -1;}
+		if(removeFile(name) < 0){ return -1;}
+		/* every cut up to the last write of the commit was tried */
+		if(!crashed){ return 0;}
+	}
+	return -1;
+}
+
+/**
+ * Test the file system on a RAM disk selected with setDevice
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_ramdisk(){
+	if(testOutput(bramdisk("ram0", DEV_SIZE), "bramdisk") < 0) {return -1;}
+	if(testOutput(setDevice("ram0", DEVICE_RAM), "setDevice") < 0) {return -1;}
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (ram)") < 0) {return -1;}
+	/* Files survive an unmount and mount of the RAM disk */
+	if(testOutput(checkRamPersist(), "checkRamPersist") < 0) {return -1;}
+	/* A mounted RAM disk can be neither freed nor replaced */
+	if(testOutput(checkRamBusy(), "checkRamBusy") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (ram)") < 0) {return -1;}
+	if(testOutput(bramfree("ram0"), "bramfree") < 0) {return -1;}
+	if(testOutput(setDevice(DEVICE_IMAGE, DEVICE_FD), "setDevice (image)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks that a file written on the RAM disk is read back after remounting
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkRamPersist(){
+	/* readFile fills whole blocks of the buffer */
+	char data[3000], check[2 * BLOCK_SIZE];
+	for(int i = 0; i < 3000; i++){
+		data[i] = 'a' + i % 26;
+	}
+	if(mountFS() < 0){ return -1;}
+	if(createFile("ram.txt") < 0){ return -1;}
+	int fd = openFile("ram.txt");
+	if(fd < 0 || writeFile(fd, data, 3000) != 3000 || closeFile(fd) < 0){ return -1;}
+	if(unmountFS() < 0 || mountFS() < 0){ return -1;}
+	/* the inode list is a copy of the RAM disk, written home at the checkpoints */
+	if((char *) inodeList == bpeek("ram0", sb.firstInode)){ return -1;}
+	fd = openFile("ram.txt");
+	if(fd < 0 || readFile(fd, check, 3000) < 0 || closeFile(fd) < 0){ return -1;}
+	if(memcmp(data, check, 3000) != 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks that the mounted RAM disk and device cannot be changed
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkRamBusy(){
+	if(bramfree("ram0") != -2){ return -1;}
+	if(bramdisk("ram0", DEV_SIZE) != -1){ return -1;}
+	if(setDevice(DEVICE_IMAGE, DEVICE_FD) != -1){ return -1;}
+	return 0;
+}
+
+/**
+ * Test the format on a device larger than the old limits of 40 files and 1 MiB files
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_scale(){
+	/* a sparse image: only the blocks written take space */
+	int fd = open(SCALE_IMAGE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0 || ftruncate(fd, SCALE_SIZE) < 0){ return -1;}
+	close(fd);
+	if(testOutput(setDevice(SCALE_IMAGE, DEVICE_FD), "setDevice (scale)") < 0) {return -1;}
+	if(testOutput(mkFS(SCALE_SIZE), "mkFS (scale)") < 0) {return -1;}
+	/* The inode table, the maps and the file size follow the size of the device */
+	if(testOutput(checkScaleFormat(), "checkScaleFormat") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (scale)") < 0) {return -1;}
+	/* Thousands of files survive a remount, which reads no inode block */
+	if(testOutput(checkScaleFiles(), "checkScaleFiles") < 0) {return -1;}
+	/* The entries of the root directory fill a B+tree of several levels */
+	if(testOutput(checkScaleDir(), "checkScaleDir") < 0) {return -1;}
+	/* A file larger than MAX_FILE_SIZE */
+	if(testOutput(checkScaleBigFile(), "checkScaleBigFile") < 0) {return -1;}
+	/* A file of more extents than an extent block holds, in a tree of two levels */
+	if(testOutput(checkScaleExtentTree(), "checkScaleExtentTree") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (scale)") < 0) {return -1;}
+	if(testOutput(setDevice(DEVICE_IMAGE, DEVICE_FD), "setDevice (image)") < 0) {return -1;}
+	unlink(SCALE_IMAGE);
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks the layout made by mkFS for the scale image
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkScaleFormat(){
+	/* one inode per BYTES_PER_INODE, filling the last inode block */
+	if(sb.inodesBlocks != (SCALE_SIZE / BYTES_PER_INODE + INODE_PER_BLOCK - 1) / INODE_PER_BLOCK || sb.numInodes != sb.inodesBlocks * INODE_PER_BLOCK){ return -1;}
+	/* one bit per block of the device does not fit in a block */
+	if(sb.bmapBlocks != 2 || sb.imapBlocks != 1 || sb.firstDataBlock != sb.bmapStart + 2){ return -1;}
+	if(sb.dataBlockNum != SCALE_SIZE / BLOCK_SIZE - sb.firstDataBlock || freeBlocks != sb.dataBlockNum){ return -1;}
+	if(sb.maxFileSize != sb.dataBlockNum * BLOCK_SIZE || sb.maxFileSize <= MAX_FILE_SIZE){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks the creation of SCALE_FILES files and their lookup after a remount
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkScaleFiles(){
+	char name[NAME_MAX];
+	bstats_t st;
+	for(int i = 0; i < SCALE_FILES; i++){
+		sprintf(name, "scale%d", i);
+		if(createFile(name) < 0){ return -1;}
+	}
+	if(freeInodes != sb.numInodes - SCALE_FILES){ return -1;}
+	if(unmountFS() < 0){ return -1;}
+	bresetstats();
+	if(mountFS() < 0){ return -1;}
+	bgetstats(&st);
+	/* the superblock, the journal and the maps */
+	if(st.reads >= sb.inodesBlocks || freeInodes != sb.numInodes - SCALE_FILES){ return -1;}
+	for(int i = 0; i < SCALE_FILES; i++){
+		sprintf(name, "scale%d", i);
+		if(getInodePosition(name) != i){ return -1;}
+	}
+	/* the last inode of the table */
+	for(int i = SCALE_FILES; i < sb.numInodes; i++){
+		sprintf(name, "scale%d", i);
+		if(createFile(name) < 0){ return -1;}
+	}
+	if(createFile("one too many") >= 0 || freeInodes != 0){ return -1;}
+	if(removeFile(name) < 0 || getInodePosition(name) != -1 || freeInodes != 1){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks a file of 4 MiB written and read back in one call each
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkScaleBigFile(){
+	int size = 4 * MAX_FILE_SIZE;
+	char *data = malloc(size), *check = malloc(size);
+	if(data == NULL || check == NULL){ return -1;}
+	for(int i = 0; i < size; i++){
+		data[i] = i * 7 % 253;
+	}
+	if(removeFile("scale0") < 0 || createFile("big.txt") < 0){ return -1;}
+	int fd = openFile("big.txt");
+	if(fd < 0 || writeFile(fd, data, size) != size){ return -1;}
+	inode_t *inode = inodeAt(fileInode(fd));
+	if(inode->size != size || inode->extents != 1 || inode->extent[0].length != size / BLOCK_SIZE){ return -1;}
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || readFile(fd, check, size) != size){ return -1;}
+	if(memcmp(data, check, size) != 0 || closeFile(fd) < 0){ return -1;}
+	free(data);
+	free(check);
+	return 0;
+}
+
+/**
+ * Checks a file written over a block map with a hole every other block: one
+ * extent per block, more than a leaf holds, so the extent tree gets an index
+ * node on top of its leaves. The blocks are found walking the tree and come
+ * back, nodes included, when the file is removed.
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkScaleExtentTree(){
+	int n = 2 * EXTENT_PER_BLOCK + 10;
+	int *holes = malloc(sizeof(int) * 2 * n);
+	char *data = malloc((long) n * BLOCK_SIZE), *check = malloc((long) n * BLOCK_SIZE);
+	bstats_t st;
+	if(holes == NULL || data == NULL || check == NULL){ return -1;}
+	for(long i = 0; i < (long) n * BLOCK_SIZE; i++){
+		data[i] = i * 11 % 241;
+	}
+	if(createFile("tree.bin") < 0 || allocN(2 * n, holes) < 0){ return -1;}
+	for(int i = 0; i < 2 * n; i += 2){
+		bfree(holes[i] - sb.firstDataBlock);
+	}
+	int available = freeBlocks;
+	blockCursor = holes[0] - sb.firstDataBlock;
+	int fd = openFile("tree.bin");
+	if(fd < 0 || writeFile(fd, data, n * BLOCK_SIZE) != n * BLOCK_SIZE || closeFile(fd) < 0){ return -1;}
+	/* three leaves under the root */
+	int inode_id = getInodePosition("tree.bin");
+	inode_t *inode = inodeAt(inode_id);
+	if(inode->depth != 2 || inode->extents != 3 || inode->size != (long) n * BLOCK_SIZE){ return -1;}
+	for(int i = 0; i < n; i++){
+		if(bmap(inode_id, (long) i * BLOCK_SIZE + i) != holes[2 * i]){ return -1;}
+	}
+	if(bmap(inode_id, (long) n * BLOCK_SIZE) != -1){ return -1;}
+	/* a lookup reads the root and a leaf */
+	bresetstats();
+	if(bmap(inode_id, (long) n / 2 * BLOCK_SIZE) != holes[n / 2 * 2]){ return -1;}
+	bgetstats(&st);
+	if(st.reads != 2){ return -1;}
+	if(unmountFS() < 0 || mountFS() < 0){ return -1;}
+	fd = openFile("tree.bin");
+	if(fd < 0 || readFile(fd, check, n * BLOCK_SIZE) != n * BLOCK_SIZE || memcmp(data, check, (long) n * BLOCK_SIZE) != 0){ return -1;}
+	if(closeFile(fd) < 0 || removeFile("tree.bin") < 0 || freeBlocks != available){ return -1;}
+	for(int i = 1; i < 2 * n; i += 2){
+		bfree(holes[i] - sb.firstDataBlock);
+	}
+	free(holes);
+	free(data);
+	free(check);
+	return 0;
+}
+
+/**
+ * Checks the B+tree of the root directory holding every inode of the scale
+ * image but one, and the listing of its entries in order
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkScaleDir(){
+	char name[NAME_MAX + 1] = "", previous[NAME_MAX + 1] = "";
+	dir_node_t node;
+	int entries = 0, ret;
+	if(sb.rootEntries != sb.numInodes - 1 || nodeRead(sb.rootDir, &node) < 0){ return -1;}
+	/* 4095 entries: more leaves than an inner node holds */
+	if(node.level != 2){ return -1;}
+	while((ret = readDir("/", name)) == 1){
+		if(strcmp(previous, name) >= 0 || getInodePosition(name) < 0){ return -1;}
+		strcpy(previous, name);
+		entries++;
+	}
+	if(ret != 0 || entries != sb.numInodes - 1){ return -1;}
+	return 0;
+}
+
+/**
+ * Test the directories
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_dir(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (dir)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (dir)") < 0) {return -1;}
+	/* Files and directories are created and found by their path */
+	if(testOutput(checkDirCreate(), "checkDirCreate") < 0) {return -1;}
+	/* The entries of a directory are listed in order */
+	if(testOutput(checkDirList(), "checkDirList") < 0) {return -1;}
+	/* The directories are found after a remount */
+	if(testOutput(checkDirRemount(), "checkDirRemount") < 0) {return -1;}
+	/* Only an empty directory is removed, and it gives its blocks back */
+	if(testOutput(checkDirRemove(), "checkDirRemove") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (dir)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks the creation of nested directories and of a file in them
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkDirCreate(){
+	char data[100], check[100];
+	memset(data, 'p', sizeof(data));
+	if(makeDir("docs") < 0 || makeDir("docs") != -1 || createFile("docs") != -1){ return -1;}
+	if(makeDir("/docs/src/") < 0 || createFile("docs/src/main.c") < 0){ return -1;}
+	/* the directories of the path must exist and be directories */
+	if(createFile("missing/main.c") != -2 || createFile("docs/src/main.c/x") != -2){ return -1;}
+	if(createFile("docs/0123456789012345678901234567890123/x") != -2 || createFile("/") != -2){ return -1;}
+	int fd = openFile("/docs//src/main.c");
+	if(fd < 0 || fileInode(fd) != getInodePosition("docs/src/main.c") || strcmp(inodeAt(fileInode(fd))->name, "main.c") != 0){ return -1;}
+	if(writeFile(fd, data, sizeof(data)) != sizeof(data) || lseekFile(fd, 0, FS_SEEK_BEGIN) < 0){ return -1;}
+	if(readFile(fd, check, sizeof(check)) != sizeof(check) || memcmp(data, check, sizeof(data)) != 0){ return -1;}
+	if(closeFile(fd) < 0){ return -1;}
+	/* a directory is neither opened nor removed as a file, nor a file as a directory */
+	int dir = getInodePosition("docs");
+	if(dir < 0 || openFile("docs") != -1 || removeFile("docs") != -1 || removeDir("docs/src/main.c") != -1){ return -1;}
+	if(readFile(dir, check, sizeof(check)) != -1 || writeFile(dir, data, sizeof(data)) != -1){ return -1;}
+	/* the same name in two directories */
+	if(createFile("main.c") < 0 || getInodePosition("main.c") == fd){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks the listing of the root directory and of a subdirectory
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkDirList(){
+	char *expected[] = {"b.txt", "c.txt", "src", "zz"};
+	char name[NAME_MAX + 1];
+	if(createFile("docs/readme") < 0 || createFile("docs/c.txt") < 0 || makeDir("docs/zz") < 0 || createFile("docs/b.txt") < 0){ return -1;}
+	/* the listing goes on from a name, whatever was created or removed in between */
+	strcpy(name, "");
+	for(int i = 0; i < 4; i++){
+		if(readDir("docs", name) != 1 || strcmp(name, expected[i]) != 0){ return -1;}
+		if(i == 1 && (createFile("docs/a.txt") < 0 || removeFile("docs/readme") < 0)){ return -1;}
+	}
+	if(readDir("docs", name) != 0 || readDir("missing", name) != -1 || readDir("docs/readme", name) != -1){ return -1;}
+	/* the root directory */
+	strcpy(name, "");
+	if(readDir("", name) != 1 || strcmp(name, "docs") != 0){ return -1;}
+	if(readDir("/", name) != 1 || strcmp(name, "main.c") != 0 || readDir("/", name) != 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks that the directories and their files are found after a remount
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkDirRemount(){
+	char check[100];
+	int file = getInodePosition("docs/src/main.c");
+	if(bflush() < 0 || unmountFS() < 0 || mountFS() < 0){ return -1;}
+	if(getInodePosition("docs/src/main.c") != file || getInodePosition("docs/zz") < 0){ return -1;}
+	int fd = openFile("docs/src/main.c");
+	if(fd < 0 || readFile(fd, check, sizeof(check)) != sizeof(check) || check[99] != 'p' || closeFile(fd) < 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks the removal of the directories, which leaves the device as mkFS did
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkDirRemove(){
+	char *files[] = {"docs/src/main.c", "docs/c.txt", "docs/b.txt", "docs/a.txt", "main.c"};
+	if(removeDir("docs") != -1 || removeDir("docs/src") != -1 || removeDir("missing") != -1){ return -1;}
+	for(int i = 0; i < 5; i++){
+		if(removeFile(files[i]) < 0){ return -1;}
+	}
+	if(removeDir("docs/src") < 0 || removeDir("docs/zz") < 0 || removeDir("docs") < 0 || removeDir("docs") != -1){ return -1;}
+	if(getInodePosition("docs") != -1 || sb.rootDir != 0 || sb.rootEntries != 0){ return -1;}
+	/* the nodes logged by the journal are freed by the checkpoint */
+	if(journalCheckpoint() < 0 || freeBlocks != sb.dataBlockNum || freeInodes != sb.numInodes){ return -1;}
+	return 0;
+}
+
+/**
+ * Test the files stored in their inode
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_inline(){
+	if(testOutput(mkFS(DEV_SIZE), "mkFS (inline)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (inline)") < 0) {return -1;}
+	/* A small file takes no data block and is read without block I/O */
+	if(testOutput(checkInlineSmall(), "checkInlineSmall") < 0) {return -1;}
+	/* A small file that grows moves to data blocks */
+	if(testOutput(checkInlinePromote(), "checkInlinePromote") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (inline)") < 0) {return -1;}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * Checks a file of 50 bytes written in two calls, read back before and after a remount
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkInlineSmall(){
+	char data[50], check[INODE_INLINE_SIZE];
+	bstats_t st;
+	memset(data, 'c', sizeof(data));
+	if(createFile("small.cfg") < 0){ return -1;}
+	int free = freeBlocks;
+	int fd = openFile("small.cfg");
+	if(fd < 0 || writeFile(fd, data, 20) != 20 || writeFile(fd, data, 30) != 30 || closeFile(fd) < 0){ return -1;}
+	inode_t *inode = inodeAt(getInodePosition("small.cfg"));
+	if(freeBlocks != free || inode->size != 50 || inode->extents != 0 || inode->depth != 0){ return -1;}
+	if(bflush() < 0 || unmountFS() < 0 || mountFS() < 0){ return -1;}
+	fd = openFile("small.cfg");
+	if(fd < 0 || readFile(fd, check, 10) != 10){ return -1;}
+	/* the inode block was read by the lookup: the contents come with it */
+	bresetstats();
+	if(readFile(fd, check + 10, sizeof(check)) != 40 || readFile(fd, check, sizeof(check)) != 0){ return -1;}
+	bgetstats(&st);
+	if(st.reads != 0 || memcmp(check + 10, data, 20) != 0 || closeFile(fd) < 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks that a write past INODE_INLINE_SIZE bytes moves the file to a data block with its contents
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkInlinePromote(){
+	char data[100], check[150];
+	memset(data, 'g', sizeof(data));
+	int free = freeBlocks;
+	int fd = openFile("small.cfg");
+	/* an append: the 50 bytes of the inode go first in the block */
+	if(fd < 0 || lseekFile(fd, 0, FS_SEEK_END) < 0 || writeFile(fd, data, sizeof(data)) != sizeof(data)){ return -1;}
+	/* the inode keeps them until the close gives the file its block */
+	inode_t *inode = inodeAt(fileInode(fd));
+	if(freeBlocks != free || inode->size != 50 || fileSize(fileInode(fd)) != 150){ return -1;}
+	if(lseekFile(fd, 0, FS_SEEK_BEGIN) < 0 || readFile(fd, check, sizeof(check)) != sizeof(check)){ return -1;}
+	if(check[0] != 'c' || check[49] != 'c' || memcmp(data, check + 50, sizeof(data)) != 0 || closeFile(fd) < 0){ return -1;}
+	if(freeBlocks != free - 1 || inode->size != 150 || inode->extents != 1 || inode->extent[0].length != 1){ return -1;}
+	/* removing it gives the block back, and the leaf of the root directory, now empty */
+	if(removeFile("small.cfg") < 0 || freeBlocks != free + 1 || sb.rootDir != 0){ return -1;}
+	return 0;
+}
+
+/**
+ * Checks that the file system has been correctly unmount from the simulated device
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkUnmountFS(){
+	/* check if the inode map is empty */
+	if(strcmp(inodeMap, "") != 0){ return -1;}
+
+	/* check if the inode map is empty */
+	if(strcmp(blockMap, "") != 0){ return -1;}
+
+	int count = 0;
+
+	/* check if the inodes are empty */
+	for(int i = 0; i < sb.inodesBlocks; i++){ /* check all the blocks of inodes */
+		inode_block_t inodeListAux = inodeList[i]; /* copy the list of inodes of the current block */
+		for(int j = 0; j < INODE_PER_BLOCK; j++){ /* go through all the inodes from a block */
+			if(count > sb.numInodes){ /* already checked all the inodes */
+				return 0;
+			}
+			if(strcmp(inodeListAux.inodeArray[j].name, "") != 0){ return -1;}
+			count++;
+		}
+	}
+    return 0;
+}
+
+/**
+ * Print the output message of a test method
+ *
+ * @param ret: the return value of the method executed
+ * @param msg: String to print which is the name of the method executed
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int testOutput(int ret, char * msg){
+    if(ret != 0) {
+        fprintf(stdout, "%s%s%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST " ,msg, " ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+        return -1;
+    }
+    fprintf(stdout, "%s%s%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST ", msg, " ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+    return 0;
+}
+
+#ifdef FS_THREADS
+/**
+ * Test the calls made from several threads at once, on a sparse image with the block cache
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int test_threads(){
+	int fd = open(SCALE_IMAGE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0 || ftruncate(fd, SCALE_SIZE) < 0){ return -1;}
+	close(fd);
+	if(testOutput(setDevice(SCALE_IMAGE, DEVICE_FD), "setDevice (threads)") < 0) {return -1;}
+	if(testOutput(mkFS(SCALE_SIZE), "mkFS (threads)") < 0) {return -1;}
+	if(testOutput(mountFS(), "mountFS (threads)") < 0) {return -1;}
+	/* Readers of their own file and of the same file read what was written */
+	if(testOutput(checkThreadsRead(), "checkThreadsRead") < 0) {return -1;}
+	/* Readers of a single descriptor read every part of the file once */
+	if(testOutput(checkThreadsSeek(), "checkThreadsSeek") < 0) {return -1;}
+	/* Threads that create, write and remove files leave the maps and the names right */
+	if(testOutput(checkThreadsWrite(), "checkThreadsWrite") < 0) {return -1;}
+	if(testOutput(unmountFS(), "unmountFS (threads)") < 0) {return -1;}
+	if(testOutput(setDevice(DEVICE_IMAGE, DEVICE_FD), "setDevice (image)") < 0) {return -1;}
+	unlink(SCALE_IMAGE);
+
+	printf("\n");
+	return 0;
+}
+
+/* Byte of a file of the concurrency tests at an offset */
+static char threadByte(int file, long offset){
+	return (char) (offset * 7 + file * 31 + offset / BLOCK_SIZE);
+}
+
+/* Descriptors read by the threads of checkThreadsRead, the shared file last */
+static int threadFds[THREADS + 1];
+
+/**
+ * Reads the file of the thread and the shared one at pseudo-random offsets, and
+ * the shared one from the seek pointer of a descriptor of the thread
+ *
+ * @return NULL if every read got the bytes of the file, non-NULL otherwise
+ */
+static void *threadRead(void *arg){
+	int t = (int) (long) arg;
+	char check[3000], name[32];
+	unsigned int seed = t + 1;
+	long ptr = 0;
+	sprintf(name, "read%d.th", THREADS);
+	int own = openFile(name);
+	if(own < 0){ return arg;}
+	for(int i = 0; i < THREAD_ROUNDS; i++){
+		int file = i % 2 == 0 ? t : THREADS;
+		long offset;
+		if(i % 4 == 3){
+			if(ptr + sizeof(check) > THREAD_FILE_SIZE){
+				if(lseekFile(own, 0, FS_SEEK_BEGIN) < 0){ return arg;}
+				ptr = 0;
+			}
+			if(readFile(own, check, sizeof(check)) != sizeof(check)){ return arg;}
+			offset = ptr;
+			ptr += sizeof(check);
+		}
+		else{
+			seed = seed * 1103515245 + 12345;
+			offset = seed % (THREAD_FILE_SIZE - sizeof(check));
+			if(readFileAt(threadFds[file], check, sizeof(check), offset) != sizeof(check)){ return arg;}
+		}
+		for(int b = 0; b < sizeof(check); b++){
+			if(check[b] != threadByte(file, offset + b)){ return arg;}
+		}
+	}
+	return closeFile(own) < 0 ? arg : NULL;
+}
+
+/**
+ * Checks THREADS readers, each one of its own file and all of them of a shared file
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkThreadsRead(){
+	static char data[THREAD_FILE_SIZE];
+	pthread_t threads[THREADS];
+	fs_stats_t st;
+	char name[32];
+	int ret = 0;
+	for(int f = 0; f <= THREADS; f++){
+		for(long b = 0; b < sizeof(data); b++){
+			data[b] = threadByte(f, b);
+		}
+		sprintf(name, "read%d.th", f);
+		if(createFile(name) < 0 || (threadFds[f] = openFile(name)) < 0){ return -1;}
+		if(writeFile(threadFds[f], data, sizeof(data)) != sizeof(data) || closeFile(threadFds[f]) < 0){ return -1;}
+		if((threadFds[f] = openFile(name)) < 0){ return -1;}
+	}
+	fsResetStats();
+	for(long t = 0; t < THREADS; t++){
+		if(pthread_create(&threads[t], NULL, threadRead, (void *) t) != 0){ return -1;}
+	}
+	for(int t = 0; t < THREADS; t++){
+		void *failed;
+		pthread_join(threads[t], &failed);
+		if(failed != NULL){ ret = -1;}
+	}
+	/* every call counted once, when the counters are built in */
+	if(fsGetStats(&st) == 0 && st.op[FS_OP_READ].calls != THREADS * THREAD_ROUNDS){ return -1;}
+	for(int f = 0; f <= THREADS; f++){
+		if(closeFile(threadFds[f]) < 0){ return -1;}
+	}
+	return ret;
+}
+
+/* Descriptor read by the threads of checkThreadsSeek, and the reads of each chunk of its file */
+static int seekFd;
+static int seekChunks[THREAD_FILE_SIZE / (BLOCK_SIZE / 4)];
+
+/**
+ * Reads chunks of a file, which holds the offset of every long at it, from the seek
+ * pointer of the descriptor all the threads share, up to its end
+ *
+ * @return NULL if every chunk read was a whole one of the file, non-NULL otherwise
+ */
+static void *threadSeek(void *arg){
+	long check[BLOCK_SIZE / 4 / sizeof(long)];
+	int n;
+	while((n = readFile(seekFd, check, sizeof(check))) == sizeof(check)){
+		if(check[0] % sizeof(check) != 0 || check[0] < 0 || check[0] >= THREAD_FILE_SIZE){ return arg;}
+		for(int i = 1; i < sizeof(check) / sizeof(long); i++){
+			if(check[i] != check[0] + i * sizeof(long)){ return arg;}
+		}
+		__atomic_fetch_add(&seekChunks[check[0] / sizeof(check)], 1, __ATOMIC_RELAXED);
+	}
+	return n == 0 ? NULL : arg;
+}
+
+/**
+ * Checks THREADS readers that share a descriptor: the seek pointer moves once per read,
+ * so each chunk of the file is read by one of them
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkThreadsSeek(){
+	static long data[THREAD_FILE_SIZE / sizeof(long)];
+	pthread_t threads[THREADS];
+	int ret = 0;
+	for(int i = 0; i < sizeof(data) / sizeof(long); i++){
+		data[i] = i * sizeof(long);
+	}
+	if(createFile("seek.th") < 0 || (seekFd = openFile("seek.th")) < 0){ return -1;}
+	if(writeFile(seekFd, data, sizeof(data)) != sizeof(data) || lseekFile(seekFd, 0, FS_SEEK_BEGIN) < 0){ return -1;}
+	for(long t = 0; t < THREADS; t++){
+		if(pthread_create(&threads[t], NULL, threadSeek, (void *) t) != 0){ return -1;}
+	}
+	for(int t = 0; t < THREADS; t++){
+		void *failed;
+		pthread_join(threads[t], &failed);
+		if(failed != NULL){ ret = -1;}
+	}
+	for(int k = 0; k < sizeof(seekChunks) / sizeof(int); k++){
+		if(seekChunks[k] != 1){ ret = -1;}
+	}
+	if(closeFile(seekFd) < 0){ return -1;}
+	return ret;
+}
+
+/**
+ * Creates, writes, reads back and removes files of its own
+ *
+ * @return NULL if all the calls succeeded, non-NULL otherwise
+ */
+static void *threadWrite(void *arg){
+	int t = (int) (long) arg;
+	char data[3000], check[3000], name[32];
+	for(int i = 0; i < THREAD_ROUNDS / 4; i++){
+		for(int b = 0; b < sizeof(data); b++){
+			data[b] = threadByte(t * THREAD_ROUNDS + i, b);
+		}
+		sprintf(name, "write%d_%d.th", t, i);
+		if(createFile(name) != 0){ return arg;}
+		int fd = openFile(name);
+		if(fd < 0 || writeFile(fd, data, sizeof(data)) != sizeof(data) || closeFile(fd) < 0){ return arg;}
+		if((fd = openFile(name)) < 0 || readFile(fd, check, sizeof(check)) != sizeof(check) || closeFile(fd) < 0){ return arg;}
+		if(memcmp(data, check, sizeof(data)) != 0){ return arg;}
+		/* every other file is removed */
+		if(i % 2 == 1 && removeFile(name) != 0){ return arg;}
+	}
+	return NULL;
+}
+
+/**
+ * Checks THREADS writers of files of their own, and the file system they leave after a remount
+ *
+ * @return 0 if all the tests are correct and -1 otherwise
+ */
+int checkThreadsWrite(){
+	pthread_t threads[THREADS];
+	char data[3000], check[3000], name[NAME_MAX + 1];
+	int ret = 0;
+	int blocks = freeBlocks, inodes = freeInodes;
+	for(long t = 0; t < THREADS; t++){
+		if(pthread_create(&threads[t], NULL, threadWrite, (void *) t) != 0){ return -1;}
+	}
+	for(int t = 0; t < THREADS; t++){
+		void *failed;
+		pthread_join(threads[t], &failed);
+		if(failed != NULL){ ret = -1;}
+	}
+	/* two blocks for every file kept, and the counts agree with the maps */
+	int kept = THREADS * THREAD_ROUNDS / 8;
+	if(ret < 0 || freeInodes != inodes - kept || unmountFS() < 0 || mountFS() < 0){ return -1;}
+	int counted = freeBlocks;
+	allocInit();
+	if(freeBlocks != counted || freeBlocks > blocks - 2 * kept){ return -1;}
+	/* the files kept, named in the root directory, with what their thread wrote */
+	int listed = 0;
+	name[0] = '\0';
+	while(readDir("", name) == 1){
+		int t, i;
+		if(sscanf(name, "write%d_%d.th", &t, &i) != 2){ continue;}
+		listed++;
+		for(int b = 0; b < sizeof(data); b++){
+			data[b] = threadByte(t * THREAD_ROUNDS + i, b);
+		}
+		int fd = openFile(name);
+		if(i % 2 == 1 || fd < 0 || readFile(fd, check, sizeof(check)) != sizeof(check) || closeFile(fd) < 0){ return -1;}
+		if(memcmp(data, check, sizeof(data)) != 0){ return -1;}
+	}
+	return listed == kept ? 0 : -1;
+}
+#endif
+
+int main() {
+	/*** test for making the File System ***/
+	test_mkFS();
+
+	/*** test for mounting the File System ***/
+	test_mountFS();
+
+	/*** test for the block cache of the mounted device ***/
+	test_cache();
+
+	/*** test for the vectored block I/O ***/
+	test_vector();
+
+	/*** test for unmounting the File System ***/
+	test_unmountFS();
+
+	/*** test for the mmap device backend ***/
+	test_mmap();
+
+	/*** test for creating a file ***/
+	test_createFile();
+
+	/*** test for removing a file ***/
+	test_removeFile();
+
+	/* create the file to continue testing */
+	createFile("test.txt");
+
+	/*** test for opening a file ***/
+	test_openFile();
+
+	unmountFS();
+	createFile("text.txt");
+	openFile("text.txt");
+
+	test_write1();
+	test_write2();
+	test_write3();
+	test_write4();
+	test_write5();
+	test_write6();	
+
+	/*** test for moving the pointer of a file ***/
+	test_lseek();
+
+	/*** test for closing a file ***/
+	test_closeFile();
+
+	test_read();
+
+	/*** test for the readahead of sequential reads ***/
+	test_readahead();
+
+	/*** test for the counters of the entry points ***/
+	test_stats();
+
+	/*** test for the index of the file names ***/
+	test_nameIndex();
+
+	/*** test for the allocator of data blocks ***/
+	test_alloc();
+
+	/*** test for the extents of the files ***/
+	test_extent();
+
+	/*** test for the writes of the metadata ***/
+	test_dirty();
+
+	/*** test for the journal of the metadata ***/
+	test_journal();
+
+	/*** test for the RAM disk backend ***/
+	test_ramdisk();
+
+	/*** test for a format sized for a larger device ***/
+	test_scale();
+
+	/*** test for the directories ***/
+	test_dir();
+
+	/*** test for the files stored in their inode ***/
+	test_inline();
+
+	/*** test for the writes from the seek pointer ***/
+	test_overwrite();
+
+	/*** test for the delayed allocation ***/
+	test_delay();
+
+	/*** test for the reads and writes at an offset ***/
+	test_positional();
+
+	/*** test for the open file table ***/
+	test_open();
+
+#ifdef FS_THREADS
+	/*** test for the calls from several threads ***/
+	test_threads();
+#endif
 
 	return 0;
 }
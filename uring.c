@@ -0,0 +1,217 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	uring.c
+ * @brief 	io_uring engine: queues the block transfers of a vectored request
+ * 			and reaps them together instead of blocking on each one.
+ * @date	01/03/2017
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "include/uring.h"
+
+/* Transfer queued in the current batch */
+typedef struct{
+	size_t bytes;                   /* Bytes the transfer must move */
+} ureq_t;
+
+static int ringFd = -1;             /* io_uring descriptor, -1 if not set up */
+static int devFd = -1;              /* Descriptor the transfers are issued on */
+
+static void *sqRing = NULL;         /* Submission ring mapping */
+static void *cqRing = NULL;         /* Completion ring mapping */
+static size_t sqRingSize = 0, cqRingSize = 0;
+static struct io_uring_sqe *sqes = NULL; /* Submission entries */
+static size_t sqesSize = 0;
+
+static unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+static unsigned *cqHead, *cqTail, *cqMask;
+static struct io_uring_cqe *cqes;
+
+static ureq_t reqs[URING_DEPTH];    /* Transfers of the current batch */
+static int queued = 0;              /* Transfers queued and not submitted yet */
+
+/*
+ * Sets up a ring for transfers on the descriptor fd.
+ * Returns 0 if correct or -1 if io_uring is not available on this kernel.
+ */
+int uringInit(int fd) {
+	struct io_uring_params p;
+
+	if(ringFd >= 0){
+		return -1;
+	}
+	memset(&p, 0, sizeof(p));
+	ringFd = syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+	if(ringFd < 0){
+		ringFd = -1;
+		return -1;
+	}
+
+	sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP){
+		if(cqRingSize > sqRingSize){
+			sqRingSize = cqRingSize;
+		}
+		cqRingSize = sqRingSize;
+	}
+	sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				  ringFd, IORING_OFF_SQ_RING);
+	if(sqRing == MAP_FAILED){
+		sqRing = NULL;
+		uringExit();
+		return -1;
+	}
+	if(p.features & IORING_FEAT_SINGLE_MMAP){
+		cqRing = sqRing;
+	}
+	else{
+		cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					  ringFd, IORING_OFF_CQ_RING);
+		if(cqRing == MAP_FAILED){
+			cqRing = NULL;
+			uringExit();
+			return -1;
+		}
+	}
+	sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ringFd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED){
+		sqes = NULL;
+		uringExit();
+		return -1;
+	}
+
+	sqHead = (unsigned *) ((char *) sqRing + p.sq_off.head);
+	sqTail = (unsigned *) ((char *) sqRing + p.sq_off.tail);
+	sqMask = (unsigned *) ((char *) sqRing + p.sq_off.ring_mask);
+	sqArray = (unsigned *) ((char *) sqRing + p.sq_off.array);
+	cqHead = (unsigned *) ((char *) cqRing + p.cq_off.head);
+	cqTail = (unsigned *) ((char *) cqRing + p.cq_off.tail);
+	cqMask = (unsigned *) ((char *) cqRing + p.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *) ((char *) cqRing + p.cq_off.cqes);
+
+	devFd = fd;
+	queued = 0;
+	return 0;
+}
+
+/*
+ * Tears down the ring. Queued transfers must have been submitted.
+ */
+void uringExit(void) {
+	if(sqes != NULL){
+		munmap(sqes, sqesSize);
+	}
+	if(cqRing != NULL && cqRing != sqRing){
+		munmap(cqRing, cqRingSize);
+	}
+	if(sqRing != NULL){
+		munmap(sqRing, sqRingSize);
+	}
+	if(ringFd >= 0){
+		close(ringFd);
+	}
+	sqes = NULL;
+	sqRing = cqRing = NULL;
+	ringFd = -1;
+	devFd = -1;
+	queued = 0;
+}
+
+/*
+ * Returns 1 if the ring is set up and 0 otherwise.
+ */
+int uringReady(void) {
+	return ringFd >= 0;
+}
+
+/*
+ * Queues a vectored transfer of the buffers of iov to consecutive positions
+ * of the device starting at offset. iov must stay valid until uringSubmit.
+ * Returns the number of the transfer in the batch or -1 if the ring is full.
+ */
+int uringQueue(off_t offset, struct iovec *iov, int count, int writing) {
+	if(ringFd < 0 || queued == URING_DEPTH){
+		return -1;
+	}
+	unsigned tail = *sqTail;
+	unsigned index = tail & *sqMask;
+	struct io_uring_sqe *sqe = &sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = writing ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = devFd;
+	sqe->off = offset;
+	sqe->addr = (unsigned long) iov;
+	sqe->len = count;
+	sqe->user_data = queued;
+	sqArray[index] = index;
+
+	reqs[queued].bytes = 0;
+	for(int i = 0; i < count; i++){
+		reqs[queued].bytes += iov[i].iov_len;
+	}
+	/* publish the entry to the kernel */
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	return queued++;
+}
+
+/*
+ * Submits the queued transfers and waits for all of them. failed[i] is set
+ * to 1 for every transfer i of the batch that failed, was short or could not
+ * be submitted, so that the caller can redo it synchronously, and to 0
+ * otherwise. It only returns once the kernel is done with every transfer it
+ * took, so the caller may release their buffers, unless the ring fails while
+ * waiting: the ring is then torn down and the next transfers are synchronous.
+ * Returns the number of system calls issued.
+ */
+int uringSubmit(char *failed) {
+	int calls = 0, pending = queued, unsubmitted = queued;
+
+	for(int i = 0; i < queued; i++){
+		failed[i] = 1;
+	}
+	while(pending > 0){
+		int ret = syscall(__NR_io_uring_enter, ringFd, unsubmitted, pending,
+						  IORING_ENTER_GETEVENTS, NULL, 0);
+		calls++;
+		if(ret >= 0){
+			unsubmitted -= ret < unsubmitted ? ret : unsubmitted;
+		}
+		else if(errno != EINTR && unsubmitted > 0){
+			/* the ring takes no more entries: the ones not submitted stay failed,
+			   the ones in flight are still waited for */
+			*sqTail = *sqHead;
+			pending -= unsubmitted;
+			unsubmitted = 0;
+		}
+		else if(errno != EINTR){
+			/* the ones in flight cannot be waited for: they stay failed, and the ring, which
+			   could still complete them, is torn down so that no later batch reaps them */
+			uringExit();
+			break;
+		}
+
+		/* reap every completion available */
+		unsigned head = *cqHead;
+		while(head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)){
+			struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+			int i = (int) cqe->user_data;
+			failed[i] = cqe->res < 0 || (size_t) cqe->res != reqs[i].bytes;
+			pending--;
+			head++;
+		}
+		__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+	}
+	queued = 0;
+	return calls;
+}